@@ -15,15 +15,28 @@
  * - Multiple account types (Savings, Checking, Fixed Deposit)
  * - Deposit, withdrawal, and transfer operations
  * - Interest calculation for different account types
- * - Persistent data storage using file I/O
+ * - Persistent storage in a versioned binary file (memory-mapped on load)
+ *   with an append-only transaction history, and import of the old text file
+ * - Write-ahead log with group commit and checkpoints, so a crash loses no
+ *   completed operation; a checkpoint rewrites only the changed accounts'
+ *   records in place, holding operations off only while it gathers them
+ * - Thread-safe operations with striped per-account locks; transfers are
+ *   atomic and deadlock-free
+ * - Deposits and withdrawals take no lock, with the log open too: accounts
+ *   are found through a lock-free index, balances are fixed-point atomics,
+ *   and the log records changes, which commute
  * - Transaction history tracking
+ * - Hash index for constant-time account lookup
  * - User-friendly menu interface
  *
  * Concepts Demonstrated:
  * - Class inheritance and polymorphism
  * - Virtual functions and abstract classes
- * - File I/O operations
+ * - File I/O operations (binary records, memory mapping)
  * - STL containers (vector, map)
+ * - Open-addressing hash table
+ * - Write-ahead logging and crash recovery
+ * - Threads, mutexes and condition variables
  * - Exception handling
  * ========================================
  */
@@ -36,9 +49,56 @@
 #include <ctime>
 #include <sstream>
 #include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <cstddef>
+#include <cerrno>
+#include <stdexcept>
+#include <chrono>
+#include <random>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#ifdef _WIN32
+#include <io.h>
+#endif
 
 using namespace std;
 
+// ========================================
+// OPERATION REPORTS
+// ========================================
+thread_local bool reportingEnabled = true;
+
+// Stream account operations report their outcome to: the console, or
+// nowhere on threads that silenced it with QuietReports
+ostream& report() {
+    static thread_local ostream silent(nullptr);
+    return reportingEnabled ? cout : silent;
+}
+
+// Silences report() on this thread while alive. Worker threads use it, as
+// their messages would interleave on the console.
+class QuietReports {
+private:
+    bool saved;
+
+public:
+    QuietReports() : saved(reportingEnabled) { reportingEnabled = false; }
+    ~QuietReports() { reportingEnabled = saved; }
+};
+
 // ========================================
 // TRANSACTION CLASS
 // Represents a single transaction record
@@ -47,33 +107,299 @@ class Transaction {
 private:
     string type;        // "Deposit", "Withdrawal", "Transfer"
     double amount;
-    string date;
+    time_t timestamp;   // Formatted only for display
     string description;
 
 public:
     // Constructor
     Transaction(string t, double amt, string desc = "")
-        : type(t), amount(amt), description(desc) {
-        // Get current date/time
-        time_t now = time(0);
-        char* dt = ctime(&now);
-        date = string(dt);
-        date.pop_back(); // Remove newline
-    }
+        : type(t), amount(amt), timestamp(time(0)), description(desc) {}
+
+    // Restore a saved transaction
+    Transaction(string t, double amt, string desc, time_t when)
+        : type(t), amount(amt), timestamp(when), description(desc) {}
 
     // Display transaction details
     void display() const {
         cout << left << setw(15) << type
              << setw(12) << fixed << setprecision(2) << amount
-             << setw(25) << date
+             << setw(25) << getDate()
              << description << endl;
     }
 
     // Getters for file operations
     string getType() const { return type; }
     double getAmount() const { return amount; }
-    string getDate() const { return date; }
+    time_t getTime() const { return timestamp; }
     string getDescription() const { return description; }
+
+    string getDate() const {
+        const char* text = ctime(&timestamp);
+        if (text == nullptr) return "Unknown date";
+        string date = text;
+        date.pop_back(); // Remove newline
+        return date;
+    }
+};
+
+// ========================================
+// BANK FILE FORMAT
+// Fixed-width account records and a name
+// table, plus an append-only history file
+// ========================================
+// Layout of bank_data.bin, in native byte order:
+//   BankFileHeader
+//   AccountRecord[accountCount]  sorted by account number
+//   AccountRecord[recordCapacity - accountCount]  room for new accounts
+//   char[stringsSize]            holder names, referenced by offset
+// The history file next to it is a HistoryFileHeader followed by
+// HistoryRecords, each padded to 8 bytes. Saving appends to it, and only
+// its first historySize bytes (as recorded in the bank file) are valid.
+// Operations since the last save are in the write-ahead log, a
+// LogFileHeader followed by LogRecords.
+// A checkpoint rewrites the records of changed accounts in place and
+// adds new ones in the spare room, names at the end. Its writes go to
+// bank_data.bin.checkpoint first, so a crash part way through them
+// leaves them to be redone: a CheckpointFileHeader, the new
+// BankFileHeader, CheckpointRecords, then the names to add. Meanwhile
+// the log records it saves are in bank_data.bin.wal.old.
+const char BANK_FILE_MAGIC[8] = { 'B', 'A', 'N', 'K', 'D', 'A', 'T', 'A' };
+const char HISTORY_FILE_MAGIC[8] = { 'B', 'A', 'N', 'K', 'H', 'I', 'S', 'T' };
+const char LOG_FILE_MAGIC[8] = { 'B', 'A', 'N', 'K', 'L', 'O', 'G', '\0' };
+const char CHECKPOINT_FILE_MAGIC[8] = { 'B', 'A', 'N', 'K', 'C', 'K', 'P', 'T' };
+const uint32_t BANK_FILE_VERSION = 4;      // 1: no checkpointSequence; 1, 2: balance in dollars; 1-3: no room
+const uint32_t HISTORY_FILE_VERSION = 1;
+const uint32_t LOG_FILE_VERSION = 3;       // 1: balances in dollars; 1, 2: balances, not changes
+const uint32_t CHECKPOINT_FILE_VERSION = 1;
+
+enum AccountType : uint8_t {
+    SAVINGS_ACCOUNT,
+    CHECKING_ACCOUNT,
+    FIXED_DEPOSIT_ACCOUNT
+};
+
+struct BankFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;        // sizeof(AccountRecord) of the writer
+    uint64_t nextAccountNumber;
+    uint64_t accountCount;
+    uint64_t stringsSize;
+    uint64_t historySize;       // Valid bytes of the history file
+    uint64_t checkpointSequence;    // Last log record included in this file
+    uint64_t recordCapacity;    // Records there is room for
+};
+
+// One account of any type; fields a type does not use are 0
+struct AccountRecord {
+    uint64_t number;            // Digits of the account number
+    uint32_t name;              // Holder name: offset into the names
+    uint32_t nameLength;
+    uint8_t type;               // AccountType
+    uint8_t matured;            // Fixed deposit paid out
+    uint16_t reserved;
+    int32_t tenureMonths;       // Fixed deposit
+    int64_t balance;            // In units of 1 / BALANCE_SCALE
+    double interestRate;        // Savings, fixed deposit
+    double limit;               // Savings: minimum balance; checking: overdraft
+    double fee;                 // Checking: transaction fee
+    int64_t maturityDate;       // Fixed deposit
+};
+
+struct HistoryFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+// Followed by typeLength + descriptionLength characters
+struct HistoryRecord {
+    uint64_t account;           // Digits of the account number
+    int64_t time;
+    double amount;
+    uint16_t typeLength;
+    uint16_t descriptionLength;
+    uint32_t reserved;
+};
+
+struct LogFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+enum LogRecordType : uint8_t {
+    LOG_OPEN_ACCOUNT = 1,       // AccountRecord, then the holder name
+    LOG_UPDATE = 2              // LogUpdate, then its accounts
+};
+
+// Followed by `size` bytes of payload and padding to 8 bytes
+struct LogRecord {
+    uint64_t sequence;          // Consecutive from 1
+    uint32_t size;
+    uint32_t checksum;          // CRC-32 of this header (with checksum 0) and the payload
+    uint8_t type;               // LogRecordType
+    uint8_t reserved[7];
+};
+
+// Every account one operation changed, so replay applies all or none.
+// Changes add up the same in any order, so records of concurrent
+// deposits and withdrawals to one account may be in either.
+struct LogUpdate {
+    uint32_t accountCount;      // LogAccountUpdates that follow
+    uint32_t reserved;
+};
+
+// Followed by `transactions` HistoryRecords, as in the history file
+struct LogAccountUpdate {
+    uint64_t account;           // Digits of the account number
+    int64_t change;             // To the balance, in units (before version 3: the balance after)
+    uint32_t transactions;      // Added by the operation
+    uint8_t matured;
+    uint8_t reserved[3];
+};
+
+struct CheckpointFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t checksum;          // CRC-32 of everything after this header
+    uint64_t recordCount;       // CheckpointRecords
+    uint64_t namesSize;         // Added to the end of the string table
+};
+
+// An account record and its position in the bank file
+struct CheckpointRecord {
+    uint64_t position;
+    AccountRecord record;
+};
+
+struct Crc32Table {
+    uint32_t entries[256];
+
+    Crc32Table() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int bit = 0; bit < 8; bit++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            entries[i] = c;
+        }
+    }
+};
+
+// CRC-32 (IEEE) of size bytes, continuing from crc
+uint32_t crc32(uint32_t crc, const char* data, size_t size) {
+    static const Crc32Table table;
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = table.entries[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// "ACC" + the number, zero-padded to six digits
+string accountNumberFor(uint64_t number) {
+    char text[24];
+    char* end = text + sizeof(text);
+    char* digit = end;
+    do {
+        *--digit = static_cast<char>('0' + number % 10);
+        number /= 10;
+    } while (number != 0 || end - digit < 6);
+    *--digit = 'C';
+    *--digit = 'C';
+    *--digit = 'A';
+    return string(digit, end);
+}
+
+// Balances are whole millionths of a dollar, so concurrent updates add up
+// exactly and fit in one atomic word
+const int64_t BALANCE_SCALE = 1000000;
+
+// Largest amount of one operation, and largest balance. Units of either
+// are far from the int64 limits, so adding or taking one cannot overflow.
+const double MAX_AMOUNT = 1e12;
+const int64_t MAX_BALANCE_UNITS = 1000000000000LL * BALANCE_SCALE;
+
+// For amounts within MAX_AMOUNT either way, which callers check
+int64_t toUnits(double amount) {
+    return llround(amount * BALANCE_SCALE);
+}
+
+double toDollars(int64_t units) {
+    return static_cast<double>(units) / BALANCE_SCALE;
+}
+
+// ========================================
+// OPERATION JOURNAL
+// What one operation changed, for its log
+// record
+// ========================================
+class Account;
+
+// Changes one operation made to one account
+struct AccountChanges {
+    const Account* account;
+    int64_t change;                     // To the balance, in units
+    vector<Transaction> transactions;   // Added, oldest first
+    bool matured;                       // A fixed deposit matured
+};
+
+// Changes of the operation this thread runs, while an OperationJournal
+// collects them
+thread_local vector<AccountChanges>* currentJournal = nullptr;
+
+// Entry for an account in this thread's journal, or nullptr if there is none
+AccountChanges* journalEntry(const Account* account) {
+    if (currentJournal == nullptr) return nullptr;
+    for (AccountChanges& entry : *currentJournal) {
+        if (entry.account == account) return &entry;
+    }
+    currentJournal->push_back(AccountChanges{ account, 0, vector<Transaction>(), false });
+    return &currentJournal->back();
+}
+
+// Collects what accounts report changing on this thread while alive. The
+// bank runs each logged operation inside one, so its record holds that
+// operation's changes only, whatever other threads do to the same
+// accounts meanwhile.
+class OperationJournal {
+private:
+    vector<AccountChanges> changes;
+    vector<AccountChanges>* saved;
+
+public:
+    // An inactive journal collects nothing, for operations not logged
+    explicit OperationJournal(bool active = true) : saved(currentJournal) {
+        if (active) currentJournal = &changes;
+    }
+    ~OperationJournal() { currentJournal = saved; }
+
+    OperationJournal(const OperationJournal&) = delete;
+    OperationJournal& operator=(const OperationJournal&) = delete;
+
+    const vector<AccountChanges>& entries() const { return changes; }
+};
+
+// Accounts changed since their bank last saved them, each listed once
+class UnsavedAccounts {
+private:
+    mutex lock;
+    vector<Account*> accounts;
+
+public:
+    void add(Account* account) {
+        lock_guard<mutex> guard(lock);
+        accounts.push_back(account);
+    }
+
+    // Every account listed, emptying the list
+    vector<Account*> take() {
+        lock_guard<mutex> guard(lock);
+        vector<Account*> taken;
+        taken.swap(accounts);
+        return taken;
+    }
 };
 
 // ========================================
@@ -81,19 +407,85 @@ public:
 // Defines common interface for all account types
 // ========================================
 class Account {
+private:
+    // Transactions added since the history was last read, newest first.
+    // Threads add to it without locking; reading moves them to the history.
+    struct PendingTransaction {
+        Transaction transaction;
+        PendingTransaction* next;
+    };
+    mutable atomic<PendingTransaction*> pending;
+    atomic<bool> unsaved;       // Changed since its bank last saved it
+    UnsavedAccounts* unsavedList;   // Where it is listed when it changes
+
 protected:
     string accountNumber;
     string accountHolderName;
-    double balance;
-    vector<Transaction> transactionHistory;
+    atomic<int64_t> balance;    // In units of 1 / BALANCE_SCALE
+    mutable vector<Transaction> transactionHistory;
+
+    // Add `units` to the balance as one atomic step, unless that takes it
+    // past MAX_BALANCE_UNITS
+    bool addToBalance(int64_t units, int64_t& after) {
+        int64_t current = balance.load();
+        do {
+            if (current > MAX_BALANCE_UNITS - units) return false;
+            after = current + units;
+        } while (!balance.compare_exchange_weak(current, after));
+        markUnsaved();
+        if (AccountChanges* entry = journalEntry(this)) entry->change += units;
+        return true;
+    }
+
+    // Take `units` plus `fee` from the balance as one atomic step, if
+    // taking `units` leaves at least `floor`. When another thread changes
+    // the balance in between, the check is made again on its result.
+    bool takeFromBalance(int64_t units, int64_t fee, int64_t floor, int64_t& after) {
+        int64_t current = balance.load();
+        do {
+            if (current - units < floor) return false;
+            after = current - units - fee;
+        } while (!balance.compare_exchange_weak(current, after));
+        markUnsaved();
+        if (AccountChanges* entry = journalEntry(this)) entry->change -= units + fee;
+        return true;
+    }
+
+    // Whether an amount may be deposited or withdrawn; reports why not
+    static bool checkAmount(double amount, const char* operation) {
+        if (!(amount > 0)) {    // NaN too
+            report() << "Error: Invalid " << operation << " amount!" << endl;
+            return false;
+        }
+        if (amount > MAX_AMOUNT) {
+            report() << "Error: Amounts are limited to $1,000,000,000,000!" << endl;
+            return false;
+        }
+        return true;
+    }
+
+    void recordWithdrawal(double amount, int64_t after) {
+        addTransaction(Transaction("Withdrawal", amount));
+        report() << "Successfully withdrawn $" << fixed << setprecision(2) << amount << endl;
+        report() << "New balance: $" << toDollars(after) << endl;
+    }
 
 public:
     // Constructor
     Account(string accNum, string name, double initialBalance = 0.0)
-        : accountNumber(accNum), accountHolderName(name), balance(initialBalance) {}
+        : pending(nullptr), unsaved(false), unsavedList(nullptr), accountNumber(accNum), accountHolderName(name), balance(toUnits(initialBalance)) {}
 
     // Virtual destructor for proper cleanup
-    virtual ~Account() {}
+    virtual ~Account() {
+        for (PendingTransaction* next = pending; next != nullptr;) {
+            PendingTransaction* done = next;
+            next = next->next;
+            delete done;
+        }
+    }
+
+    Account(const Account&) = delete;
+    Account& operator=(const Account&) = delete;
 
     // Pure virtual function - must be implemented by derived classes
     virtual void displayAccountType() const = 0;
@@ -101,37 +493,37 @@ public:
     // Virtual function - can be overridden by derived classes
     virtual double calculateInterest() = 0;
 
+    // Deposit and withdrawal change the balance without locking, so any
+    // number of threads may make them at once; the other operations need
+    // the account to themselves.
+
     // Deposit money into account
     virtual bool deposit(double amount) {
-        if (amount <= 0) {
-            cout << "Error: Invalid deposit amount!" << endl;
+        if (!checkAmount(amount, "deposit")) return false;
+
+        int64_t after;
+        if (!addToBalance(toUnits(amount), after)) {
+            report() << "Error: Deposit would exceed the maximum balance!" << endl;
             return false;
         }
-
-        balance += amount;
-        transactionHistory.push_back(Transaction("Deposit", amount));
-        cout << "Successfully deposited $" << fixed << setprecision(2) << amount << endl;
-        cout << "New balance: $" << balance << endl;
+        addTransaction(Transaction("Deposit", amount));
+        report() << "Successfully deposited $" << fixed << setprecision(2) << amount << endl;
+        report() << "New balance: $" << toDollars(after) << endl;
         return true;
     }
 
     // Withdraw money from account
     virtual bool withdraw(double amount) {
-        if (amount <= 0) {
-            cout << "Error: Invalid withdrawal amount!" << endl;
-            return false;
-        }
+        if (!checkAmount(amount, "withdrawal")) return false;
 
-        if (balance < amount) {
-            cout << "Error: Insufficient funds!" << endl;
-            cout << "Current balance: $" << balance << endl;
+        int64_t after;
+        if (!takeFromBalance(toUnits(amount), 0, 0, after)) {
+            report() << "Error: Insufficient funds!" << endl;
+            report() << "Current balance: $" << getBalance() << endl;
             return false;
         }
 
-        balance -= amount;
-        transactionHistory.push_back(Transaction("Withdrawal", amount));
-        cout << "Successfully withdrawn $" << fixed << setprecision(2) << amount << endl;
-        cout << "New balance: $" << balance << endl;
+        recordWithdrawal(amount, after);
         return true;
     }
 
@@ -142,7 +534,7 @@ public:
         cout << "Account Holder: " << accountHolderName << endl;
         cout << "Account Type: ";
         displayAccountType();
-        cout << "Current Balance: $" << fixed << setprecision(2) << balance << endl;
+        cout << "Current Balance: $" << fixed << setprecision(2) << getBalance() << endl;
         cout << "========================================\n" << endl;
     }
 
@@ -152,7 +544,7 @@ public:
         cout << "TRANSACTION HISTORY - " << accountNumber << endl;
         cout << "========================================" << endl;
 
-        if (transactionHistory.empty()) {
+        if (getTransactions().empty()) {
             cout << "No transactions yet." << endl;
         } else {
             cout << left << setw(15) << "Type"
@@ -171,14 +563,71 @@ public:
     // Getters
     string getAccountNumber() const { return accountNumber; }
     string getAccountHolderName() const { return accountHolderName; }
-    double getBalance() const { return balance; }
+    double getBalance() const { return toDollars(balance.load()); }
+
+    // Pay back an amount just withdrawn, which could not be paid in where
+    // it was going
+    void refund(double amount) {
+        int64_t after;
+        if (addToBalance(toUnits(amount), after)) {
+            addTransaction(Transaction("Refund", amount, "Transfer not completed"));
+        }
+    }
+
+    // Have the account list itself in `list` the first time it changes
+    // after being marked saved
+    void listChangesIn(UnsavedAccounts* list) { unsavedList = list; }
+
+    void markUnsaved() {
+        if (unsavedList != nullptr && !unsaved.load(memory_order_relaxed) && !unsaved.exchange(true)) {
+            unsavedList->add(this);
+        }
+    }
+
+    void markSaved() { unsaved = false; }
 
     // Setter for balance (used during transfers)
-    void setBalance(double newBalance) { balance = newBalance; }
+    void setBalance(double newBalance) {
+        balance = toUnits(newBalance);
+        markUnsaved();
+    }
 
-    // Add transaction to history
+    // Add transaction to history, and to the running operation's journal;
+    // safe from any number of threads
     void addTransaction(const Transaction& trans) {
-        transactionHistory.push_back(trans);
+        markUnsaved();
+        if (AccountChanges* entry = journalEntry(this)) entry->transactions.push_back(trans);
+        PendingTransaction* added = new PendingTransaction{ trans, pending.load() };
+        while (!pending.compare_exchange_weak(added->next, added)) {
+        }
+    }
+
+    // Every transaction, oldest first. Not safe while another thread
+    // reads the history, though others may add to it.
+    const vector<Transaction>& getTransactions() const {
+        PendingTransaction* newest = pending.exchange(nullptr);
+        if (newest != nullptr) {
+            size_t start = transactionHistory.size();
+            for (PendingTransaction* next = newest; next != nullptr;) {
+                PendingTransaction* done = next;
+                next = next->next;
+                transactionHistory.push_back(move(done->transaction));
+                delete done;
+            }
+            reverse(transactionHistory.begin() + start, transactionHistory.end());
+        }
+        return transactionHistory;
+    }
+
+    // Fill the type-specific fields of a saved record
+    virtual void writeRecord(AccountRecord& record) const {
+        record.balance = balance.load();
+    }
+
+    // Take back the fields operations change from a record
+    virtual void readRecord(const AccountRecord& record) {
+        balance = record.balance;
+        markUnsaved();
     }
 };
 
@@ -205,30 +654,40 @@ public:
 
     // Override: Calculate monthly interest
     double calculateInterest() override {
-        if (balance >= minimumBalance) {
-            double interest = (balance * interestRate * 30) / (365 * 100); // Monthly interest
-            balance += interest;
+        double current = getBalance();
+        if (current >= minimumBalance) {
+            double interest = (current * interestRate * 30) / (365 * 100); // Monthly interest
+            int64_t after;
+            if (!(interest <= MAX_AMOUNT) || !addToBalance(toUnits(interest), after)) {
+                report() << "Error: Interest would exceed the maximum balance!" << endl;
+                return 0.0;
+            }
 
             stringstream ss;
             ss << "Interest credited @ " << interestRate << "% p.a.";
-            transactionHistory.push_back(Transaction("Interest", interest, ss.str()));
+            addTransaction(Transaction("Interest", interest, ss.str()));
 
-            cout << "Interest credited: $" << fixed << setprecision(2) << interest << endl;
+            report() << "Interest credited: $" << fixed << setprecision(2) << interest << endl;
             return interest;
         } else {
-            cout << "Minimum balance not maintained. No interest credited." << endl;
+            report() << "Minimum balance not maintained. No interest credited." << endl;
             return 0.0;
         }
     }
 
     // Override: Withdraw with minimum balance check
     bool withdraw(double amount) override {
-        if (balance - amount < minimumBalance) {
-            cout << "Error: Withdrawal would breach minimum balance requirement of $"
+        if (!checkAmount(amount, "withdrawal")) return false;
+
+        int64_t after;
+        if (!takeFromBalance(toUnits(amount), 0, toUnits(minimumBalance), after)) {
+            report() << "Error: Withdrawal would breach minimum balance requirement of $"
                  << minimumBalance << endl;
             return false;
         }
-        return Account::withdraw(amount);
+
+        recordWithdrawal(amount, after);
+        return true;
     }
 
     // Override: Display with interest rate info
@@ -238,6 +697,13 @@ public:
         cout << "Minimum Balance: $" << minimumBalance << endl;
         cout << "========================================\n" << endl;
     }
+
+    void writeRecord(AccountRecord& record) const override {
+        Account::writeRecord(record);
+        record.type = SAVINGS_ACCOUNT;
+        record.interestRate = interestRate;
+        record.limit = minimumBalance;
+    }
 };
 
 // ========================================
@@ -249,169 +715,1933 @@ private:
     double overdraftLimit;
     double transactionFee;
 
-public:
-    // Constructor
-    CheckingAccount(string accNum, string name, double initialBalance = 0.0,
-                    double overdraft = 500.0, double fee = 1.0)
-        : Account(accNum, name, initialBalance),
-          overdraftLimit(overdraft), transactionFee(fee) {}
+public:
+    // Constructor
+    CheckingAccount(string accNum, string name, double initialBalance = 0.0,
+                    double overdraft = 500.0, double fee = 1.0)
+        : Account(accNum, name, initialBalance),
+          overdraftLimit(overdraft), transactionFee(fee) {}
+
+    // Override: Display account type
+    void displayAccountType() const override {
+        cout << "Checking Account" << endl;
+    }
+
+    // Override: No interest for checking accounts
+    double calculateInterest() override {
+        report() << "Checking accounts do not earn interest." << endl;
+        return 0.0;
+    }
+
+    // Override: Withdraw with overdraft facility
+    bool withdraw(double amount) override {
+        if (!checkAmount(amount, "withdrawal")) return false;
+
+        // The fee may take the balance past the overdraft limit
+        int64_t after;
+        if (!takeFromBalance(toUnits(amount), toUnits(transactionFee), -toUnits(overdraftLimit), after)) {
+            report() << "Error: Amount exceeds available balance + overdraft limit!" << endl;
+            report() << "Available: $" << (getBalance() + overdraftLimit) << endl;
+            return false;
+        }
+
+        addTransaction(Transaction("Withdrawal", amount));
+        addTransaction(Transaction("Fee", transactionFee, "Transaction fee"));
+
+        report() << "Successfully withdrawn $" << fixed << setprecision(2) << amount << endl;
+        report() << "Transaction fee: $" << transactionFee << endl;
+        report() << "New balance: $" << toDollars(after) << endl;
+
+        return true;
+    }
+
+    // Override: Display with overdraft info
+    void displayInfo() const override {
+        Account::displayInfo();
+        cout << "Overdraft Limit: $" << overdraftLimit << endl;
+        cout << "Transaction Fee: $" << transactionFee << endl;
+        cout << "Available Balance: $" << (getBalance() + overdraftLimit) << endl;
+        cout << "========================================\n" << endl;
+    }
+
+    void writeRecord(AccountRecord& record) const override {
+        Account::writeRecord(record);
+        record.type = CHECKING_ACCOUNT;
+        record.limit = overdraftLimit;
+        record.fee = transactionFee;
+    }
+};
+
+// ========================================
+// FIXED DEPOSIT ACCOUNT CLASS
+// Fixed deposit with lock-in period
+// ========================================
+class FixedDepositAccount : public Account {
+private:
+    double interestRate;
+    int tenureMonths;
+    time_t maturityDate;
+    atomic<bool> isMatured;
+
+public:
+    // Constructor
+    FixedDepositAccount(string accNum, string name, double amount,
+                        int months, double rate = 6.5)
+        : Account(accNum, name, amount),
+          interestRate(rate), tenureMonths(months), isMatured(false) {
+
+        // Calculate maturity date
+        time_t now = time(0);
+        struct tm* timeinfo = localtime(&now);
+        timeinfo->tm_mon += months;
+        maturityDate = mktime(timeinfo);
+    }
+
+    // Restore a saved fixed deposit
+    FixedDepositAccount(string accNum, string name, double amount, int months,
+                        double rate, time_t maturity, bool matured)
+        : Account(accNum, name, amount),
+          interestRate(rate), tenureMonths(months), maturityDate(maturity), isMatured(matured) {}
+
+    // Override: Display account type
+    void displayAccountType() const override {
+        cout << "Fixed Deposit Account" << endl;
+    }
+
+    // Override: Calculate interest at maturity
+    double calculateInterest() override {
+        double interest = (getBalance() * interestRate * tenureMonths) / (12 * 100);
+        report() << "Interest on maturity: $" << fixed << setprecision(2) << interest << endl;
+        return interest;
+    }
+
+    // Override: Deposits not allowed after creation
+    bool deposit(double amount) override {
+        report() << "Error: Additional deposits not allowed in Fixed Deposit accounts!" << endl;
+        return false;
+    }
+
+    // Override: Withdrawals only at maturity
+    bool withdraw(double amount) override {
+        time_t now = time(0);
+
+        if (now < maturityDate && !isMatured) {
+            report() << "Error: Premature withdrawal not allowed!" << endl;
+            report() << "Maturity date: " << ctime(&maturityDate);
+            return false;
+        }
+
+        // If withdrawing at maturity, add interest; only the first of
+        // concurrent withdrawals does
+        if (!isMatured.exchange(true)) {
+            markUnsaved();
+            if (AccountChanges* entry = journalEntry(this)) entry->matured = true;
+            double interest = calculateInterest();
+            int64_t after;
+            if (interest <= MAX_AMOUNT && addToBalance(toUnits(interest), after)) {
+                addTransaction(Transaction("Interest", interest, "Maturity interest"));
+            } else {
+                report() << "Error: Interest would exceed the maximum balance!" << endl;
+            }
+        }
+
+        return Account::withdraw(amount);
+    }
+
+    // Override: Display with FD specific info
+    void displayInfo() const override {
+        Account::displayInfo();
+        cout << "Interest Rate: " << interestRate << "% p.a." << endl;
+        cout << "Tenure: " << tenureMonths << " months" << endl;
+        cout << "Maturity Date: " << ctime(&maturityDate);
+        cout << "Status: " << (isMatured ? "Matured" : "Active") << endl;
+        cout << "========================================\n" << endl;
+    }
+
+    void writeRecord(AccountRecord& record) const override {
+        Account::writeRecord(record);
+        record.type = FIXED_DEPOSIT_ACCOUNT;
+        record.interestRate = interestRate;
+        record.tenureMonths = tenureMonths;
+        record.maturityDate = maturityDate;
+        record.matured = isMatured;
+    }
+
+    void readRecord(const AccountRecord& record) override {
+        Account::readRecord(record);
+        isMatured = record.matured != 0;
+    }
+};
+
+// Rebuild an account from its record (nullptr if the type is unknown)
+Account* accountFromRecord(const AccountRecord& record, const string& name) {
+    string accNum = accountNumberFor(record.number);
+    Account* account = nullptr;
+    switch (record.type) {
+        case SAVINGS_ACCOUNT:
+            account = new SavingsAccount(accNum, name, 0.0, record.interestRate, record.limit);
+            break;
+        case CHECKING_ACCOUNT:
+            account = new CheckingAccount(accNum, name, 0.0, record.limit, record.fee);
+            break;
+        case FIXED_DEPOSIT_ACCOUNT:
+            account = new FixedDepositAccount(accNum, name, 0.0, record.tenureMonths,
+                                              record.interestRate, record.maturityDate, record.matured != 0);
+            break;
+    }
+    if (account != nullptr) account->readRecord(record);    // The balance in units, exactly
+    return account;
+}
+
+// Units of a balance that older files store as a double of dollars;
+// false if it is out of range
+bool unitsFromDollars(int64_t stored, int64_t& units) {
+    double dollars;
+    memcpy(&dollars, &stored, sizeof(dollars));
+    if (!(fabs(dollars) <= MAX_AMOUNT)) return false;
+    units = toUnits(dollars);
+    return true;
+}
+
+// Whether the amounts in a record are ones operations could have left
+bool recordInRange(const AccountRecord& record) {
+    return record.balance <= MAX_BALANCE_UNITS && record.balance >= -2 * MAX_BALANCE_UNITS &&
+           fabs(record.limit) <= MAX_AMOUNT && fabs(record.fee) <= MAX_AMOUNT;
+}
+
+// Transaction stored at a position in a history file
+Transaction transactionAt(const char* at) {
+    HistoryRecord record;
+    memcpy(&record, at, sizeof(record));
+    const char* text = at + sizeof(record);
+    return Transaction(string(text, record.typeLength), record.amount,
+                       string(text + record.typeLength, record.descriptionLength),
+                       static_cast<time_t>(record.time));
+}
+
+// Bytes a stored transaction takes, padding included
+uint64_t storedSize(const HistoryRecord& record) {
+    return (sizeof(record) + record.typeLength + record.descriptionLength + 7) / 8 * 8;
+}
+
+// Store a transaction of an account at the end of out (8-byte aligned)
+void appendTransaction(string& out, uint64_t account, const Transaction& transaction) {
+    string type = transaction.getType().substr(0, UINT16_MAX);
+    string description = transaction.getDescription().substr(0, UINT16_MAX);
+    HistoryRecord record = {};
+    record.account = account;
+    record.time = transaction.getTime();
+    record.amount = transaction.getAmount();
+    record.typeLength = static_cast<uint16_t>(type.size());
+    record.descriptionLength = static_cast<uint16_t>(description.size());
+    out.append(reinterpret_cast<const char*>(&record), sizeof(record));
+    out += type;
+    out += description;
+    out.append((8 - out.size() % 8) % 8, '\0');
+}
+
+// Force a file's contents to disk
+bool syncFile(FILE* file) {
+#if defined(__unix__)
+    return fdatasync(fileno(file)) == 0;
+#elif defined(_WIN32)
+    return _commit(_fileno(file)) == 0;
+#else
+    (void)file;
+    return true;
+#endif
+}
+
+// Force a file, or a directory's entries, to disk by path
+bool syncPath(const string& path) {
+#ifdef __unix__
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    bool synced = fsync(fd) == 0;
+    close(fd);
+    return synced;
+#else
+    FILE* file = fopen(path.c_str(), "r+b");
+    if (file == nullptr) return true;   // Directories cannot be synced here
+    bool synced = syncFile(file);
+    fclose(file);
+    return synced;
+#endif
+}
+
+// ========================================
+// MAPPED FILE
+// Read-only view of a whole file
+// ========================================
+class MappedFile {
+private:
+    const char* contents;
+    size_t length;
+    vector<char> buffer;    // Used when the file cannot be mapped
+
+public:
+    explicit MappedFile(const string& path) : contents(nullptr), length(0) {
+#ifdef __unix__
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw runtime_error("Cannot open " + path + ": " + strerror(errno));
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+                contents = static_cast<const char*>(mapped);
+                length = info.st_size;
+            }
+        }
+        close(fd);
+        if (contents != nullptr) return;
+#endif
+        ifstream file(path, ios::binary);
+        if (!file) {
+            throw runtime_error("Cannot open " + path);
+        }
+        buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        contents = buffer.data();
+        length = buffer.size();
+    }
+
+    ~MappedFile() {
+#ifdef __unix__
+        if (buffer.empty() && contents != nullptr) {
+            munmap(const_cast<char*>(contents), length);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return contents; }
+    size_t size() const { return length; }
+};
+
+// ========================================
+// WRITE-AHEAD LOG
+// Each change is on disk before it is
+// acknowledged; waiting operations share
+// one write and flush (group commit)
+// ========================================
+class WriteAheadLog {
+private:
+    atomic<FILE*> file;         // Atomic so isOpen takes no lock
+    string path;
+    mutex lock;
+    condition_variable flushed;
+    string pending;             // Appended records not yet written
+    uint64_t lastSequence;      // Of the last appended record
+    uint64_t durableSequence;   // Records up to this one are written
+    uint64_t bytes;             // Log size, pending records included
+    bool flushing;              // A group is being written
+    size_t committing;          // Threads inside commit
+    bool failed;                // A write failed; nothing more is committed
+    bool syncEnabled;           // Off: survives a crash of the program, not of the machine
+    chrono::microseconds window;
+    uint64_t groups;
+    uint64_t committed;
+
+    bool writeHeader() {
+        LogFileHeader header = {};
+        memcpy(header.magic, LOG_FILE_MAGIC, sizeof(header.magic));
+        header.version = LOG_FILE_VERSION;
+        bytes = sizeof(header);
+        return fwrite(&header, sizeof(header), 1, file) == 1 && fflush(file) == 0 &&
+               (!syncEnabled || syncFile(file));
+    }
+
+public:
+    WriteAheadLog()
+        : file(nullptr), lastSequence(0), durableSequence(0), bytes(0), flushing(false), committing(0), failed(false),
+          syncEnabled(true), window(0), groups(0), committed(0) {}
+
+    ~WriteAheadLog() { close(); }
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    // Continue the log at logPath after its first `valid` bytes (0 starts a
+    // new log), whose last record is `last`
+    bool open(const string& logPath, uint64_t valid, uint64_t last) {
+        close();
+        path = logPath;
+        file = fopen(path.c_str(), valid == 0 ? "wb" : "r+b");
+        if (file == nullptr) return false;
+        lastSequence = durableSequence = last;
+        failed = false;
+        if (valid == 0) {
+            if (!writeHeader()) {
+                close();
+                return false;
+            }
+            return true;
+        }
+        // Cut off a record torn by a crash
+        fflush(file);
+#if defined(__unix__)
+        bool cut = ftruncate(fileno(file), valid) == 0;
+#elif defined(_WIN32)
+        bool cut = _chsize_s(_fileno(file), valid) == 0;
+#else
+        bool cut = true;
+#endif
+        if (!cut || fseek(file, 0, SEEK_END) != 0) {
+            close();
+            return false;
+        }
+        bytes = valid;
+        return true;
+    }
+
+    void close() {
+        if (file != nullptr) {
+            fclose(file);
+            file = nullptr;
+        }
+        pending.clear();
+    }
+
+    bool isOpen() const { return file != nullptr; }
+
+    // Whether groups are flushed to disk, and how long the first operation
+    // of a group waits for others to join it
+    void configure(bool sync, chrono::microseconds groupWindow) {
+        lock_guard<mutex> guard(lock);
+        syncEnabled = sync;
+        window = groupWindow;
+    }
+
+    // Queue a record; returns its sequence number, to pass to commit
+    uint64_t append(LogRecordType type, const string& payload) {
+        LogRecord record = {};
+        record.size = static_cast<uint32_t>(payload.size());
+        record.type = type;
+        string padding((8 - payload.size() % 8) % 8, '\0');
+
+        lock_guard<mutex> guard(lock);
+        record.sequence = ++lastSequence;
+        record.checksum = crc32(crc32(0, reinterpret_cast<const char*>(&record), sizeof(record)),
+                                payload.data(), payload.size());
+        pending.append(reinterpret_cast<const char*>(&record), sizeof(record));
+        pending += payload;
+        pending += padding;
+        bytes += sizeof(record) + payload.size() + padding.size();
+        return record.sequence;
+    }
+
+    // Wait until a record and all before it are on disk. The first waiter
+    // writes every pending record in one go; the others wait for it.
+    bool commit(uint64_t sequence) {
+        unique_lock<mutex> guard(lock);
+        committing++;
+        while (durableSequence < sequence && !failed) {
+            if (flushing) {
+                flushed.wait(guard);
+                continue;
+            }
+            flushing = true;
+            if (window.count() > 0 && committing > 1) {
+                flushed.wait_for(guard, window);    // Others are busy: let them join
+            }
+            string group;
+            group.swap(pending);
+            uint64_t last = lastSequence;
+            guard.unlock();
+
+            bool written = fwrite(group.data(), 1, group.size(), file) == group.size() &&
+                           fflush(file) == 0 && (!syncEnabled || syncFile(file));
+
+            guard.lock();
+            flushing = false;
+            if (written) {
+                durableSequence = last;
+                groups++;
+            } else {
+                failed = true;
+            }
+            flushed.notify_all();
+        }
+        committing--;
+        if (!failed) committed++;
+        return !failed;
+    }
+
+    // Start over empty, once a checkpoint holds every record's effects
+    bool reset() {
+        unique_lock<mutex> guard(lock);
+        while (flushing) {
+            flushed.wait(guard);    // The group being written still uses the file
+        }
+        if (file == nullptr) return false;
+        fclose(file);
+        file = fopen(path.c_str(), "wb");
+        pending.clear();
+        durableSequence = lastSequence;
+        failed = file == nullptr || !writeHeader();
+        return !failed;
+    }
+
+    // Keep the records so far at olderPath, and go on in a new file; a
+    // checkpoint saving their effects can then run while others are logged.
+    // Records still pending are written first, for their committers.
+    bool rotate(const string& olderPath) {
+        unique_lock<mutex> guard(lock);
+        while (flushing) {
+            flushed.wait(guard);
+        }
+        if (file == nullptr || failed) return false;
+        bool written = fwrite(pending.data(), 1, pending.size(), file) == pending.size() &&
+                       fflush(file) == 0 && (!syncEnabled || syncFile(file));
+        fclose(file);
+        file = nullptr;
+        pending.clear();
+        if (written && rename(path.c_str(), olderPath.c_str()) != 0) {
+            remove(olderPath.c_str());  // Windows will not rename over a file
+            written = rename(path.c_str(), olderPath.c_str()) == 0;
+        }
+        if (written) {
+            durableSequence = lastSequence;
+            file = fopen(path.c_str(), "wb");
+        }
+        failed = file == nullptr || !writeHeader();
+        flushed.notify_all();
+        return !failed;
+    }
+
+    uint64_t size() {
+        lock_guard<mutex> guard(lock);
+        return bytes;
+    }
+
+    uint64_t sequence() {
+        lock_guard<mutex> guard(lock);
+        return lastSequence;
+    }
+
+    // Commits per write, on average
+    double averageGroup() {
+        lock_guard<mutex> guard(lock);
+        return groups == 0 ? 0.0 : static_cast<double>(committed) / groups;
+    }
+};
+
+// ========================================
+// ACCOUNT INDEX
+// Open-addressing hash table from the number
+// in an account number to its account
+// ========================================
+// One thread at a time inserts, and any number find at once without a
+// lock. Entries are never removed until clear(); a table that fills up is
+// replaced by one twice its size, and kept, as a find may still be
+// probing it. Together the old tables are smaller than the current one.
+class AccountIndex {
+private:
+    struct Slot {
+        atomic<uint64_t> key;       // 0 marks an empty slot; stored last
+        atomic<Account*> account;
+    };
+
+    struct Table {
+        unique_ptr<Slot[]> slots;   // Power-of-two size, at most half full
+        size_t mask;
+        int shift;                  // 64 - log2(size)
+
+        Table(size_t size, int shift) : slots(new Slot[size]), mask(size - 1), shift(shift) {
+            for (size_t i = 0; i < size; i++) {
+                slots[i].key.store(0, memory_order_relaxed);
+                slots[i].account.store(nullptr, memory_order_relaxed);
+            }
+        }
+
+        // Fibonacci hashing spreads sequential account numbers over the table
+        size_t home(uint64_t key) const {
+            return static_cast<size_t>((key * 11400714819323198485ull) >> shift);
+        }
+
+        void place(uint64_t key, Account* account) {
+            size_t i = home(key);
+            while (slots[i].key.load(memory_order_relaxed) != 0) {
+                i = (i + 1) & mask;     // Linear probing
+            }
+            slots[i].account.store(account, memory_order_relaxed);
+            slots[i].key.store(key, memory_order_release);
+        }
+    };
+
+    atomic<Table*> current;
+    vector<unique_ptr<Table>> tables;   // The current one last
+    size_t count;
+
+    void grow() {
+        const Table& old = *tables.back();
+        unique_ptr<Table> table(new Table((old.mask + 1) * 2, old.shift - 1));
+        for (size_t i = 0; i <= old.mask; i++) {
+            uint64_t key = old.slots[i].key.load(memory_order_relaxed);
+            if (key != 0) table->place(key, old.slots[i].account.load(memory_order_relaxed));
+        }
+        current.store(table.get(), memory_order_release);
+        tables.push_back(move(table));
+    }
+
+public:
+    AccountIndex() : current(nullptr), count(0) { clear(); }
+
+    AccountIndex(const AccountIndex&) = delete;
+    AccountIndex& operator=(const AccountIndex&) = delete;
+
+    // Remove every entry; not while another thread finds
+    void clear() {
+        tables.clear();
+        tables.emplace_back(new Table(16, 60));
+        current.store(tables.back().get(), memory_order_release);
+        count = 0;
+    }
+
+    // Number in an account number, or 0 if accNum is not one. Only the form
+    // generateAccountNumber makes is accepted ("ACC", then at least six
+    // digits, zero-padded to six), so each key has exactly one spelling.
+    static uint64_t keyOf(const string& accNum) {
+        if (accNum.size() < 9 || accNum.size() > 21 || accNum.compare(0, 3, "ACC") != 0 ||
+            (accNum.size() > 9 && accNum[3] == '0')) {
+            return 0;
+        }
+        uint64_t key = 0;
+        for (size_t i = 3; i < accNum.size(); i++) {
+            if (accNum[i] < '0' || accNum[i] > '9') return 0;
+            key = key * 10 + (accNum[i] - '0');
+        }
+        return key;
+    }
+
+    // Add an account under its number (which must not be indexed yet)
+    void insert(Account* account) {
+        uint64_t key = keyOf(account->getAccountNumber());
+        if (key == 0) return;
+        if ((count + 1) * 2 > tables.back()->mask + 1) grow();
+        tables.back()->place(key, account);
+        count++;
+    }
+
+    // Account whose number has this key, or nullptr. One being inserted
+    // meanwhile may not be found yet.
+    Account* find(uint64_t key) const {
+        if (key == 0) return nullptr;
+        const Table& table = *current.load(memory_order_acquire);
+        for (size_t i = table.home(key);; i = (i + 1) & table.mask) {
+            uint64_t found = table.slots[i].key.load(memory_order_acquire);
+            if (found == key) return table.slots[i].account.load(memory_order_relaxed);
+            if (found == 0) return nullptr;
+        }
+    }
+
+    size_t size() const { return count; }
+};
+
+// ========================================
+// BANK CLASS
+// Manages all accounts and operations
+// ========================================
+class Bank {
+private:
+    vector<Account*> accounts;  // In account number order
+    AccountIndex index;         // Account number -> account, except loaded ones
+    string bankName;
+    string dataFile;            // Empty: accounts are kept in memory only
+    int nextAccountNumber;
+
+    // The file accounts were loaded from stays mapped. Its accounts come
+    // first in `accounts`, as nullptr until first used, when they are built
+    // from their records; so loading takes the same time for any number of
+    // accounts that are never touched.
+    unique_ptr<MappedFile> image;
+    const char* imageRecords;   // AccountRecords, by account number
+    const char* imageNames;
+    size_t imageAccounts;
+    uint64_t imageFirst;        // Numbers of loaded accounts are in
+    uint64_t imageEnd;          // [imageFirst, imageEnd)
+    uint32_t imageVersion;      // Of the file format
+    string imagePath;
+    unique_ptr<atomic<Account*>[]> built;   // Loaded accounts once built, by position
+
+    // The data file as the last save left it. When it is the image, a
+    // checkpoint updates it in place: it rewrites the records of the
+    // accounts listed in `unsaved`, and adds those opened since.
+    uint64_t fileAccounts;
+    uint64_t fileCapacity;      // Records there is room for
+    uint64_t fileStrings;       // String table size
+    vector<uint32_t> fileNames; // Name offsets of accounts from position imageAccounts on
+    UnsavedAccounts unsaved;
+    bool rewriteNeeded;         // A checkpoint failed part way: the next rewrites the file
+
+    // Their saved transactions: historyOffsets[historyBegin[i]] up to
+    // historyOffsets[historyBegin[i + 1]] locate those of loaded account i
+    unique_ptr<MappedFile> historyImage;
+    vector<uint32_t> historyBegin;
+    vector<uint64_t> historyOffsets;
+
+    // Transactions already in the history file, per account
+    vector<uint32_t> savedHistory;
+    string historyFile;         // History file savedHistory refers to
+    uint64_t historySize;       // Its valid bytes
+
+    // Operations are logged to dataFile + ".wal" until the next checkpoint
+    WriteAheadLog log;
+    uint64_t checkpointSequence;    // Last log record reflected in the data file
+    uint32_t logVersion;            // Of the log being recovered
+    vector<Account*> replayedAccounts;  // Changed by the replay so far
+    uint64_t checkpointBytes;       // Log size that triggers a checkpoint
+
+    // An operation holds the stripe of each account it changes: the lock
+    // its account number hashes to. One that changes two takes their
+    // stripes in index order, so concurrent transfers cannot deadlock.
+    // Deposits and withdrawals only count themselves in the stripe (see
+    // runUnlocked). Stripes are padded to a cache line each, so they do
+    // not share one.
+    static const size_t STRIPES = 256;
+    struct Stripe {
+        mutex lock;
+        atomic<uint32_t> unlocked;  // Operations running without the lock
+        char padding[64 - (sizeof(mutex) + sizeof(atomic<uint32_t>)) % 64];
+
+        Stripe() : unlocked(0) {}
+    };
+    Stripe stripes[STRIPES];
+    atomic<int> lockingAll; // Threads in lockAll: operations take their stripe
+    bool lockFreeUpdates;   // Else deposits and withdrawals take their stripe too
+    mutex accountsLock;     // accounts, index, the image and nextAccountNumber
+    mutex checkpointLock;   // One checkpoint or save at a time
+
+    // Whether an account may open with this balance; reports why not
+    static bool checkOpeningAmount(double amount) {
+        if (!(amount >= 0 && amount <= MAX_AMOUNT)) {
+            report() << "Error: The opening amount must be between $0 and $1,000,000,000,000!" << endl;
+            return false;
+        }
+        return true;
+    }
+
+    // What a checkpoint writes to update the data file in place
+    struct PendingCheckpoint {
+        BankFileHeader header;
+        vector<CheckpointRecord> records;   // Sorted by position once gathered
+        vector<pair<size_t, uint32_t>> savedBefore;    // Position and savedHistory before, of each
+        vector<Account*> accounts;          // Marked saved
+        vector<uint32_t> newNames;          // Name offsets of accounts opened since the last save
+        string names;                       // Added to the string table
+        vector<pair<uint64_t, Transaction>> transactions;  // Added to the history file, by account number
+    };
+
+    // Generate unique account number
+    string generateAccountNumber() {
+        return accountNumberFor(nextAccountNumber++);
+    }
+
+    // Take ownership of a new account and index it
+    void addAccount(Account* account) {
+        accounts.push_back(account);
+        savedHistory.push_back(0);
+        index.insert(account);
+        account->listChangesIn(dataFile.empty() ? nullptr : &unsaved);
+        account->markUnsaved();
+    }
+
+    AccountRecord loadedRecord(size_t i) const {
+        AccountRecord record;
+        memcpy(&record, imageRecords + i * sizeof(record), sizeof(record));
+        if (imageVersion < 3) unitsFromDollars(record.balance, record.balance);   // Checked on loading
+        return record;
+    }
+
+    uint64_t loadedNumber(size_t i) const {
+        uint64_t number;
+        memcpy(&number, imageRecords + i * sizeof(AccountRecord), sizeof(number));
+        return number;
+    }
+
+    // Position of a loaded account, or imageAccounts if there is none
+    size_t loadedPosition(uint64_t key) const {
+        if (key < imageFirst || key >= imageEnd) return imageAccounts;
+        // Numbers are usually consecutive, which places the account exactly
+        size_t guess = static_cast<size_t>(key - imageFirst);
+        if (guess < imageAccounts && loadedNumber(guess) == key) return guess;
+        size_t low = 0;
+        size_t high = imageAccounts;
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+            if (loadedNumber(middle) < key) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        return low < imageAccounts && loadedNumber(low) == key ? low : imageAccounts;
+    }
+
+    // Loaded account i, built on first use
+    Account* loadedAccount(size_t i) {
+        if (accounts[i] != nullptr) return accounts[i];
+        AccountRecord record = loadedRecord(i);
+        Account* account = accountFromRecord(record, string(imageNames + record.name, record.nameLength));
+        if (!historyBegin.empty()) {
+            for (uint32_t t = historyBegin[i]; t < historyBegin[i + 1]; t++) {
+                account->addTransaction(transactionAt(historyImage->data() + historyOffsets[t]));
+            }
+            savedHistory[i] = historyBegin[i + 1] - historyBegin[i];
+        }
+        account->listChangesIn(dataFile.empty() ? nullptr : &unsaved);
+        accounts[i] = account;
+        built[i].store(account, memory_order_release);
+        return account;
+    }
+
+    static size_t stripeOf(uint64_t key) {
+        return static_cast<size_t>((key * 0x9E3779B97F4A7C15ULL) >> 56);     // Top 8 bits: 256 stripes
+    }
+
+    mutex& stripeFor(uint64_t key) {
+        return stripes[stripeOf(key)].lock;
+    }
+
+    // Hold off every operation, e.g. to save a consistent state: no
+    // account is half changed, or changed but not yet logged. Operations
+    // running without their stripe are waited for; new ones take it.
+    void lockAll() {
+        lockingAll++;
+        for (Stripe& stripe : stripes) {
+            stripe.lock.lock();
+        }
+        accountsLock.lock();
+        for (Stripe& stripe : stripes) {
+            while (stripe.unlocked != 0) {
+                this_thread::yield();
+            }
+        }
+    }
+
+    void unlockAll() {
+        accountsLock.unlock();
+        for (size_t i = STRIPES; i-- > 0;) {
+            stripes[i].lock.unlock();
+        }
+        lockingAll--;
+    }
+
+    // Run a deposit or withdrawal of the account with this key, and log
+    // it. Both change the balance in one atomic step and are logged as
+    // that change, which adds up the same in any order, so they need not
+    // hold the stripe. Counting themselves in it holds off lockAll until
+    // their record is queued, and finds a built account without a lock.
+    // While lockAll runs, or to build the account, they take the stripe.
+    template <typename Operation>
+    bool runUnlocked(uint64_t key, Operation operation) {
+        Stripe& stripe = stripes[stripeOf(key)];
+        OperationJournal journal(log.isOpen());
+        bool done = false;
+        uint64_t sequence = 0;
+        stripe.unlocked++;
+        Account* account = lockFreeUpdates && lockingAll == 0 ? builtAccount(key) : nullptr;
+        if (account != nullptr) {
+            done = operation(account);
+            sequence = logChanges(journal);
+            stripe.unlocked--;
+        } else {
+            stripe.unlocked--;
+            lock_guard<mutex> guard(stripe.lock);
+            account = lookup(key);
+            if (account != nullptr) {
+                done = operation(account);
+                sequence = logChanges(journal);
+            }
+        }
+        if (account == nullptr) report() << "Error: Account not found!" << endl;
+        commitLog(sequence);
+        return done;
+    }
+
+    // Account with this number if it is built, or nullptr; without a lock.
+    // Callers hold the account's stripe or are counted in it, so lockAll,
+    // which may map the image anew, waits for them.
+    Account* builtAccount(uint64_t key) const {
+        if (key >= imageFirst && key < imageEnd) {
+            size_t i = loadedPosition(key);
+            return i < imageAccounts ? built[i].load(memory_order_acquire) : nullptr;
+        }
+        return index.find(key);
+    }
+
+    // Account with this number, or nullptr, as builtAccount; accountsLock
+    // is taken only to build a loaded account, or to find none
+    Account* lookup(uint64_t key) {
+        if (Account* account = builtAccount(key)) return account;
+        lock_guard<mutex> guard(accountsLock);
+        return accountFor(key);
+    }
+
+    // Position in `accounts` of the account with this number, which exists
+    size_t positionOf(uint64_t key) const {
+        size_t i = loadedPosition(key);
+        if (i < imageAccounts) return i;
+        // Opened since loading: after the loaded ones, in number order
+        auto opened = lower_bound(accounts.begin() + imageAccounts, accounts.end(), key,
+                                  [](const Account* account, uint64_t number) {
+                                      return AccountIndex::keyOf(account->getAccountNumber()) < number;
+                                  });
+        return opened - accounts.begin();
+    }
+
+    // Account with this number, or nullptr
+    Account* accountFor(uint64_t key) {
+        if (key >= imageFirst && key < imageEnd) {
+            size_t i = loadedPosition(key);
+            return i < imageAccounts ? loadedAccount(i) : nullptr;
+        }
+        return index.find(key);
+    }
+
+    void loadAllAccounts() {
+        for (size_t i = 0; i < imageAccounts; i++) {
+            loadedAccount(i);
+        }
+    }
+
+    // Drop every account
+    void clearAccounts() {
+        unsaved.take();
+        for (auto account : accounts) {
+            delete account;
+        }
+        accounts.clear();
+        savedHistory.clear();
+        index.clear();
+        image.reset();
+        built.reset();
+        imageRecords = imageNames = nullptr;
+        imageAccounts = 0;
+        imageFirst = imageEnd = 0;
+        imageVersion = BANK_FILE_VERSION;
+        imagePath.clear();
+        fileAccounts = fileCapacity = fileStrings = 0;
+        fileNames.clear();
+        rewriteNeeded = false;
+        historyImage.reset();
+        historyBegin.clear();
+        historyOffsets.clear();
+        historyFile.clear();
+        historySize = 0;
+        checkpointSequence = 0;
+    }
+
+    static bool fileExists(const string& path) {
+        return ifstream(path).good();
+    }
+
+    // Flush the directory holding path, so files created or renamed in it
+    // are there after a crash
+    static void syncDirectoryOf(const string& path) {
+        size_t slash = path.find_last_of("/\\");
+        syncPath(slash == string::npos ? "." : path.substr(0, slash + 1));
+    }
+
+    // The text file older versions kept next to the binary one
+    static string legacyFileFor(const string& path) {
+        size_t dot = path.find_last_of('.');
+        size_t slash = path.find_last_of("/\\");
+        if (dot == string::npos || (slash != string::npos && dot < slash)) return path + ".txt";
+        return path.substr(0, dot) + ".txt";
+    }
+
+    // Append transactions not yet in the history file. If it is not the
+    // one this bank was loaded from, the whole history is written anew.
+    void writeHistory(const string& path) {
+        bool append = path == historyFile && historySize > 0 && fileExists(path);
+        if (!append) loadAllAccounts();     // Saved transactions must be copied too
+        fstream out(path, ios::binary | ios::in | ios::out | (append ? ios::openmode() : ios::trunc));
+        if (!out) {
+            throw runtime_error("Cannot write " + path);
+        }
+        uint64_t size = historySize;
+        if (append) {
+            out.seekp(size);    // Anything past it was never committed
+        } else {
+            HistoryFileHeader header = {};
+            memcpy(header.magic, HISTORY_FILE_MAGIC, sizeof(header.magic));
+            header.version = HISTORY_FILE_VERSION;
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            size = sizeof(header);
+        }
+
+        string buffer;
+        for (size_t i = 0; i < accounts.size(); i++) {
+            if (accounts[i] == nullptr) continue;   // Untouched since loading
+            const vector<Transaction>& history = accounts[i]->getTransactions();
+            size_t saved = append ? savedHistory[i] : 0;
+            if (saved == history.size()) continue;
+            uint64_t number = AccountIndex::keyOf(accounts[i]->getAccountNumber());
+            for (size_t t = saved; t < history.size(); t++) {
+                appendTransaction(buffer, number, history[t]);
+            }
+            if (buffer.size() >= (1 << 20)) {
+                out.write(buffer.data(), buffer.size());
+                size += buffer.size();
+                buffer.clear();
+            }
+        }
+        out.write(buffer.data(), buffer.size());
+        size += buffer.size();
+        out.flush();
+        if (!out) {
+            throw runtime_error("Cannot write " + path);
+        }
+
+        for (size_t i = 0; i < accounts.size(); i++) {
+            if (accounts[i] != nullptr) {
+                savedHistory[i] = static_cast<uint32_t>(accounts[i]->getTransactions().size());
+            }
+        }
+        historyFile = path;
+        historySize = size;
+    }
+
+    // Map the bank file and check every record; accounts are built later
+    void readAccounts(const string& path) {
+        unique_ptr<MappedFile> file(new MappedFile(path));
+        BankFileHeader header = {};
+        const size_t VERSION_1_SIZE = offsetof(BankFileHeader, checkpointSequence);
+        const size_t VERSION_3_SIZE = offsetof(BankFileHeader, recordCapacity);
+        if (file->size() < VERSION_1_SIZE) {
+            throw runtime_error(path + " is too short for a bank file");
+        }
+        memcpy(&header, file->data(), VERSION_1_SIZE);
+        if (memcmp(header.magic, BANK_FILE_MAGIC, sizeof(header.magic)) != 0) {
+            throw runtime_error(path + " is not a bank file");
+        }
+        if (header.version < 1 || header.version > BANK_FILE_VERSION ||
+            header.recordSize != sizeof(AccountRecord)) {
+            throw runtime_error(path + " was written by an incompatible version");
+        }
+        size_t headerSize = header.version == 1 ? VERSION_1_SIZE : header.version < 4 ? VERSION_3_SIZE : sizeof(header);
+        if (file->size() < headerSize) {
+            throw runtime_error(path + " is too short for a bank file");
+        }
+        memcpy(&header, file->data(), headerSize);
+        if (header.version < 4) header.recordCapacity = header.accountCount;
+        uint64_t space = file->size() - headerSize;
+        if (header.recordCapacity > space / sizeof(AccountRecord) || header.accountCount > header.recordCapacity ||
+            header.stringsSize != space - header.recordCapacity * sizeof(AccountRecord)) {
+            throw runtime_error(path + " is truncated or has trailing data");
+        }
+        if (header.nextAccountNumber > INT32_MAX) {
+            throw runtime_error(path + " has an invalid next account number");
+        }
+
+        const char* records = file->data() + headerSize;
+        uint64_t previous = 0;
+        for (uint64_t i = 0; i < header.accountCount; i++) {
+            AccountRecord record;
+            memcpy(&record, records + i * sizeof(record), sizeof(record));
+            if (record.number <= previous || record.number >= header.nextAccountNumber) {
+                throw runtime_error(path + " has an invalid, repeated or unsorted account number");
+            }
+            if (record.name > header.stringsSize || record.nameLength > header.stringsSize - record.name) {
+                throw runtime_error(path + " has a name outside its string table");
+            }
+            if (record.type > FIXED_DEPOSIT_ACCOUNT) {
+                throw runtime_error(path + " has an unknown account type");
+            }
+            if ((header.version < 3 && !unitsFromDollars(record.balance, record.balance)) || !recordInRange(record)) {
+                throw runtime_error(path + " has an amount out of range");
+            }
+            previous = record.number;
+        }
+
+        clearAccounts();
+        adoptImage(move(file), path, header, headerSize);
+        accounts.assign(imageAccounts, nullptr);
+        savedHistory.assign(imageAccounts, 0);
+        nextAccountNumber = static_cast<int>(header.nextAccountNumber);
+        historySize = header.historySize;
+        checkpointSequence = header.checkpointSequence;
+    }
+
+    // Use a mapped bank file, whose header has been read, as the image of
+    // the first header.accountCount accounts
+    void adoptImage(unique_ptr<MappedFile> file, const string& path, const BankFileHeader& header, size_t headerSize) {
+        image = move(file);
+        imageRecords = image->data() + headerSize;
+        imageNames = imageRecords + header.recordCapacity * sizeof(AccountRecord);
+        imageAccounts = header.accountCount;
+        imageVersion = header.version;
+        imagePath = path;
+        imageFirst = imageEnd = 0;
+        if (imageAccounts > 0) {
+            imageFirst = loadedNumber(0);
+            imageEnd = loadedNumber(imageAccounts - 1) + 1;
+        }
+        fileAccounts = header.accountCount;
+        fileCapacity = header.recordCapacity;
+        fileStrings = header.stringsSize;
+        fileNames.clear();
+        built.reset(new atomic<Account*>[imageAccounts]);
+        for (size_t i = 0; i < imageAccounts; i++) {
+            built[i].store(i < accounts.size() ? accounts[i] : nullptr, memory_order_relaxed);
+        }
+    }
+
+    // Map the first `valid` bytes of a history file and group its
+    // transactions by loaded account
+    void readHistory(const string& path, uint64_t valid) {
+        unique_ptr<MappedFile> file(new MappedFile(path));
+        if (file->size() < valid || valid < sizeof(HistoryFileHeader)) {
+            throw runtime_error(path + " is shorter than its bank file records");
+        }
+        HistoryFileHeader header;
+        memcpy(&header, file->data(), sizeof(header));
+        if (memcmp(header.magic, HISTORY_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != HISTORY_FILE_VERSION) {
+            throw runtime_error(path + " is not a version 1 history file");
+        }
+
+        // Count each account's transactions, then place their offsets
+        vector<uint32_t> begin(imageAccounts + 1, 0);
+        uint64_t transactions = 0;
+        uint64_t lastKey = 0;
+        size_t last = imageAccounts;
+        for (uint64_t at = sizeof(header); at < valid; ) {
+            HistoryRecord record;
+            if (valid - at < sizeof(record)) {
+                throw runtime_error(path + " ends inside a transaction");
+            }
+            memcpy(&record, file->data() + at, sizeof(record));
+            if (valid - at < storedSize(record)) {
+                throw runtime_error(path + " ends inside a transaction");
+            }
+            if (record.account != lastKey) {
+                lastKey = record.account;
+                last = loadedPosition(record.account);
+            }
+            if (last == imageAccounts) {
+                throw runtime_error(path + " has a transaction for an unknown account");
+            }
+            if (++transactions > UINT32_MAX) {
+                throw runtime_error(path + " has too many transactions");
+            }
+            begin[last + 1]++;
+            at += storedSize(record);
+        }
+        for (size_t i = 0; i < imageAccounts; i++) {
+            begin[i + 1] += begin[i];
+        }
+
+        vector<uint64_t> offsets(transactions);
+        vector<uint32_t> next(begin.begin(), begin.end() - 1);
+        lastKey = 0;
+        for (uint64_t at = sizeof(header); at < valid; ) {
+            HistoryRecord record;
+            memcpy(&record, file->data() + at, sizeof(record));
+            if (record.account != lastKey) {
+                lastKey = record.account;
+                last = loadedPosition(record.account);
+            }
+            offsets[next[last]++] = at;
+            at += storedSize(record);
+        }
+
+        historyImage = move(file);
+        historyBegin.swap(begin);
+        historyOffsets.swap(offsets);
+        historyFile = path;
+        historySize = valid;
+    }
+
+    // Redo one logged operation
+    void applyLogRecord(const LogRecord& record, const char* payload) {
+        if (record.type == LOG_OPEN_ACCOUNT) {
+            AccountRecord opened;
+            if (record.size < sizeof(opened)) {
+                throw runtime_error("an account record is cut short");
+            }
+            memcpy(&opened, payload, sizeof(opened));
+            if (record.size - sizeof(opened) != opened.nameLength) {
+                throw runtime_error("an account record has the wrong size");
+            }
+            if ((logVersion < 2 && !unitsFromDollars(opened.balance, opened.balance)) || !recordInRange(opened)) {
+                throw runtime_error("an account has an amount out of range");
+            }
+            if (opened.number < static_cast<uint64_t>(nextAccountNumber) || opened.number >= INT32_MAX) {
+                throw runtime_error("an account number is reused or out of range");
+            }
+            Account* account = accountFromRecord(opened, string(payload + sizeof(opened), opened.nameLength));
+            if (account == nullptr) {
+                throw runtime_error("an account has an unknown type");
+            }
+            addAccount(account);
+            nextAccountNumber = static_cast<int>(opened.number) + 1;
+            return;
+        }
+        if (record.type != LOG_UPDATE) {
+            throw runtime_error("a record has an unknown type");
+        }
+
+        LogUpdate update;
+        if (record.size < sizeof(update)) {
+            throw runtime_error("an update is cut short");
+        }
+        memcpy(&update, payload, sizeof(update));
+        uint64_t at = sizeof(update);
+        for (uint32_t i = 0; i < update.accountCount; i++) {
+            LogAccountUpdate change;
+            if (record.size - at < sizeof(change)) {
+                throw runtime_error("an update is cut short");
+            }
+            memcpy(&change, payload + at, sizeof(change));
+            at += sizeof(change);
+            Account* account = accountFor(change.account);
+            if (account == nullptr) {
+                throw runtime_error("an update is for an unknown account");
+            }
+            AccountRecord state = {};
+            account->writeRecord(state);
+            if (logVersion >= 3) {
+                // Concurrent changes may be logged in either order, so a
+                // balance may pass its limits on the way; only the one
+                // replay ends with is checked
+                if (change.change > 4 * MAX_BALANCE_UNITS || change.change < -4 * MAX_BALANCE_UNITS ||
+                    (change.change > 0 && state.balance > INT64_MAX - change.change) ||
+                    (change.change < 0 && state.balance < INT64_MIN - change.change)) {
+                    throw runtime_error("an update has a change out of range");
+                }
+                state.balance += change.change;
+                replayedAccounts.push_back(account);
+            } else {
+                state.balance = change.change;
+                if (logVersion < 2 && !unitsFromDollars(state.balance, state.balance)) {
+                    throw runtime_error("an update has a balance out of range");
+                }
+            }
+            state.matured |= change.matured;
+            if (logVersion < 3 && !recordInRange(state)) {
+                throw runtime_error("an update leaves a balance out of range");
+            }
+            account->readRecord(state);
+            for (uint32_t t = 0; t < change.transactions; t++) {
+                HistoryRecord transaction;
+                if (record.size - at < sizeof(transaction)) {
+                    throw runtime_error("an update is cut short");
+                }
+                memcpy(&transaction, payload + at, sizeof(transaction));
+                if (record.size - at < storedSize(transaction)) {
+                    throw runtime_error("an update is cut short");
+                }
+                account->addTransaction(transactionAt(payload + at));
+                at += storedSize(transaction);
+            }
+        }
+    }
+
+    // Redo the operations in a log file after the last checkpoint; `last`
+    // is the last one redone so far. Returns the valid bytes of the file:
+    // records after a torn or damaged one were never committed.
+    uint64_t replayLog(const string& path, uint64_t& last, size_t& replayed) {
+        MappedFile file(path);
+        LogFileHeader header;
+        uint64_t valid = 0;
+        if (file.size() >= sizeof(header)) {    // Else the crash came while creating it
+            memcpy(&header, file.data(), sizeof(header));
+            if (memcmp(header.magic, LOG_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+                header.version < 1 || header.version > LOG_FILE_VERSION) {
+                throw runtime_error(path + " is not a log file of a known version");
+            }
+            logVersion = header.version;
+            valid = sizeof(header);
+        }
+
+        uint64_t previous = 0;
+        while (valid > 0 && file.size() - valid >= sizeof(LogRecord)) {
+            LogRecord record;
+            memcpy(&record, file.data() + valid, sizeof(record));
+            uint64_t stored = sizeof(record) + (static_cast<uint64_t>(record.size) + 7) / 8 * 8;
+            if (file.size() - valid < stored || (previous != 0 && record.sequence != previous + 1)) break;
+            const char* payload = file.data() + valid + sizeof(record);
+            uint32_t checksum = record.checksum;
+            record.checksum = 0;
+            if (crc32(crc32(0, reinterpret_cast<const char*>(&record), sizeof(record)),
+                      payload, record.size) != checksum) break;
+
+            if (record.sequence > checkpointSequence) {
+                if (record.sequence != last + 1) {
+                    throw runtime_error(path + " does not continue from " + dataFile);
+                }
+                try {
+                    applyLogRecord(record, payload);
+                } catch (const runtime_error& e) {
+                    throw runtime_error(path + ": " + e.what());
+                }
+                last = record.sequence;
+                replayed++;
+            }
+            previous = record.sequence;
+            valid += stored;
+        }
+        return valid;
+    }
+
+    // Redo the operations logged after the last checkpoint, then continue
+    // the log. Those of a checkpoint that did not finish come first, from
+    // the older part of the log it was saving.
+    void recoverLog() {
+        string path = dataFile + ".wal";
+        string olderPath = dataFile + ".wal.old";
+        uint64_t valid = 0;
+        uint64_t last = checkpointSequence;
+        try {
+            size_t replayed = 0;
+            bool older = fileExists(olderPath);
+            if (older) replayLog(olderPath, last, replayed);
+            if (fileExists(path)) valid = replayLog(path, last, replayed);
+            for (Account* account : replayedAccounts) {
+                AccountRecord state = {};
+                account->writeRecord(state);
+                if (!recordInRange(state)) {
+                    throw runtime_error(path + ": the log leaves a balance out of range");
+                }
+            }
+            replayedAccounts.clear();
+            if (replayed > 0) {
+                cout << "Recovered " << replayed << " logged operations from " << path << endl;
+            }
+            if (older || (valid > 0 && logVersion != LOG_FILE_VERSION)) {
+                // Save what the log holds and start it over: the older part
+                // is only kept until a checkpoint has it, and records are not
+                // added to a log of another version
+                checkpointSequence = last;
+                writeBankFile(dataFile);
+                remove(olderPath.c_str());
+                valid = 0;
+            }
+        } catch (const exception& e) {
+            replayedAccounts.clear();
+            cout << "Error: Unable to recover from the log! " << e.what() << endl;
+            cout << "Changes in this session will not be saved." << endl;
+            dataFile.clear();
+            return;
+        }
+        if (!log.open(path, valid, last)) {
+            cout << "Error: Unable to open " << path << "; operations will not be logged!" << endl;
+        }
+    }
+
+    // Wait for a logged operation to reach disk (sequence 0: nothing was
+    // logged), and checkpoint when the log has grown large. Called without
+    // any account locked, so others carry on during the flush.
+    bool commitLog(uint64_t sequence) {
+        if (sequence == 0) return true;
+        if (!log.commit(sequence)) {
+            report() << "Error: Unable to write the transaction log! Recent operations may be lost." << endl;
+            return false;
+        }
+        // When many threads see a full log, only one checkpoints
+        if (log.size() >= checkpointBytes && checkpointLock.try_lock()) {
+            if (log.size() >= checkpointBytes) {
+                saveCheckpoint("Error: Checkpoint failed! ");
+            }
+            checkpointLock.unlock();
+        }
+        return true;
+    }
+
+    // Queue the record of a new account (under accountsLock); returns its
+    // sequence for commitLog, or 0 if nothing is logged
+    uint64_t logOpenedAccount(const Account* account) {
+        if (!log.isOpen()) return 0;
+        AccountRecord record = {};
+        string name = account->getAccountHolderName();
+        record.number = AccountIndex::keyOf(account->getAccountNumber());
+        record.nameLength = static_cast<uint32_t>(name.size());
+        account->writeRecord(record);
+        string payload(reinterpret_cast<const char*>(&record), sizeof(record));
+        payload += name;
+        return log.append(LOG_OPEN_ACCOUNT, payload);
+    }
+
+    // Queue what one operation did, as its journal collected it, as one
+    // record, while it still holds off lockAll; returns its sequence for
+    // commitLog, or 0 if nothing is logged
+    uint64_t logChanges(const OperationJournal& journal) {
+        if (!log.isOpen()) return 0;
+        LogUpdate update = {};
+        string payload(sizeof(update), '\0');
+        for (const AccountChanges& changes : journal.entries()) {
+            if (changes.change == 0 && changes.transactions.empty() && !changes.matured) continue;
+            LogAccountUpdate entry = {};
+            entry.account = AccountIndex::keyOf(changes.account->getAccountNumber());
+            entry.change = changes.change;
+            entry.matured = changes.matured;
+            entry.transactions = static_cast<uint32_t>(changes.transactions.size());
+            payload.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+            for (const Transaction& transaction : changes.transactions) {
+                appendTransaction(payload, entry.account, transaction);
+            }
+            update.accountCount++;
+        }
+        if (update.accountCount == 0) return 0;
+        memcpy(&payload[0], &update, sizeof(update));
+        return log.append(LOG_UPDATE, payload);
+    }
+
+    // Save every change to the data file so the log can start over; caller
+    // holds checkpointLock. When the file can be updated in place,
+    // operations are held off only while the changes are gathered, not
+    // while they are written; else while the whole file is rewritten.
+    // Reports a failure, prefixed by `failure`.
+    bool saveCheckpoint(const char* failure) {
+        PendingCheckpoint pending;
+        bool inPlace = false;
+        bool gathered = true;
+        lockAll();
+        try {
+            inPlace = canUpdateInPlace() && gatherCheckpoint(pending);
+        } catch (const exception& e) {
+            report() << failure << e.what() << endl;
+            gathered = false;
+        }
+        unlockAll();
+        if (!gathered) return false;
+        if (!inPlace) return writeExclusive(dataFile, failure);
+
+        try {
+            writeCheckpoint(pending);
+        } catch (const exception& e) {
+            report() << failure << e.what() << endl;
+            lock_guard<mutex> guard(accountsLock);
+            undoCheckpoint(pending);
+            return false;
+        }
+        fileNames.insert(fileNames.end(), pending.newNames.begin(), pending.newNames.end());
+        fileAccounts = pending.header.accountCount;
+        fileStrings = pending.header.stringsSize;
+        historySize = pending.header.historySize;
+        checkpointSequence = pending.header.checkpointSequence;
+        return true;
+    }
+
+    // Whether a checkpoint can update the data file in place: it is the
+    // mapped image, in this version's format, and has a history file
+    bool canUpdateInPlace() const {
+        return !rewriteNeeded && image != nullptr && imagePath == dataFile && imageVersion == BANK_FILE_VERSION &&
+               historySize > 0 && historyFile == dataFile + ".history" && log.isOpen();
+    }
+
+    // Under lockAll, gather what a checkpoint writes in place: the records
+    // of unsaved accounts, names of those opened since the last save, and
+    // transactions not yet in the history file. Then mark them saved and
+    // go on in a new log. False, with nothing changed, if the file has no
+    // room for them.
+    bool gatherCheckpoint(PendingCheckpoint& out) {
+        vector<Account*> changed = unsaved.take();
+        size_t opened = 0;
+        uint64_t namesSize = 0;
+        for (Account* account : changed) {
+            CheckpointRecord entry = {};
+            entry.record.number = AccountIndex::keyOf(account->getAccountNumber());
+            entry.record.nameLength = static_cast<uint32_t>(account->getAccountHolderName().size());
+            entry.position = positionOf(entry.record.number);
+            account->writeRecord(entry.record);
+            out.records.push_back(entry);
+            if (entry.position >= fileAccounts) {
+                opened++;
+                namesSize += entry.record.nameLength;
+            }
+        }
+        // Accounts are opened unsaved, so all since the last save are here
+        if (fileAccounts + opened != accounts.size() || accounts.size() > fileCapacity ||
+            fileStrings + namesSize > UINT32_MAX) {
+            for (Account* account : changed) {
+                unsaved.add(account);
+            }
+            return false;
+        }
+        for (CheckpointRecord& entry : out.records) {
+            size_t i = static_cast<size_t>(entry.position);
+            if (i < imageAccounts) {
+                entry.record.name = loadedRecord(i).name;
+            } else if (i < fileAccounts) {
+                entry.record.name = fileNames[i - imageAccounts];
+            } else {
+                entry.record.name = static_cast<uint32_t>(fileStrings + out.names.size());
+                out.newNames.push_back(entry.record.name);
+                out.names += accounts[i]->getAccountHolderName();
+            }
+            const vector<Transaction>& history = accounts[i]->getTransactions();
+            for (size_t t = savedHistory[i]; t < history.size(); t++) {
+                out.transactions.push_back(make_pair(entry.record.number, history[t]));
+            }
+            out.savedBefore.push_back(make_pair(i, savedHistory[i]));
+        }
+
+        BankFileHeader& header = out.header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, BANK_FILE_MAGIC, sizeof(header.magic));
+        header.version = BANK_FILE_VERSION;
+        header.recordSize = sizeof(AccountRecord);
+        header.nextAccountNumber = nextAccountNumber;
+        header.accountCount = accounts.size();
+        header.stringsSize = fileStrings + out.names.size();
+        header.historySize = historySize;      // Plus the transactions, once written
+        header.checkpointSequence = log.sequence();
+        header.recordCapacity = fileCapacity;
+
+        for (const CheckpointRecord& entry : out.records) {
+            size_t i = static_cast<size_t>(entry.position);
+            savedHistory[i] = static_cast<uint32_t>(accounts[i]->getTransactions().size());
+            accounts[i]->markSaved();
+        }
+        out.accounts.swap(changed);
+        if (!log.rotate(dataFile + ".wal.old")) {
+            undoCheckpoint(out);
+            throw runtime_error("Cannot restart the log " + dataFile + ".wal");
+        }
+        return true;
+    }
+
+    // Make a gathered checkpoint's writes, with no account locked: append
+    // the transactions to the history file, write the checkpoint file,
+    // then update the data file in place. Each is on disk before the next
+    // starts, so a crash leaves the data file as it was, or the checkpoint
+    // file to redo.
+    void writeCheckpoint(PendingCheckpoint& pending) {
+        sort(pending.records.begin(), pending.records.end(), [](const CheckpointRecord& a, const CheckpointRecord& b) {
+            return a.position < b.position;     // Written in file order
+        });
+        string historyPath = dataFile + ".history";
+        if (!pending.transactions.empty()) {
+            string transactions;
+            for (const pair<uint64_t, Transaction>& added : pending.transactions) {
+                appendTransaction(transactions, added.first, added.second);
+            }
+            pending.header.historySize += transactions.size();
+            fstream history(historyPath, ios::binary | ios::in | ios::out);
+            history.seekp(historySize);     // Anything past it was never committed
+            history.write(transactions.data(), transactions.size());
+            history.close();
+            if (!history || !syncPath(historyPath)) {
+                throw runtime_error("Cannot write " + historyPath);
+            }
+        }
+
+        string body(reinterpret_cast<const char*>(&pending.header), sizeof(pending.header));
+        body.append(reinterpret_cast<const char*>(pending.records.data()),
+                    pending.records.size() * sizeof(CheckpointRecord));
+        body += pending.names;
+        CheckpointFileHeader header = {};
+        memcpy(header.magic, CHECKPOINT_FILE_MAGIC, sizeof(header.magic));
+        header.version = CHECKPOINT_FILE_VERSION;
+        header.checksum = crc32(0, body.data(), body.size());
+        header.recordCount = pending.records.size();
+        header.namesSize = pending.names.size();
+
+        string checkpointPath = dataFile + ".checkpoint";
+        ofstream out(checkpointPath, ios::binary | ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(body.data(), body.size());
+        out.close();
+        if (!out || !syncPath(checkpointPath)) {
+            throw runtime_error("Cannot write " + checkpointPath);
+        }
+        syncDirectoryOf(checkpointPath);
 
-    // Override: Display account type
-    void displayAccountType() const override {
-        cout << "Checking Account" << endl;
+        applyCheckpoint(dataFile, pending.header, pending.records, pending.names);
+        remove(checkpointPath.c_str());
+        remove((dataFile + ".wal.old").c_str());
     }
 
-    // Override: No interest for checking accounts
-    double calculateInterest() override {
-        cout << "Checking accounts do not earn interest." << endl;
-        return 0.0;
+    // Write a checkpoint's records, names and header into the bank file
+    static void applyCheckpoint(const string& path, const BankFileHeader& header,
+                                const vector<CheckpointRecord>& records, const string& names) {
+        fstream file(path, ios::binary | ios::in | ios::out);
+        for (const CheckpointRecord& entry : records) {
+            file.seekp(sizeof(header) + entry.position * sizeof(AccountRecord));
+            file.write(reinterpret_cast<const char*>(&entry.record), sizeof(entry.record));
+        }
+        file.seekp(sizeof(header) + header.recordCapacity * sizeof(AccountRecord) + header.stringsSize - names.size());
+        file.write(names.data(), names.size());
+        file.seekp(0);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.close();
+        if (!file || !syncPath(path)) {
+            throw runtime_error("Cannot update " + path);
+        }
     }
 
-    // Override: Withdraw with overdraft facility
-    bool withdraw(double amount) override {
-        if (balance + overdraftLimit < amount) {
-            cout << "Error: Amount exceeds available balance + overdraft limit!" << endl;
-            cout << "Available: $" << (balance + overdraftLimit) << endl;
-            return false;
+    // Finish a checkpoint that a crash or a failed write interrupted:
+    // redo its writes if its file is complete (else none were made yet),
+    // then remove the file
+    void finishCheckpoint() {
+        string checkpointPath = dataFile + ".checkpoint";
+        {
+            MappedFile file(checkpointPath);
+            CheckpointFileHeader header;
+            bool complete = file.size() >= sizeof(header) + sizeof(BankFileHeader);
+            if (complete) {
+                memcpy(&header, file.data(), sizeof(header));
+                uint64_t body = file.size() - sizeof(header);
+                uint64_t space = body - sizeof(BankFileHeader);
+                complete = memcmp(header.magic, CHECKPOINT_FILE_MAGIC, sizeof(header.magic)) == 0 &&
+                           header.version == CHECKPOINT_FILE_VERSION &&
+                           header.recordCount <= space / sizeof(CheckpointRecord) &&
+                           header.namesSize == space - header.recordCount * sizeof(CheckpointRecord) &&
+                           crc32(0, file.data() + sizeof(header), body) == header.checksum;
+            }
+            if (complete) {
+                const char* at = file.data() + sizeof(header);
+                BankFileHeader bankHeader;
+                memcpy(&bankHeader, at, sizeof(bankHeader));
+                at += sizeof(bankHeader);
+                vector<CheckpointRecord> records(header.recordCount);
+                if (!records.empty()) memcpy(&records[0], at, records.size() * sizeof(CheckpointRecord));
+                at += records.size() * sizeof(CheckpointRecord);
+                applyCheckpoint(dataFile, bankHeader, records, string(at, header.namesSize));
+            }
         }
+        remove(checkpointPath.c_str());
+    }
 
-        balance -= amount;
-        balance -= transactionFee; // Deduct transaction fee
+    // Take back what gatherCheckpoint marked saved, once its writes failed;
+    // under accountsLock. The next checkpoint rewrites the whole file.
+    void undoCheckpoint(const PendingCheckpoint& pending) {
+        for (const pair<size_t, uint32_t>& saved : pending.savedBefore) {
+            savedHistory[saved.first] = saved.second;
+        }
+        for (Account* account : pending.accounts) {
+            account->markUnsaved();
+        }
+        rewriteNeeded = true;
+    }
 
-        transactionHistory.push_back(Transaction("Withdrawal", amount));
-        transactionHistory.push_back(Transaction("Fee", transactionFee, "Transaction fee"));
+    // writeBankFile with every operation held off; caller holds
+    // checkpointLock. Reports a failure, prefixed by `failure`.
+    bool writeExclusive(const string& path, const char* failure) {
+        bool written = true;
+        lockAll();
+        try {
+            writeBankFile(path);
+        } catch (const exception& e) {
+            report() << failure << e.what() << endl;
+            written = false;
+        }
+        unlockAll();
+        return written;
+    }
 
-        cout << "Successfully withdrawn $" << fixed << setprecision(2) << amount << endl;
-        cout << "Transaction fee: $" << transactionFee << endl;
-        cout << "New balance: $" << balance << endl;
+    // Write accounts and history to path. The files are on disk before the
+    // log is emptied, when path is the data file; that is then mapped as
+    // the image, so later checkpoints can update it in place.
+    void writeBankFile(const string& path) {
+        bool isCheckpoint = path == dataFile && log.isOpen();
+        if (path == dataFile && fileExists(dataFile + ".checkpoint")) {
+            finishCheckpoint();     // Else it could be redone over the new file
+        }
+        writeHistory(path + ".history");
+        if (!syncPath(path + ".history")) {
+            throw runtime_error("Cannot flush " + path + ".history");
+        }
 
-        return true;
-    }
+        BankFileHeader header = {};
+        memcpy(header.magic, BANK_FILE_MAGIC, sizeof(header.magic));
+        header.version = BANK_FILE_VERSION;
+        header.recordSize = sizeof(AccountRecord);
+        header.nextAccountNumber = nextAccountNumber;
+        header.accountCount = accounts.size();
+        header.historySize = historySize;
+        header.checkpointSequence = log.isOpen() ? log.sequence() : checkpointSequence;
+        header.recordCapacity = accounts.size() + accounts.size() / 4 + 1024;   // Room for new accounts
+        for (size_t i = 0; i < accounts.size(); i++) {
+            header.stringsSize += accounts[i] != nullptr ? accounts[i]->getAccountHolderName().size()
+                                                         : loadedRecord(i).nameLength;
+        }
+        if (header.stringsSize > UINT32_MAX) {
+            throw runtime_error("Holder names exceed the 4 GB string table");
+        }
 
-    // Override: Display with overdraft info
-    void displayInfo() const override {
-        Account::displayInfo();
-        cout << "Overdraft Limit: $" << overdraftLimit << endl;
-        cout << "Transaction Fee: $" << transactionFee << endl;
-        cout << "Available Balance: $" << (balance + overdraftLimit) << endl;
-        cout << "========================================\n" << endl;
-    }
-};
+        // Write beside the old file and swap it in, so a failed save
+        // leaves the previous data intact
+        string temporary = path + ".tmp";
+        ofstream outFile(temporary, ios::binary | ios::trunc);
+        if (!outFile) {
+            throw runtime_error("Cannot write " + temporary);
+        }
+        outFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        vector<AccountRecord> batch;
+        batch.reserve(8192);
+        uint32_t name = 0;
+        for (size_t i = 0; i < accounts.size(); i++) {
+            AccountRecord record = {};
+            if (accounts[i] != nullptr) {
+                record.number = AccountIndex::keyOf(accounts[i]->getAccountNumber());
+                record.nameLength = static_cast<uint32_t>(accounts[i]->getAccountHolderName().size());
+                accounts[i]->writeRecord(record);
+            } else {
+                record = loadedRecord(i);   // Unchanged since loading
+            }
+            record.name = name;
+            name += record.nameLength;
+            batch.push_back(record);
+            if (batch.size() == batch.capacity()) {
+                outFile.write(reinterpret_cast<const char*>(batch.data()), batch.size() * sizeof(AccountRecord));
+                batch.clear();
+            }
+        }
+        outFile.write(reinterpret_cast<const char*>(batch.data()), batch.size() * sizeof(AccountRecord));
+        batch.assign(batch.capacity(), AccountRecord());
+        for (uint64_t spare = header.recordCapacity - header.accountCount; spare > 0; ) {
+            size_t count = static_cast<size_t>(min<uint64_t>(spare, batch.size()));
+            outFile.write(reinterpret_cast<const char*>(batch.data()), count * sizeof(AccountRecord));
+            spare -= count;
+        }
 
-// ========================================
-// FIXED DEPOSIT ACCOUNT CLASS
-// Fixed deposit with lock-in period
-// ========================================
-class FixedDepositAccount : public Account {
-private:
-    double interestRate;
-    int tenureMonths;
-    time_t maturityDate;
-    bool isMatured;
+        string names;
+        for (size_t i = 0; i < accounts.size(); i++) {
+            if (accounts[i] != nullptr) {
+                names += accounts[i]->getAccountHolderName();
+            } else {
+                AccountRecord record = loadedRecord(i);
+                names.append(imageNames + record.name, record.nameLength);
+            }
+            if (names.size() >= (1 << 20)) {
+                outFile.write(names.data(), names.size());
+                names.clear();
+            }
+        }
+        outFile.write(names.data(), names.size());
+        outFile.close();
+        if (!outFile || !syncPath(temporary)) {
+            throw runtime_error("Cannot write " + temporary);
+        }
+
+        if (rename(temporary.c_str(), path.c_str()) != 0) {
+            remove(path.c_str());   // Windows will not rename over a file
+            if (rename(temporary.c_str(), path.c_str()) != 0) {
+                throw runtime_error("Cannot replace " + path);
+            }
+        }
+        syncDirectoryOf(path);
+
+        if (path == dataFile) {
+            adoptImage(unique_ptr<MappedFile>(new MappedFile(path)), path, header, sizeof(header));
+            if (!historyBegin.empty()) historyBegin.resize(imageAccounts + 1, historyBegin.back());
+            for (Account* account : unsaved.take()) {
+                account->markSaved();
+            }
+            rewriteNeeded = false;
+        }
+        checkpointSequence = header.checkpointSequence;
+        if (isCheckpoint) {
+            if (!log.reset()) {
+                throw runtime_error("Cannot restart the log " + path + ".wal");
+            }
+            remove((path + ".wal.old").c_str());
+        }
+    }
 
 public:
     // Constructor
-    FixedDepositAccount(string accNum, string name, double amount,
-                        int months, double rate = 6.5)
-        : Account(accNum, name, amount),
-          interestRate(rate), tenureMonths(months), isMatured(false) {
+    Bank(string name, string file = "bank_data.bin")
+        : bankName(name), dataFile(file), nextAccountNumber(100001),
+          imageRecords(nullptr), imageNames(nullptr), imageAccounts(0), imageFirst(0), imageEnd(0),
+          imageVersion(BANK_FILE_VERSION), fileAccounts(0), fileCapacity(0), fileStrings(0),
+          rewriteNeeded(false), historySize(0), checkpointSequence(0), logVersion(LOG_FILE_VERSION),
+          checkpointBytes(64 << 20), lockingAll(0), lockFreeUpdates(true) {
+        if (dataFile.empty()) return;
+        if (fileExists(dataFile + ".checkpoint")) {
+            try {
+                finishCheckpoint();
+            } catch (const exception& e) {
+                cout << "Error: Unable to finish the last checkpoint! " << e.what() << endl;
+                cout << "Changes in this session will not be saved." << endl;
+                dataFile.clear();
+                return;
+            }
+        }
+        if (fileExists(dataFile)) {
+            if (!loadAccountsFromFile(dataFile)) {
+                // Keep the damaged file for inspection rather than replacing it
+                cout << "Changes in this session will not be saved." << endl;
+                dataFile.clear();
+                return;
+            }
+        } else if (legacyFileFor(dataFile) != dataFile && fileExists(legacyFileFor(dataFile))) {
+            importTextFile(legacyFileFor(dataFile));
+        }
+        recoverLog();
+    }
 
-        // Calculate maturity date
-        time_t now = time(0);
-        struct tm* timeinfo = localtime(&now);
-        timeinfo->tm_mon += months;
-        maturityDate = mktime(timeinfo);
+    // Destructor - cleanup
+    ~Bank() {
+        if (!dataFile.empty()) saveAccountsToFile(dataFile);
+        clearAccounts();
     }
 
-    // Override: Display account type
-    void displayAccountType() const override {
-        cout << "Fixed Deposit Account" << endl;
+    // Find account by account number. The operations below are safe to
+    // call from many threads at once; changing or reading the account
+    // directly is not, while they run.
+    Account* findAccount(const string& accNum) {
+        lock_guard<mutex> guard(accountsLock);
+        return accountFor(AccountIndex::keyOf(accNum));
     }
 
-    // Override: Calculate interest at maturity
-    double calculateInterest() override {
-        double interest = (balance * interestRate * tenureMonths) / (12 * 100);
-        cout << "Interest on maturity: $" << fixed << setprecision(2) << interest << endl;
-        return interest;
+    // Every account, in account number order (builds any not used yet).
+    // Not for use while other threads open accounts.
+    const vector<Account*>& getAccounts() {
+        lock_guard<mutex> guard(accountsLock);
+        loadAllAccounts();
+        return accounts;
     }
 
-    // Override: Deposits not allowed after creation
-    bool deposit(double amount) override {
-        cout << "Error: Additional deposits not allowed in Fixed Deposit accounts!" << endl;
-        return false;
+    // Whether the log is flushed to disk on commit (off is faster but only
+    // survives a crash of the program), how long a commit waits for
+    // concurrent ones to share its flush, and the log size that triggers
+    // a checkpoint. Set before operations start.
+    void configureLog(bool sync, chrono::microseconds groupWindow, uint64_t checkpointAfter) {
+        log.configure(sync, groupWindow);
+        checkpointBytes = checkpointAfter;
     }
 
-    // Override: Withdrawals only at maturity
-    bool withdraw(double amount) override {
-        time_t now = time(0);
+    // Whether deposits and withdrawals run without their stripe (the
+    // default) or hold it, as transfers do; for comparing the two. Set
+    // before operations start.
+    void configureUpdates(bool lockFree) {
+        lockFreeUpdates = lockFree;
+    }
 
-        if (now < maturityDate && !isMatured) {
-            cout << "Error: Premature withdrawal not allowed!" << endl;
-            cout << "Maturity date: " << ctime(&maturityDate);
-            return false;
-        }
+    // Save every account so the log can start over
+    bool checkpoint() {
+        if (dataFile.empty()) return false;
+        lock_guard<mutex> guard(checkpointLock);
+        return saveCheckpoint("Error: Checkpoint failed! ");
+    }
 
-        // If withdrawing at maturity, add interest
-        if (!isMatured) {
-            double interest = calculateInterest();
-            balance += interest;
-            transactionHistory.push_back(Transaction("Interest", interest, "Maturity interest"));
-            isMatured = true;
-        }
+    // Open accounts without prompting; each returns the new account number,
+    // or an empty string if the amount is negative or too large
+    string openSavingsAccount(const string& name, double initialBalance) {
+        if (!checkOpeningAmount(initialBalance)) return "";
+        unique_lock<mutex> guard(accountsLock);
+        string accNum = generateAccountNumber();
+        addAccount(new SavingsAccount(accNum, name, initialBalance));
+        uint64_t sequence = logOpenedAccount(accounts.back());
+        guard.unlock();
+        commitLog(sequence);
+        return accNum;
+    }
 
-        return Account::withdraw(amount);
+    string openCheckingAccount(const string& name, double initialBalance) {
+        if (!checkOpeningAmount(initialBalance)) return "";
+        unique_lock<mutex> guard(accountsLock);
+        string accNum = generateAccountNumber();
+        addAccount(new CheckingAccount(accNum, name, initialBalance));
+        uint64_t sequence = logOpenedAccount(accounts.back());
+        guard.unlock();
+        commitLog(sequence);
+        return accNum;
     }
 
-    // Override: Display with FD specific info
-    void displayInfo() const override {
-        Account::displayInfo();
-        cout << "Interest Rate: " << interestRate << "% p.a." << endl;
-        cout << "Tenure: " << tenureMonths << " months" << endl;
-        cout << "Maturity Date: " << ctime(&maturityDate);
-        cout << "Status: " << (isMatured ? "Matured" : "Active") << endl;
-        cout << "========================================\n" << endl;
+    string openFixedDepositAccount(const string& name, double amount, int months) {
+        if (!checkOpeningAmount(amount)) return "";
+        unique_lock<mutex> guard(accountsLock);
+        string accNum = generateAccountNumber();
+        addAccount(new FixedDepositAccount(accNum, name, amount, months));
+        uint64_t sequence = logOpenedAccount(accounts.back());
+        guard.unlock();
+        commitLog(sequence);
+        return accNum;
     }
-};
 
-// ========================================
-// BANK CLASS
-// Manages all accounts and operations
-// ========================================
-class Bank {
-private:
-    vector<Account*> accounts;
-    string bankName;
-    int nextAccountNumber;
+    // Operations by account number, without prompting. Each is logged,
+    // and on disk, before it returns. Any number of threads may run them
+    // at once; a transfer is atomic, as both accounts stay locked
+    // throughout. Deposits and withdrawals of a built account take no
+    // lock, logged or not: the account is found, and updates its balance
+    // and history, without one, and the log records the change they made.
+    bool deposit(const string& accNum, double amount) {
+        return runUnlocked(AccountIndex::keyOf(accNum), [&](Account* account) {
+            return account->deposit(amount);
+        });
+    }
 
-    // Generate unique account number
-    string generateAccountNumber() {
-        stringstream ss;
-        ss << "ACC" << setw(6) << setfill('0') << nextAccountNumber++;
-        return ss.str();
+    bool withdraw(const string& accNum, double amount) {
+        // A fixed deposit may mature even if this fails; that is logged too
+        return runUnlocked(AccountIndex::keyOf(accNum), [&](Account* account) {
+            return account->withdraw(amount);
+        });
     }
 
-    // Find account by account number
-    Account* findAccount(const string& accNum) {
-        for (auto account : accounts) {
-            if (account->getAccountNumber() == accNum) {
-                return account;
+    bool transfer(const string& fromAccNum, const string& toAccNum, double amount) {
+        uint64_t fromKey = AccountIndex::keyOf(fromAccNum);
+        uint64_t toKey = AccountIndex::keyOf(toAccNum);
+
+        // Lower stripe first; once if both accounts share one. The accounts
+        // are found holding them, so without accountsLock once built.
+        size_t first = min(stripeOf(fromKey), stripeOf(toKey));
+        size_t second = max(stripeOf(fromKey), stripeOf(toKey));
+        unique_lock<mutex> firstGuard(stripes[first].lock);
+        unique_lock<mutex> secondGuard;
+        if (second != first) secondGuard = unique_lock<mutex>(stripes[second].lock);
+
+        Account* fromAccount = lookup(fromKey);
+        Account* toAccount = lookup(toKey);
+        if (fromAccount == nullptr || toAccount == nullptr) {
+            report() << "Error: One or both accounts not found!" << endl;
+            return false;
+        }
+
+        OperationJournal journal(log.isOpen());
+        bool done = false;
+
+        // Attempt withdrawal from source
+        if (fromAccount->withdraw(amount)) {
+            // If successful, deposit to destination
+            if (toAccount->deposit(amount)) {
+                // Add transfer records
+                stringstream ss;
+                ss << "Transfer to " << toAccNum;
+                fromAccount->addTransaction(Transaction("Transfer Out", amount, ss.str()));
+
+                ss.str("");
+                ss << "Transfer from " << fromAccNum;
+                toAccount->addTransaction(Transaction("Transfer In", amount, ss.str()));
+                done = true;
+            } else {
+                fromAccount->refund(amount);    // The destination refused it
             }
         }
-        return nullptr;
-    }
 
-public:
-    // Constructor
-    Bank(string name) : bankName(name), nextAccountNumber(100001) {
-        loadAccountsFromFile();
+        uint64_t sequence = logChanges(journal);
+        if (secondGuard.owns_lock()) secondGuard.unlock();
+        firstGuard.unlock();
+        commitLog(sequence);
+        return done;
     }
 
-    // Destructor - cleanup
-    ~Bank() {
-        saveAccountsToFile();
-        for (auto account : accounts) {
-            delete account;
+    // Credit interest due to an account
+    bool creditInterest(const string& accNum) {
+        uint64_t key = AccountIndex::keyOf(accNum);
+        unique_lock<mutex> guard(stripeFor(key));
+        Account* account = lookup(key);
+        if (account == nullptr) {
+            report() << "Error: Account not found!" << endl;
+            return false;
         }
+        OperationJournal journal;
+        account->calculateInterest();
+        bool credited = !journal.entries().empty();
+        uint64_t sequence = logChanges(journal);
+        guard.unlock();
+        commitLog(sequence);
+        return credited;
     }
 
     // Create new Savings Account
@@ -431,9 +2661,8 @@ public:
             return;
         }
 
-        string accNum = generateAccountNumber();
-        Account* newAccount = new SavingsAccount(accNum, name, initialBalance);
-        accounts.push_back(newAccount);
+        string accNum = openSavingsAccount(name, initialBalance);
+        if (accNum.empty()) return;
 
         cout << "\nSavings Account created successfully!" << endl;
         cout << "Account Number: " << accNum << endl;
@@ -451,9 +2680,8 @@ public:
         cout << "Enter initial deposit: $";
         cin >> initialBalance;
 
-        string accNum = generateAccountNumber();
-        Account* newAccount = new CheckingAccount(accNum, name, initialBalance);
-        accounts.push_back(newAccount);
+        string accNum = openCheckingAccount(name, initialBalance);
+        if (accNum.empty()) return;
 
         cout << "\nChecking Account created successfully!" << endl;
         cout << "Account Number: " << accNum << endl;
@@ -485,9 +2713,8 @@ public:
             return;
         }
 
-        string accNum = generateAccountNumber();
-        Account* newAccount = new FixedDepositAccount(accNum, name, amount, months);
-        accounts.push_back(newAccount);
+        string accNum = openFixedDepositAccount(name, amount, months);
+        if (accNum.empty()) return;
 
         cout << "\nFixed Deposit Account created successfully!" << endl;
         cout << "Account Number: " << accNum << endl;
@@ -511,7 +2738,7 @@ public:
         cout << "Enter amount to deposit: $";
         cin >> amount;
 
-        account->deposit(amount);
+        deposit(accNum, amount);
     }
 
     // Withdrawal operation
@@ -532,7 +2759,7 @@ public:
         cout << "Enter amount to withdraw: $";
         cin >> amount;
 
-        account->withdraw(amount);
+        withdraw(accNum, amount);
     }
 
     // Transfer between accounts
@@ -557,22 +2784,20 @@ public:
         cout << "Enter amount to transfer: $";
         cin >> amount;
 
-        // Attempt withdrawal from source
-        if (fromAccount->withdraw(amount)) {
-            // If successful, deposit to destination
-            toAccount->deposit(amount);
+        if (transfer(fromAccNum, toAccNum, amount)) {
+            cout << "\nTransfer completed successfully!" << endl;
+        }
+    }
 
-            // Add transfer records
-            stringstream ss;
-            ss << "Transfer to " << toAccNum;
-            fromAccount->addTransaction(Transaction("Transfer Out", amount, ss.str()));
+    // Credit monthly interest
+    void creditMonthlyInterest() {
+        string accNum;
 
-            ss.str("");
-            ss << "Transfer from " << fromAccNum;
-            toAccount->addTransaction(Transaction("Transfer In", amount, ss.str()));
+        cout << "\n=== CREDIT INTEREST ===" << endl;
+        cout << "Enter account number: ";
+        cin >> accNum;
 
-            cout << "\nTransfer completed successfully!" << endl;
-        }
+        creditInterest(accNum);
     }
 
     // Check balance
@@ -615,6 +2840,8 @@ public:
         cout << "ALL ACCOUNTS IN " << bankName << endl;
         cout << "========================================" << endl;
 
+        lockAll();
+        loadAllAccounts();
         if (accounts.empty()) {
             cout << "No accounts in the system." << endl;
         } else {
@@ -632,59 +2859,524 @@ public:
                 cout << "$" << fixed << setprecision(2) << account->getBalance() << endl;
             }
         }
+        unlockAll();
         cout << "========================================\n" << endl;
     }
 
-    // Save accounts to file
-    void saveAccountsToFile() {
-        ofstream outFile("bank_data.txt");
+    // Save accounts to a binary file, and their new transactions to the
+    // history file next to it. Saving to the data file is a checkpoint.
+    bool saveAccountsToFile(const string& path) {
+        lock_guard<mutex> guard(checkpointLock);
+        const char* failure = "Error: Unable to save data! ";
+        if (!(path == dataFile ? saveCheckpoint(failure) : writeExclusive(path, failure))) return false;
 
-        if (!outFile) {
-            cout << "Error: Unable to save data!" << endl;
-            return;
+        report() << "Data saved successfully!" << endl;
+        return true;
+    }
+
+    // Replace this bank's accounts with those in a binary file. Accounts
+    // and their history are read from the file when first used. Not for
+    // use while other threads run operations, nor is importTextFile.
+    bool loadAccountsFromFile(const string& path) {
+        try {
+            readAccounts(path);
+            if (historySize > 0) readHistory(path + ".history", historySize);
+        } catch (const exception& e) {
+            cout << "Error: Unable to load data! " << e.what() << endl;
+            clearAccounts();
+            return false;
         }
+        return true;
+    }
 
-        outFile << nextAccountNumber << endl;
-        outFile << accounts.size() << endl;
+    // Import the text file of older versions: the next account number, the
+    // account count, then "number|name|balance" per line. It has no account
+    // types, so every account comes back as a checking account. Replaces
+    // this bank's accounts.
+    bool importTextFile(const string& path) {
+        ifstream inFile(path);
+        if (!inFile) {
+            cout << "Error: Unable to open " << path << endl;
+            return false;
+        }
 
-        // Simple file format - in real system, use JSON or database
-        for (auto account : accounts) {
-            outFile << account->getAccountNumber() << "|"
-                    << account->getAccountHolderName() << "|"
-                    << account->getBalance() << endl;
+        long long next = 0;
+        size_t count = 0;
+        inFile >> next >> count;
+        inFile.ignore(); // Ignore newline
+        if (!inFile || next <= 0 || next > INT32_MAX) {
+            cout << "Error: " << path << " is not a bank data file" << endl;
+            return false;
+        }
+        clearAccounts();
+        nextAccountNumber = static_cast<int>(next);
+
+        string line;
+        size_t imported = 0;
+        while (getline(inFile, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty()) continue;
+            // Names may contain '|', so split at the first and last one
+            size_t first = line.find('|');
+            size_t last = line.rfind('|');
+            uint64_t number = first == string::npos ? 0 : AccountIndex::keyOf(line.substr(0, first));
+            char* end = nullptr;
+            double balance = last == first ? 0.0 : strtod(line.c_str() + last + 1, &end);
+            if (number == 0 || number > INT32_MAX || last == first || end == line.c_str() + last + 1 ||
+                !(fabs(balance) <= MAX_AMOUNT)) {
+                cout << "Skipping malformed line: " << line << endl;
+                continue;
+            }
+            if (index.find(number) != nullptr) {
+                cout << "Skipping duplicate account " << line.substr(0, first) << endl;
+                continue;
+            }
+            addAccount(new CheckingAccount(accountNumberFor(number), line.substr(first + 1, last - first - 1), balance));
+            nextAccountNumber = max(nextAccountNumber, static_cast<int>(number) + 1);
+            imported++;
         }
+        sort(accounts.begin(), accounts.end(), [](const Account* a, const Account* b) {
+            return AccountIndex::keyOf(a->getAccountNumber()) < AccountIndex::keyOf(b->getAccountNumber());
+        });
 
-        outFile.close();
-        cout << "Data saved successfully!" << endl;
+        if (imported != count) {
+            cout << "Warning: " << path << " lists " << count << " accounts, imported " << imported << endl;
+        }
+        cout << "Imported " << imported << " accounts from " << path << endl;
+        return true;
     }
+};
 
-    // Load accounts from file
-    void loadAccountsFromFile() {
-        ifstream inFile("bank_data.txt");
+// ========================================
+// BENCHMARKS
+// Run with: banking_system --bench
+// ========================================
 
-        if (!inFile) {
-            // File doesn't exist - first run
-            return;
+// Seconds elapsed since start
+double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Lookup latency of random existing accounts through the index, and
+// through the linear scan it replaced
+void benchmarkLookup() {
+    const size_t SIZES[] = { 10000, 1000000, 10000000 };
+    const size_t LOOKUPS = 1000000;
+    const size_t SCANNED_ACCOUNTS = 200000000;      // Budget for the linear scan
+
+    cout << "\n--- Account lookup (" << LOOKUPS << " random lookups) ---" << endl;
+    for (size_t size : SIZES) {
+        Bank bank("Benchmark Bank", "");
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < size; i++) {
+            bank.openCheckingAccount("Holder", 100.0);
         }
+        double building = secondsSince(start);
 
-        inFile >> nextAccountNumber;
+        mt19937 rng(2025);
+        vector<string> numbers;
+        numbers.reserve(LOOKUPS);
+        for (size_t i = 0; i < LOOKUPS; i++) {
+            stringstream ss;
+            ss << "ACC" << setw(6) << setfill('0') << 100001 + rng() % size;
+            numbers.push_back(ss.str());
+        }
 
-        int count;
-        inFile >> count;
-        inFile.ignore(); // Ignore newline
+        size_t found = 0;
+        start = chrono::steady_clock::now();
+        for (const string& number : numbers) {
+            found += bank.findAccount(number) != nullptr;
+        }
+        double indexed = secondsSince(start);
+
+        size_t scans = max<size_t>(SCANNED_ACCOUNTS / size, 10);
+        start = chrono::steady_clock::now();
+        for (size_t i = 0; i < scans; i++) {
+            for (Account* account : bank.getAccounts()) {
+                if (account->getAccountNumber() == numbers[i]) {
+                    found++;
+                    break;
+                }
+            }
+        }
+        double scanned = secondsSince(start);
 
-        // Note: In a real system, you'd save account type info
-        // For this demo, we just restore basic accounts
+        cout << setw(9) << size << " accounts (built in " << fixed << setprecision(2) << building
+             << " s): index " << setprecision(1) << setw(8) << indexed * 1e9 / LOOKUPS
+             << " ns, linear scan " << setw(12) << scanned * 1e9 / scans << " ns"
+             << (found == LOOKUPS + scans ? "" : "  (MISSING ACCOUNTS)") << endl;
+    }
+}
+
+// Save and load time of the binary file for a bank of mixed accounts,
+// a third of them with a few transactions, the cost of first using
+// loaded accounts, and of a checkpoint after some of them change
+void benchmarkPersistence() {
+    const size_t ACCOUNTS = 10000000;
+    const size_t LOOKUPS = 1000000;
+    const string PATH = "bank_benchmark.bin";
+
+    cout << "\n--- Binary persistence (" << ACCOUNTS << " accounts) ---" << endl;
+    size_t transactions = 0;
+    {
+        Bank bank("Benchmark Bank", "");
+        for (size_t i = 0; i < ACCOUNTS; i++) {
+            string number;
+            switch (i % 3) {
+                case 0: number = bank.openSavingsAccount("Savings Holder", 500.0 + i % 1000); break;
+                case 1: number = bank.openCheckingAccount("Checking Holder", 100.0 + i % 1000); break;
+                default: number = bank.openFixedDepositAccount("Deposit Holder", 1000.0, 12); break;
+            }
+            if (i % 3 == 1) {
+                Account* account = bank.findAccount(number);
+                account->addTransaction(Transaction("Deposit", 25.0));
+                account->addTransaction(Transaction("Withdrawal", 10.0, "ATM"));
+                transactions += 2;
+            }
+        }
 
-        inFile.close();
+        auto start = chrono::steady_clock::now();
+        bool saved = bank.saveAccountsToFile(PATH);
+        double saving = secondsSince(start);
+        if (!saved) return;
+        cout << "save: " << fixed << setprecision(3) << saving << " s" << endl;
+    }
+
+    mt19937 rng(2025);
+    vector<string> numbers;
+    numbers.reserve(LOOKUPS);
+    for (size_t i = 0; i < LOOKUPS; i++) {
+        numbers.push_back(accountNumberFor(100001 + rng() % ACCOUNTS));
+    }
+
+    {
+        Bank bank("Benchmark Bank", "");
+        auto start = chrono::steady_clock::now();
+        bool loaded = bank.loadAccountsFromFile(PATH);
+        double loading = secondsSince(start);
+        ifstream accountsFile(PATH, ios::binary | ios::ate);
+        ifstream historyFile(PATH + ".history", ios::binary | ios::ate);
+        cout << "load: " << fixed << setprecision(3) << loading << " s  ("
+             << setprecision(1) << accountsFile.tellg() / 1e6 << " MB accounts, "
+             << historyFile.tellg() / 1e6 << " MB history)" << endl;
+
+        size_t found = 0;
+        start = chrono::steady_clock::now();
+        for (const string& number : numbers) {
+            found += bank.findAccount(number) != nullptr;
+        }
+        double firstUse = secondsSince(start);
+        cout << "first use of " << LOOKUPS << " random accounts: " << setprecision(1)
+             << firstUse * 1e9 / LOOKUPS << " ns each" << endl;
+
+        start = chrono::steady_clock::now();
+        size_t restored = 0;
+        for (Account* account : bank.getAccounts()) {
+            restored += account->getTransactions().size();
+        }
+        double building = secondsSince(start);
+        cout << "building every account: " << setprecision(3) << building << " s"
+             << (loaded && found == LOOKUPS && bank.getAccounts().size() == ACCOUNTS && restored == transactions
+                 ? "" : "  (DATA LOST)")
+             << endl;
+    }
+
+    // A checkpoint rewrites only the accounts changed since the last one,
+    // and holds off operations only while gathering them
+    {
+        const size_t CHANGED = 100000;
+        QuietReports quiet;
+        Bank bank("Benchmark Bank", PATH);
+        bank.configureLog(false, chrono::microseconds(0), uint64_t(1) << 40);
+        for (size_t i = 0; i < CHANGED; i++) {
+            bank.deposit(numbers[i % LOOKUPS], 10.0);
+        }
+        atomic<bool> done(false);
+        double longest = 0;
+        thread depositor([&]() {
+            QuietReports quietToo;
+            for (size_t i = 0; !done; i++) {
+                auto begin = chrono::steady_clock::now();
+                bank.deposit(numbers[i % LOOKUPS], 1.0);
+                longest = max(longest, secondsSince(begin));
+            }
+        });
+        auto start = chrono::steady_clock::now();
+        bool checkpointed = bank.checkpoint();
+        double checkpointing = secondsSince(start);
+        done = true;
+        depositor.join();
+        cout << "checkpoint after " << CHANGED << " deposits: " << setprecision(3) << checkpointing
+             << " s, longest deposit meanwhile " << setprecision(1) << longest * 1e3 << " ms"
+             << (checkpointed ? "" : "  (FAILED)") << endl;
+    }
+
+    remove(PATH.c_str());
+    remove((PATH + ".history").c_str());
+    remove((PATH + ".wal").c_str());
+}
+
+// Sustained operations per second through the write-ahead log, with and
+// without flushing to disk, and how group commit shares flushes among
+// concurrent committers
+void benchmarkLog() {
+    const string PATH = "bank_log_benchmark.bin";
+    const double SECONDS = 1.0;
+    const size_t ACCOUNTS = 1000;
+
+    cout << "\n--- Write-ahead log (deposits and withdrawals, one thread) ---" << endl;
+    for (int sync = 0; sync < 2; sync++) {
+        size_t operations = 0;
+        double elapsed = 0;
+        {
+            QuietReports quiet;
+            Bank bank("Benchmark Bank", PATH);
+            bank.configureLog(sync != 0, chrono::microseconds(0), 64 << 20);
+            vector<string> numbers;
+            for (size_t i = 0; i < ACCOUNTS; i++) {
+                numbers.push_back(bank.openCheckingAccount("Holder", 1000.0));
+            }
+            auto start = chrono::steady_clock::now();
+            while ((elapsed = secondsSince(start)) < SECONDS) {
+                for (int i = 0; i < 100; i++, operations++) {
+                    const string& number = numbers[operations % ACCOUNTS];
+                    if (operations % 2 == 0) {
+                        bank.deposit(number, 10.0);
+                    } else {
+                        bank.withdraw(number, 5.0);
+                    }
+                }
+            }
+        }
+        cout << "fsync " << (sync ? "on: " : "off:") << setw(10) << fixed << setprecision(0)
+             << operations / elapsed << " ops/s" << endl;
+        remove(PATH.c_str());
+        remove((PATH + ".history").c_str());
+        remove((PATH + ".wal").c_str());
     }
-};
+
+    // A deposit's log record, committed from many threads at once
+    const int THREADS[] = { 1, 4, 16, 64 };
+    const int WINDOWS[] = { 0, 200 };
+    string payload(sizeof(LogUpdate) + sizeof(LogAccountUpdate), '\0');
+    appendTransaction(payload, 100001, Transaction("Deposit", 10.0));
+
+    cout << "\n--- Group commit (fsync on, concurrent committers) ---" << endl;
+    for (int window : WINDOWS) {
+        for (int threads : THREADS) {
+            WriteAheadLog log;
+            if (!log.open(PATH + ".wal", 0, 0)) return;
+            log.configure(true, chrono::microseconds(window));
+            atomic<size_t> operations(0);
+            atomic<bool> stop(false);
+            vector<thread> workers;
+            auto start = chrono::steady_clock::now();
+            for (int t = 0; t < threads; t++) {
+                workers.emplace_back([&]() {
+                    while (!stop) {
+                        if (!log.commit(log.append(LOG_UPDATE, payload))) return;
+                        operations++;
+                    }
+                });
+            }
+            this_thread::sleep_for(chrono::milliseconds(static_cast<int>(SECONDS * 1000)));
+            stop = true;
+            for (thread& worker : workers) {
+                worker.join();
+            }
+            double elapsed = secondsSince(start);
+            cout << setw(3) << threads << " threads, window " << setw(3) << window << " us: "
+                 << setw(8) << fixed << setprecision(0) << operations / elapsed << " ops/s, "
+                 << setprecision(1) << log.averageGroup() << " commits per flush" << endl;
+            log.close();
+            remove((PATH + ".wal").c_str());
+        }
+    }
+}
+
+// Operations per second from many threads at once, spread over every
+// account or mostly on a few hot ones, and whether the total balance
+// matches what was deposited and withdrawn
+void benchmarkConcurrency() {
+    const double SECONDS = 0.3;
+    const size_t ACCOUNTS = 100000;
+    const size_t HOT = 16;              // Nine in ten operations go to these when skewed
+    const double BALANCE = 1000000.0;   // No transfer of 1.0 fails for lack of funds
+    const int THREADS[] = { 1, 2, 4, 8, 16, 32 };
+
+    cout << "\n--- Concurrent operations (80% transfers, in memory, "
+         << thread::hardware_concurrency() << " hardware threads) ---" << endl;
+    cout << "threads   uniform ops/s   hot-account ops/s" << endl;
+    bool conserved = true;
+    for (int threads : THREADS) {
+        cout << setw(7) << threads;
+        for (int skewed = 0; skewed < 2; skewed++) {
+            Bank bank("Benchmark Bank", "");
+            vector<string> numbers;
+            for (size_t i = 0; i < ACCOUNTS; i++) {
+                numbers.push_back(bank.openSavingsAccount("Holder", BALANCE));
+            }
+
+            atomic<size_t> operations(0);
+            atomic<bool> stop(false);
+            vector<double> net(threads, 0.0);   // Deposited minus withdrawn, per thread
+            vector<thread> workers;
+            auto start = chrono::steady_clock::now();
+            for (int t = 0; t < threads; t++) {
+                workers.emplace_back([&, t]() {
+                    QuietReports quiet;
+                    mt19937_64 generator(t + 1);
+                    auto pick = [&]() -> const string& {
+                        uint64_t r = generator();
+                        return numbers[(r >> 8) % (skewed && r % 10 != 0 ? HOT : ACCOUNTS)];
+                    };
+                    size_t done = 0;
+                    while (!stop) {
+                        uint64_t kind = generator() % 10;
+                        if (kind < 8) {
+                            const string& from = pick();
+                            bank.transfer(from, pick(), 1.0);
+                        } else if (kind == 8) {
+                            if (bank.deposit(pick(), 1.0)) net[t] += 1.0;
+                        } else {
+                            if (bank.withdraw(pick(), 1.0)) net[t] -= 1.0;
+                        }
+                        done++;
+                    }
+                    operations += done;
+                });
+            }
+            this_thread::sleep_for(chrono::milliseconds(static_cast<int>(SECONDS * 1000)));
+            stop = true;
+            for (thread& worker : workers) {
+                worker.join();
+            }
+            double elapsed = secondsSince(start);
+
+            double expected = BALANCE * ACCOUNTS;
+            for (double change : net) {
+                expected += change;
+            }
+            double total = 0;
+            for (Account* account : bank.getAccounts()) {
+                total += account->getBalance();
+            }
+            if (total != expected) conserved = false;
+            cout << setw(skewed ? 20 : 16) << fixed << setprecision(0) << operations / elapsed;
+        }
+        cout << endl;
+    }
+    cout << "Total balance " << (conserved ? "matches" : "DOES NOT MATCH") << " deposits and withdrawals" << endl;
+}
+
+// Deposits and withdrawals from many threads on one account, in memory
+// and with the log open (fsync off, so the locking is measured rather
+// than the disk): as the bank runs them, without a lock, and holding the
+// account's stripe throughout, as transfers do, for comparison
+void benchmarkContention() {
+    const string PATH = "bank_contention_benchmark.bin";
+    const double SECONDS = 0.3;
+    const double BALANCE = 1000000.0;
+    const int THREADS[] = { 1, 4, 16, 64 };
+
+    auto removeFiles = [&]() {
+        remove(PATH.c_str());
+        remove((PATH + ".history").c_str());
+        remove((PATH + ".wal").c_str());
+    };
+
+    cout << "\n--- One hot account (deposits and withdrawals) ---" << endl;
+    cout << "               in memory            logged, fsync off" << endl;
+    cout << "threads   lock-free   locked     lock-free   locked    (ops/s)" << endl;
+    bool conserved = true;
+    for (int threads : THREADS) {
+        cout << setw(7) << threads;
+        for (int logged = 0; logged < 2; logged++) {
+            for (int locked = 0; locked < 2; locked++) {
+                size_t operations = 0;
+                double elapsed = 0;
+                if (logged) removeFiles();
+                {
+                    QuietReports quiet;
+                    Bank bank("Benchmark Bank", logged ? PATH : "");
+                    if (logged) bank.configureLog(false, chrono::microseconds(0), 64 << 20);
+                    bank.configureUpdates(!locked);
+                    string number = bank.openSavingsAccount("Merchant", BALANCE);
+
+                    atomic<size_t> done(0);
+                    atomic<long long> net(0);   // Deposited minus withdrawn
+                    atomic<bool> stop(false);
+                    vector<thread> workers;
+                    auto start = chrono::steady_clock::now();
+                    for (int t = 0; t < threads; t++) {
+                        workers.emplace_back([&, t]() {
+                            QuietReports quiet;
+                            size_t count = 0;
+                            long long change = 0;
+                            while (!stop) {
+                                if ((count + t) % 2 == 0) {
+                                    if (bank.deposit(number, 1.0)) change++;
+                                } else {
+                                    if (bank.withdraw(number, 1.0)) change--;
+                                }
+                                count++;
+                            }
+                            done += count;
+                            net += change;
+                        });
+                    }
+                    this_thread::sleep_for(chrono::milliseconds(static_cast<int>(SECONDS * 1000)));
+                    stop = true;
+                    for (thread& worker : workers) {
+                        worker.join();
+                    }
+                    elapsed = secondsSince(start);
+                    operations = done;
+
+                    if (bank.findAccount(number)->getBalance() != BALANCE + net) conserved = false;
+                }
+                if (logged) removeFiles();
+                cout << setw(locked ? 9 : (logged ? 14 : 12)) << fixed << setprecision(0) << operations / elapsed;
+            }
+        }
+        cout << endl;
+    }
+    cout << "Balance " << (conserved ? "matches" : "DOES NOT MATCH") << " deposits and withdrawals" << endl;
+}
+
+void runBenchmarks() {
+    cout << "\n========================================" << endl;
+    cout << "BANK BENCHMARKS" << endl;
+    cout << "========================================" << endl;
+    benchmarkLookup();
+    benchmarkPersistence();
+    benchmarkLog();
+    benchmarkConcurrency();
+    benchmarkContention();
+    cout << "========================================\n" << endl;
+}
 
 // ========================================
 // MAIN FUNCTION
 // Program entry point with menu system
 // ========================================
-int main() {
+int main(int argc, char* argv[]) {
+    // Benchmarks: banking_system --bench
+    if (argc > 1 && string(argv[1]) == "--bench") {
+        runBenchmarks();
+        return 0;
+    }
+
+    // Convert the old text file: banking_system --convert bank_data.txt bank_data.bin
+    if (argc > 1 && string(argv[1]) == "--convert") {
+        if (argc != 4) {
+            cout << "Usage: " << argv[0] << " --convert <text file> <binary file>" << endl;
+            return 1;
+        }
+        Bank bank("CSC International Bank", "");
+        return bank.importTextFile(argv[2]) && bank.saveAccountsToFile(argv[3]) ? 0 : 1;
+    }
+
     Bank myBank("CSC International Bank");
     int choice;
 
@@ -704,6 +3396,7 @@ int main() {
         cout << "7.  Check Balance" << endl;
         cout << "8.  View Transaction History" << endl;
         cout << "9.  List All Accounts" << endl;
+        cout << "10. Credit Interest" << endl;
         cout << "0.  Exit" << endl;
         cout << "===============================" << endl;
         cout << "Enter your choice: ";
@@ -737,6 +3430,9 @@ int main() {
             case 9:
                 myBank.listAllAccounts();
                 break;
+            case 10:
+                myBank.creditMonthlyInterest();
+                break;
             case 0:
                 cout << "\nThank you for using CSC International Bank!" << endl;
                 cout << "Goodbye!\n" << endl;
@@ -756,10 +3452,13 @@ int main() {
  * ========================================
  *
  * To compile:
- *   g++ -std=c++11 banking_system.cpp -o banking_system
+ *   g++ -std=c++11 -pthread banking_system.cpp -o banking_system
  *
  * To run:
  *   ./banking_system
+ *   ./banking_system --bench    (performance benchmarks)
+ *   ./banking_system --convert bank_data.txt bank_data.bin
+ *                               (convert the old text data file)
  *
  * ========================================
  * TESTING SUGGESTIONS:
@@ -15,32 +15,81 @@
  * Features:
  * - Basic operations: +, -, *, /, ^(power), %(modulo)
  * - Scientific functions: sin, cos, tan, log, ln, sqrt, abs
- * - Expression parsing with Shunting Yard algorithm
+ * - Single-pass Pratt parser (unary minus, right-associative ^)
  * - Variable support (x = 5, y = x * 2)
- * - Calculation history
- * - Unit conversions
+ * - User-defined functions of several arguments, inlined into callers
+ * - Spreadsheet-style updates of dependent variables
+ * - Calculation history (bounded, optionally streamed to a file)
+ * - Unit conversions (table-driven, whole arrays in one call)
  * - Parentheses and operator precedence
+ * - Scientific notation (1.5e-3)
+ * - Compile-once expression programs with an LRU cache
+ * - Batch evaluation over columns of inputs (SIMD kernels)
+ * - Accuracy tiers for sin/cos/tan/log/ln/exp (libm, ~1 ulp, ~1e-7)
+ * - Native backend compiling hot formulas into specialized node trees
+ * - Constant folding and common-subexpression elimination
+ * - Multi-threaded server mode (stdin or Unix socket)
+ * - Exact derivatives (dual numbers) and a Newton equation solver
+ * - Parallel integrate(f, a, b) and root(f, a, b), compiled as calls in programs
+ * - Interval bounds over input ranges, tightened by branch and bound
+ * - Batch mode for files of expressions (pipelined, memory-mapped)
+ * - Snapshots of variables and compiled formulas (memory-mapped at startup)
+ * - Benchmarks over generated expression corpora and a fuzz target
  *
  * Concepts Demonstrated:
  * - Stack data structure
- * - Infix to Postfix conversion (Shunting Yard)
+ * - Recursive-descent (Pratt) parsing straight to postfix
  * - Expression evaluation
  * - String parsing and tokenization
- * - Map for variables storage
+ * - Variable names interned to array slots
+ * - Flat bytecode (RPN) programs
  * ========================================
  */
 
 #include <iostream>
-#include <stack>
 #include <queue>
 #include <string>
+#include <string_view>
+#include <charconv>
+#include <system_error>
 #include <cmath>
 #include <map>
+#include <set>
 #include <vector>
 #include <sstream>
 #include <iomanip>
 #include <cctype>
 #include <algorithm>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <chrono>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <cerrno>
+#include <atomic>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <functional>
+#include <limits>
+
+#ifdef __unix__
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 using namespace std;
 
@@ -54,494 +103,6176 @@ enum TokenType {
     FUNCTION,
     LPAREN,
     RPAREN,
-    VARIABLE
+    VARIABLE,
+    COMMA               // Separates the arguments of user functions
 };
 
+enum OpCode : uint8_t;
+
 struct Token {
     TokenType type;
-    string value;
+    string_view text;   // Slice of the source expression
     double numValue;
+    OpCode op;          // Resolved opcode of operators and functions (OP_COUNT: user function)
 
-    Token(TokenType t, string v, double n = 0.0)
-        : type(t), value(v), numValue(n) {}
+    Token(TokenType t, string_view s, double n = 0.0, OpCode o = OpCode(0))
+        : type(t), text(s), numValue(n), op(o) {}
 };
 
 // ========================================
-// CALCULATOR CLASS
-// Main calculator with all operations
+// OPCODES AND MATH OPERATIONS
+// Compact instruction set shared by every
+// evaluator of compiled expressions
 // ========================================
-class ScientificCalculator {
-private:
-    map<string, double> variables;          // Store variables
-    vector<string> history;                 // Calculation history
-    map<string, int> operatorPrecedence;    // Operator priorities
-    map<string, string> unitConversions;    // Unit conversion info
+enum OpCode : uint8_t {
+    OP_PUSH_CONST,      // Push literal value
+    OP_PUSH_VAR,        // Push value of a variable slot
+    OP_LOAD_TEMP,       // Push value of a temporary
+    OP_STORE_TEMP,      // Copy top of stack into a temporary (stays on stack)
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_POW,
+    OP_SIN, OP_COS, OP_TAN, OP_LOG, OP_LN, OP_SQRT, OP_ABS, OP_EXP,
+    OP_NEG,             // Unary minus
+    OP_INTEGRATE,       // integrate(f, a, b): pops a and b; slot indexes the program's calls
+    OP_ROOT,            // root(f, a, b), likewise
+    OP_COUNT            // Number of opcodes / "no opcode" marker
+};
+
+// Binary operators
+double opAdd(double a, double b) { return a + b; }
+double opSub(double a, double b) { return a - b; }
+double opMul(double a, double b) { return a * b; }
+double opDiv(double a, double b) {
+    if (b == 0) throw runtime_error("Division by zero!");
+    return a / b;
+}
+double opMod(double a, double b) {
+    if (b == 0) throw runtime_error("Modulo by zero!");
+    return fmod(a, b);
+}
+double opPow(double a, double b) { return pow(a, b); }
+
+// Functions (trigonometry works in degrees)
+double fnSin(double value) { return sin(value * M_PI / 180.0); }
+double fnCos(double value) { return cos(value * M_PI / 180.0); }
+double fnTan(double value) { return tan(value * M_PI / 180.0); }
+double fnLog(double value) {
+    if (value <= 0) throw runtime_error("log: value must be positive!");
+    return log10(value);
+}
+double fnLn(double value) {
+    if (value <= 0) throw runtime_error("ln: value must be positive!");
+    return log(value);
+}
+double fnSqrt(double value) {
+    if (value < 0) throw runtime_error("sqrt: value must be non-negative!");
+    return sqrt(value);
+}
+double fnAbs(double value) { return fabs(value); }
+double fnExp(double value) { return exp(value); }
+double fnNeg(double value) { return 0.0 - value; }     // -(0) is 0, not -0
+
+// Partial derivatives of the binary operators with respect to a and b
+void dAdd(double, double, double& da, double& db) { da = 1; db = 1; }
+void dSub(double, double, double& da, double& db) { da = 1; db = -1; }
+void dMul(double a, double b, double& da, double& db) { da = b; db = a; }
+void dDiv(double a, double b, double& da, double& db) { da = 1 / b; db = -a / (b * b); }
+void dMod(double a, double b, double& da, double& db) { da = 1; db = -trunc(a / b); }
+void dPow(double a, double b, double& da, double& db) {
+    da = b * pow(a, b - 1);
+    db = pow(a, b) * log(a);    // Only used when the exponent varies
+}
 
-    // Initialize operator precedence
-    void initializeOperators() {
-        operatorPrecedence["+"] = 1;
-        operatorPrecedence["-"] = 1;
-        operatorPrecedence["*"] = 2;
-        operatorPrecedence["/"] = 2;
-        operatorPrecedence["%"] = 2;
-        operatorPrecedence["^"] = 3;
+// Derivatives of the functions (trigonometry includes the degree scaling)
+double dSin(double value) { return cos(value * M_PI / 180.0) * M_PI / 180.0; }
+double dCos(double value) { return -sin(value * M_PI / 180.0) * M_PI / 180.0; }
+double dTan(double value) {
+    double c = cos(value * M_PI / 180.0);
+    return M_PI / 180.0 / (c * c);
+}
+double dLog(double value) { return 1 / (value * M_LN10); }
+double dLn(double value) { return 1 / value; }
+double dSqrt(double value) { return 0.5 / sqrt(value); }
+double dAbs(double value) { return value > 0 ? 1 : (value < 0 ? -1 : 0); }
+double dExp(double value) { return exp(value); }
+double dNeg(double) { return -1; }
+
+// Interval versions of the operators and functions. Each result contains
+// the value at every point of the inputs where the point version succeeds;
+// points outside a function's domain are left out, and only an input lying
+// entirely outside it throws. Bounds are widened outward to cover rounding.
+struct Interval {
+    double lo;
+    double hi;
+};
+
+const double INF = numeric_limits<double>::infinity();
+const Interval ENTIRE = { -INF, INF };
+
+// One ulp further out on each side (libm results are within one ulp)
+Interval widen(double lo, double hi) {
+    return Interval{ nextafter(lo, -INF), nextafter(hi, INF) };
+}
+
+Interval hull(double a, double b, double c, double d) {
+    return widen(min(min(a, b), min(c, d)), max(max(a, b), max(c, d)));
+}
+
+bool containsZero(Interval a) { return a.lo <= 0 && a.hi >= 0; }
+
+Interval iAdd(Interval a, Interval b) { return widen(a.lo + b.lo, a.hi + b.hi); }
+Interval iSub(Interval a, Interval b) { return widen(a.lo - b.hi, a.hi - b.lo); }
+Interval iMul(Interval a, Interval b) {
+    // 0 * inf is NaN; zero times anything finite or not is zero here
+    auto mul = [](double x, double y) { return (x == 0 || y == 0) ? 0.0 : x * y; };
+    return hull(mul(a.lo, b.lo), mul(a.lo, b.hi), mul(a.hi, b.lo), mul(a.hi, b.hi));
+}
+Interval iDiv(Interval a, Interval b) {
+    if (b.lo == 0 && b.hi == 0) throw runtime_error("Division by zero!");
+    if (containsZero(b)) return ENTIRE;
+    return hull(a.lo / b.lo, a.lo / b.hi, a.hi / b.lo, a.hi / b.hi);
+}
+Interval iMod(Interval a, Interval b) {
+    if (b.lo == 0 && b.hi == 0) throw runtime_error("Modulo by zero!");
+
+    // Within one period of a fixed divisor, fmod is increasing
+    if (b.lo == b.hi && isfinite(a.lo) && isfinite(a.hi) &&
+        trunc(a.lo / b.lo) == trunc(a.hi / b.lo) && (a.lo >= 0 || a.hi <= 0)) {
+        return widen(fmod(a.lo, b.lo), fmod(a.hi, b.lo));
+    }
+
+    // Otherwise |fmod(a, b)| < |b|, with the sign of a
+    double limit = max(fabs(b.lo), fabs(b.hi));
+    return Interval{ a.lo >= 0 ? 0.0 : -min(-a.lo, limit), a.hi <= 0 ? 0.0 : min(a.hi, limit) };
+}
+Interval iPow(Interval a, Interval b) {
+    // Integer exponent: defined for negative bases too
+    if (b.lo == b.hi && b.lo == trunc(b.lo)) {
+        double n = b.lo;
+        if (n == 0) return Interval{ 1, 1 };
+        double lo = pow(a.lo, n);
+        double hi = pow(a.hi, n);
+        if (a.lo > 0 || a.hi < 0) return widen(min(lo, hi), max(lo, hi));
+        if (n < 0) return ENTIRE;
+        if (fmod(n, 2) == 0) return Interval{ 0, nextafter(max(lo, hi), INF) };
+        return widen(lo, hi);
     }
 
-    // Check if character is operator
-    bool isOperator(char c) {
-        return (c == '+' || c == '-' || c == '*' ||
-                c == '/' || c == '%' || c == '^');
+    // Positive base: monotonic in each argument, so extremes are at corners
+    if (a.lo >= 0) {
+        return hull(pow(a.lo, b.lo), pow(a.lo, b.hi), pow(a.hi, b.lo), pow(a.hi, b.hi));
     }
+    return ENTIRE;
+}
+
+// Trigonometry in degrees. The degree-to-radian product is rounded, which
+// shifts the argument by up to a few ulps of its magnitude.
+double trigMargin(Interval a) {
+    return (max(fabs(a.lo), fabs(a.hi)) * M_PI / 180.0 + 1) * 4 * numeric_limits<double>::epsilon();
+}
+
+// Whether [lo, hi] (slightly enlarged) contains offset + k * period
+bool containsPeriodic(Interval a, double offset, double period) {
+    double slack = 1e-9 * (1 + max(fabs(a.lo), fabs(a.hi)));
+    return floor((a.hi + slack - offset) / period) >= ceil((a.lo - slack - offset) / period);
+}
+
+// Sine-shaped function with its maximum at peak and minimum at peak + 180
+Interval periodicBounds(Interval a, double (*f)(double), double peak) {
+    if (!(a.hi - a.lo < 360)) return Interval{ -1, 1 };
+    double margin = trigMargin(a);
+    double lo = min(f(a.lo), f(a.hi)) - margin;
+    double hi = max(f(a.lo), f(a.hi)) + margin;
+    if (containsPeriodic(a, peak, 360)) hi = 1;
+    if (containsPeriodic(a, peak + 180, 360)) lo = -1;
+    return Interval{ max(lo, -1.0), min(hi, 1.0) };
+}
+
+Interval iSin(Interval a) { return periodicBounds(a, fnSin, 90); }
+Interval iCos(Interval a) { return periodicBounds(a, fnCos, 0); }
+Interval iTan(Interval a) {
+    if (!(a.hi - a.lo < 180) || containsPeriodic(a, 90, 180)) return ENTIRE;
+    double lo = fnTan(a.lo);
+    double hi = fnTan(a.hi);
+    double slope = 1 + max(lo * lo, hi * hi);
+    double margin = trigMargin(a) * slope;
+    return Interval{ lo - margin, hi + margin };
+}
+Interval iLog(Interval a) {
+    if (a.hi <= 0) throw runtime_error("log: value must be positive!");
+    return widen(a.lo <= 0 ? -INF : log10(a.lo), log10(a.hi));
+}
+Interval iLn(Interval a) {
+    if (a.hi <= 0) throw runtime_error("ln: value must be positive!");
+    return widen(a.lo <= 0 ? -INF : log(a.lo), log(a.hi));
+}
+Interval iSqrt(Interval a) {
+    if (a.hi < 0) throw runtime_error("sqrt: value must be non-negative!");
+    if (a.lo <= 0) return Interval{ 0, nextafter(sqrt(a.hi), INF) };
+    return widen(sqrt(a.lo), sqrt(a.hi));
+}
+Interval iAbs(Interval a) {
+    if (containsZero(a)) return Interval{ 0, max(-a.lo, a.hi) };
+    return a.lo > 0 ? a : Interval{ -a.hi, -a.lo };
+}
+Interval iExp(Interval a) { return widen(exp(a.lo), exp(a.hi)); }
+Interval iNeg(Interval a) { return Interval{ 0.0 - a.hi, 0.0 - a.lo }; }
+
+// Static description of an opcode
+struct OpInfo {
+    const char* name;                   // Operator symbol or function name
+    uint8_t arity;                      // 2 for operators, 1 for functions, else 0
+    uint8_t precedence;                 // Binding strength of binary operators
+    bool rightAssociative;
+    double (*binary)(double, double);   // Set for binary operators
+    double (*unary)(double);            // Set for functions
+    void (*binaryPartials)(double, double, double&, double&);  // Operators: d/da, d/db
+    double (*unaryDerivative)(double);                          // Functions: f'(x)
+    Interval (*intervalBinary)(Interval, Interval);             // Operators over intervals
+    Interval (*intervalUnary)(Interval);                        // Functions over intervals
+};
+
+// Indexed by OpCode
+constexpr OpInfo OP_TABLE[] = {
+    { "const", 0, 0, false, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr },
+    { "var",   0, 0, false, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr },
+    { "load",  0, 0, false, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr },
+    { "store", 0, 0, false, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr },
+    { "+",     2, 1, false, opAdd,   nullptr, dAdd,    nullptr, iAdd,    nullptr },
+    { "-",     2, 1, false, opSub,   nullptr, dSub,    nullptr, iSub,    nullptr },
+    { "*",     2, 2, false, opMul,   nullptr, dMul,    nullptr, iMul,    nullptr },
+    { "/",     2, 2, false, opDiv,   nullptr, dDiv,    nullptr, iDiv,    nullptr },
+    { "%",     2, 2, false, opMod,   nullptr, dMod,    nullptr, iMod,    nullptr },
+    { "^",     2, 3, true,  opPow,   nullptr, dPow,    nullptr, iPow,    nullptr },
+    { "sin",   1, 0, false, nullptr, fnSin,   nullptr, dSin,    nullptr, iSin },
+    { "cos",   1, 0, false, nullptr, fnCos,   nullptr, dCos,    nullptr, iCos },
+    { "tan",   1, 0, false, nullptr, fnTan,   nullptr, dTan,    nullptr, iTan },
+    { "log",   1, 0, false, nullptr, fnLog,   nullptr, dLog,    nullptr, iLog },
+    { "ln",    1, 0, false, nullptr, fnLn,    nullptr, dLn,     nullptr, iLn },
+    { "sqrt",  1, 0, false, nullptr, fnSqrt,  nullptr, dSqrt,   nullptr, iSqrt },
+    { "abs",   1, 0, false, nullptr, fnAbs,   nullptr, dAbs,    nullptr, iAbs },
+    { "exp",   1, 0, false, nullptr, fnExp,   nullptr, dExp,    nullptr, iExp },
+    { "-",     1, 0, false, nullptr, fnNeg,   nullptr, dNeg,    nullptr, iNeg },    // Never matches a name
+    { "integrate", 2, 0, false, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr }, // Evaluated by numericCall*
+    { "root",  2, 0, false, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr }
+};
+static_assert(sizeof(OP_TABLE) / sizeof(OP_TABLE[0]) == OP_COUNT,
+              "OP_TABLE must have one entry per opcode");
+
+// Whether op is a call of integrate() or root(), which needs its program
+inline bool isNumericCall(OpCode op) {
+    return op == OP_INTEGRATE || op == OP_ROOT;
+}
 
-    // Check if string is a function
-    bool isFunction(const string& str) {
-        return (str == "sin" || str == "cos" || str == "tan" ||
-                str == "log" || str == "ln" || str == "sqrt" ||
-                str == "abs" || str == "exp");
+// Resolve an operator character (OP_COUNT if it is not one)
+OpCode lookupOperator(char c) {
+    for (int op = OP_ADD; op < OP_COUNT; op++) {
+        if (OP_TABLE[op].arity == 2 && !isNumericCall(static_cast<OpCode>(op)) && OP_TABLE[op].name[0] == c) {
+            return static_cast<OpCode>(op);
+        }
     }
+    return OP_COUNT;
+}
 
-    // Get operator precedence
-    int getPrecedence(const string& op) {
-        if (operatorPrecedence.find(op) != operatorPrecedence.end()) {
-            return operatorPrecedence[op];
+// Resolve a function name (OP_COUNT if it is not one)
+OpCode lookupFunction(string_view name) {
+    for (int op = OP_ADD; op < OP_COUNT; op++) {
+        if (OP_TABLE[op].arity == 1 && name == OP_TABLE[op].name) {
+            return static_cast<OpCode>(op);
         }
-        return 0;
     }
+    return OP_COUNT;
+}
 
-    // Tokenize the input expression
-    vector<Token> tokenize(const string& expression) {
-        vector<Token> tokens;
-        string current = "";
+// Resolve a built-in constant, folded into programs at compile time
+bool lookupConstant(string_view name, double& value) {
+    if (name == "pi") { value = M_PI; return true; }
+    if (name == "e") { value = M_E; return true; }
+    return false;
+}
 
-        for (size_t i = 0; i < expression.length(); i++) {
-            char c = expression[i];
+// Apply binary operation
+inline double applyBinaryOperator(double a, double b, OpCode op) {
+    return OP_TABLE[op].binary(a, b);
+}
 
-            // Skip whitespace
-            if (isspace(c)) continue;
+// Apply function
+inline double applyFunction(double value, OpCode func) {
+    return OP_TABLE[func].unary(value);
+}
 
-            // Numbers (including decimals)
-            if (isdigit(c) || c == '.') {
-                current += c;
-                // Check if next char is also digit/decimal
-                if (i + 1 < expression.length() &&
-                    (isdigit(expression[i + 1]) || expression[i + 1] == '.')) {
-                    continue;
-                }
-                tokens.push_back(Token(NUMBER, current, stod(current)));
-                current = "";
+// Evaluate an operation on constants at compile time. Returns false when
+// it would raise an error (e.g. 1/0), which is left for evaluation time.
+bool foldConstant(OpCode op, double a, double b, double& result) {
+    try {
+        result = OP_TABLE[op].arity == 2 ? applyBinaryOperator(a, b, op) : applyFunction(a, op);
+        return true;
+    } catch (const exception&) {
+        return false;
+    }
+}
+
+// ========================================
+// ACCURACY TIERS
+// Polynomial kernels for sin, cos, tan,
+// log, ln and exp, chosen per calculator
+// ========================================
+enum MathAccuracy : uint8_t {
+    ACCURACY_EXACT,     // libm
+    ACCURACY_ULP,       // Polynomials within about 1 ulp
+    ACCURACY_FAST,      // Shorter polynomials, relative error below 1e-7
+    ACCURACY_COUNT
+};
+
+// Bounds the accuracy benchmark holds the tiers to
+const double ULP_TIER_MAX_ULPS = 2.0;
+const double ULP_TIER_MAX_ULPS_TAN = 4.0;      // A quotient of two kernels
+const double FAST_TIER_MAX_RELATIVE = 1e-7;
+
+const char* const ACCURACY_NAMES[ACCURACY_COUNT] = { "exact", "ulp", "fast" };
+
+// Resolve a tier name (ACCURACY_COUNT if it is not one)
+MathAccuracy lookupAccuracy(string_view name) {
+    for (int tier = 0; tier < ACCURACY_COUNT; tier++) {
+        if (name == ACCURACY_NAMES[tier]) return static_cast<MathAccuracy>(tier);
+    }
+    return ACCURACY_COUNT;
+}
+
+inline uint64_t bitsOf(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+inline double fromBits(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// x + ROUND_MAGIC - ROUND_MAGIC rounds x to an integer k, and the low bits
+// of x + ROUND_MAGIC hold k in two's complement (for |k| < 2^51)
+const double ROUND_MAGIC = 6755399441055744.0;     // 1.5 * 2^52
+
+// The kernels are branch-free so column loops vectorize. Inputs outside
+// these ranges (and infinities and NaN) are left to libm.
+const double KERNEL_MAX_DEGREES = 1e13;            // 90 * k stays exact
+const double KERNEL_MAX_EXP = 708.0;               // 2^k stays a normal number
+
+// An angle in degrees as r + 90q with |r| <= 45. The reduction is exact,
+// unlike libm's x * pi / 180; r is returned in radians.
+inline double reduceDegrees(double x, uint64_t& quadrant) {
+    double shifted = x * (1.0 / 90.0) + ROUND_MAGIC;
+    quadrant = bitsOf(shifted);
+    double k = shifted - ROUND_MAGIC;
+    return (x - k * 90.0) * (M_PI / 180.0);
+}
+
+// sin and cos for |x| <= pi/4 (FreeBSD msun's kernels, below 1 ulp)
+inline double sinKernel(double x) {
+    const double S1 = -1.66666666666666324348e-01, S2 = 8.33333333332248946124e-03,
+                 S3 = -1.98412698298579493134e-04, S4 = 2.75573137070700676789e-06,
+                 S5 = -2.50507602534068634195e-08, S6 = 1.58969099521155010221e-10;
+    double z = x * x;
+    double w = z * z;
+    double r = S2 + z * (S3 + z * S4) + z * w * (S5 + z * S6);
+    return x + z * x * (S1 + z * r);
+}
+
+inline double cosKernel(double x) {
+    const double C1 = 4.16666666666666019037e-02, C2 = -1.38888888888741095749e-03,
+                 C3 = 2.48015872894767294178e-05, C4 = -2.75573143513906633035e-07,
+                 C5 = 2.08757232129817482790e-09, C6 = -1.13596475577881948265e-11;
+    double z = x * x;
+    double w = z * z;
+    double r = z * (C1 + z * (C2 + z * C3)) + w * w * (C4 + z * (C5 + z * C6));
+    double hz = 0.5 * z;
+    double v = 1.0 - hz;
+    return v + (((1.0 - v) - hz) + z * r);
+}
+
+// Taylor polynomials for |x| <= pi/4: next terms 2e-9 and 3e-8
+inline double sinKernelFast(double x) {
+    double z = x * x;
+    return x + x * z * (-1.0 / 6 + z * (1.0 / 120 + z * (-1.0 / 5040 + z * (1.0 / 362880))));
+}
+
+inline double cosKernelFast(double x) {
+    double z = x * x;
+    return 1.0 + z * (-0.5 + z * (1.0 / 24 + z * (-1.0 / 720 + z * (1.0 / 40320))));
+}
+
+// Flip the sign of value when bit 1 of flip is set
+inline double negateIf(double value, uint64_t flip) {
+    return fromBits(bitsOf(value) ^ ((flip & 2) << 62));
+}
+
+// a when bit 0 of choice is set, else b, without a branch (the quadrant
+// of random angles is unpredictable)
+inline double selectIf(uint64_t choice, double a, double b) {
+    uint64_t mask = 0 - (choice & 1);
+    return fromBits((bitsOf(a) & mask) | (bitsOf(b) & ~mask));
+}
+
+template <MathAccuracy A>
+inline double sinDegrees(double x) {
+    uint64_t q;
+    double r = reduceDegrees(x, q);
+    double s = A == ACCURACY_FAST ? sinKernelFast(r) : sinKernel(r);
+    double c = A == ACCURACY_FAST ? cosKernelFast(r) : cosKernel(r);
+    return negateIf(selectIf(q, c, s), q);                  // s, c, -s, -c
+}
+
+template <MathAccuracy A>
+inline double cosDegrees(double x) {
+    uint64_t q;
+    double r = reduceDegrees(x, q);
+    double s = A == ACCURACY_FAST ? sinKernelFast(r) : sinKernel(r);
+    double c = A == ACCURACY_FAST ? cosKernelFast(r) : cosKernel(r);
+    return negateIf(selectIf(q, s, c), q + 1);              // c, -s, -c, s
+}
+
+template <MathAccuracy A>
+inline double tanDegrees(double x) {
+    uint64_t q;
+    double r = reduceDegrees(x, q);
+    double s = A == ACCURACY_FAST ? sinKernelFast(r) : sinKernel(r);
+    double c = A == ACCURACY_FAST ? cosKernelFast(r) : cosKernel(r);
+    return negateIf(selectIf(q, c, s) / selectIf(q, s, c), q << 1);    // s/c or -c/s
+}
+
+// One value at a time, a branch on the quadrant costs less than the
+// second kernel the branch-free forms compute. Results are the same.
+template <MathAccuracy A>
+inline double sinDegreesScalar(double x) {
+    uint64_t q;
+    double r = reduceDegrees(x, q);
+    double v = (q & 1) ? (A == ACCURACY_FAST ? cosKernelFast(r) : cosKernel(r))
+                       : (A == ACCURACY_FAST ? sinKernelFast(r) : sinKernel(r));
+    return negateIf(v, q);
+}
+
+template <MathAccuracy A>
+inline double cosDegreesScalar(double x) {
+    uint64_t q;
+    double r = reduceDegrees(x, q);
+    double v = (q & 1) ? (A == ACCURACY_FAST ? sinKernelFast(r) : sinKernel(r))
+                       : (A == ACCURACY_FAST ? cosKernelFast(r) : cosKernel(r));
+    return negateIf(v, q + 1);
+}
+
+// e^x as 2^k e^r with |r| <= ln(2)/2 (FreeBSD msun's rational form)
+template <MathAccuracy A>
+inline double expKernel(double x) {
+    const double LN2_HI = 6.93147180369123816490e-01, LN2_LO = 1.90821492927058770002e-10;
+    double shifted = x * 1.44269504088896338700 + ROUND_MAGIC;
+    double k = shifted - ROUND_MAGIC;
+    double hi = x - k * LN2_HI;
+    double lo = k * LN2_LO;
+    double r = hi - lo;
+
+    double y;
+    if (A == ACCURACY_FAST) {
+        y = 1.0 + r * (1.0 + r * (1.0 / 2 + r * (1.0 / 6 + r * (1.0 / 24 + r * (1.0 / 120 +
+                  r * (1.0 / 720 + r * (1.0 / 5040)))))));
+    } else {
+        const double P1 = 1.66666666666666019037e-01, P2 = -2.77777777770155933842e-03,
+                     P3 = 6.61375632143793436117e-05, P4 = -1.65339022054652515390e-06,
+                     P5 = 4.13813679705723846039e-08;
+        double t = r * r;
+        double c = r - t * (P1 + t * (P2 + t * (P3 + t * (P4 + t * P5))));
+        y = 1.0 - ((lo - (r * c) / (2.0 - c)) - hi);
+    }
+    return fromBits(bitsOf(y) + (bitsOf(shifted) << 52));  // Add k to the exponent
+}
+
+// A positive normal x as 2^k (1 + f) with sqrt(2)/2 <= 1 + f < sqrt(2)
+inline double splitLog(double x, double& k) {
+    uint64_t bits = bitsOf(x) + (0x3ff0000000000000ULL - 0x3fe6a09e00000000ULL);
+    k = fromBits(0x4330000000000000ULL | (bits >> 52)) - (4503599627370496.0 + 1023.0);
+    return fromBits((bits & 0x000fffffffffffffULL) + 0x3fe6a09e00000000ULL) - 1.0;
+}
+
+// ln(1 + f) - f + f^2/2, with s = f / (2 + f) (msun's Lg1..Lg7 polynomial)
+inline double logTail(double s, double hfsq) {
+    const double Lg1 = 6.666666666666735130e-01, Lg2 = 3.999999999940941908e-01,
+                 Lg3 = 2.857142874366239149e-01, Lg4 = 2.222219843214978396e-01,
+                 Lg5 = 1.818357216161805012e-01, Lg6 = 1.531383769920937332e-01,
+                 Lg7 = 1.479819860511658591e-01;
+    double z = s * s;
+    double w = z * z;
+    double t1 = w * (Lg2 + w * (Lg4 + w * Lg6));
+    double t2 = z * (Lg1 + w * (Lg3 + w * (Lg5 + w * Lg7)));
+    return s * (hfsq + t1 + t2);
+}
+
+// ln(1 + f) for |f| < 0.42 by the series 2 atanh(s), s = f / (2 + f)
+inline double logSeriesFast(double f) {
+    double s = f / (2.0 + f);
+    double z = s * s;
+    return 2.0 * s * (1.0 + z * (1.0 / 3 + z * (1.0 / 5 + z * (1.0 / 7 + z * (1.0 / 9)))));
+}
+
+template <MathAccuracy A>
+inline double lnKernel(double x) {
+    const double LN2_HI = 6.93147180369123816490e-01, LN2_LO = 1.90821492927058770002e-10;
+    double k;
+    double f = splitLog(x, k);
+    if (A == ACCURACY_FAST) return k * M_LN2 + logSeriesFast(f);
+
+    double hfsq = 0.5 * f * f;
+    double s = f / (2.0 + f);
+    return logTail(s, hfsq) + k * LN2_LO - hfsq + f + k * LN2_HI;
+}
+
+template <MathAccuracy A>
+inline double log10Kernel(double x) {
+    double k;
+    double f = splitLog(x, k);
+    if (A == ACCURACY_FAST) return k * (M_LN2 / M_LN10) + logSeriesFast(f) * (1 / M_LN10);
+
+    // Keep ln(1 + f) as hi + lo so the scaling by 1/ln(10) loses no bits
+    const double IVLN10_HI = 4.34294481878168880939e-01, IVLN10_LO = 2.50829467116452752298e-11,
+                 LOG10_2_HI = 3.01029995663611771306e-01, LOG10_2_LO = 3.69423907715893078616e-13;
+    double hfsq = 0.5 * f * f;
+    double s = f / (2.0 + f);
+    double hi = fromBits(bitsOf(f - hfsq) & 0xffffffff00000000ULL);
+    double lo = f - hi - hfsq + logTail(s, hfsq);
+    double y = k * LOG10_2_HI;
+    double valueHi = hi * IVLN10_HI;
+    double valueLo = k * LOG10_2_LO + (lo + hi) * IVLN10_LO + lo * IVLN10_HI;
+    double w = y + valueHi;
+    valueLo += (y - w) + valueHi;
+    return valueLo + w;
+}
+
+// Where the kernels apply; elsewhere the tiers call libm
+inline bool inDegreeRange(double v) { return fabs(v) <= KERNEL_MAX_DEGREES; }
+inline bool inExpRange(double v) { return fabs(v) <= KERNEL_MAX_EXP; }
+inline bool inLogRange(double v) { return v >= numeric_limits<double>::min() && v < INF; }
+
+// Scalar functions of each tier, with the same domain errors as fnLog etc.
+template <MathAccuracy A>
+double fnSinTier(double value) { return inDegreeRange(value) ? sinDegreesScalar<A>(value) : fnSin(value); }
+template <MathAccuracy A>
+double fnCosTier(double value) { return inDegreeRange(value) ? cosDegreesScalar<A>(value) : fnCos(value); }
+template <MathAccuracy A>
+double fnTanTier(double value) { return inDegreeRange(value) ? tanDegrees<A>(value) : fnTan(value); }
+template <MathAccuracy A>
+double fnLogTier(double value) { return inLogRange(value) ? log10Kernel<A>(value) : fnLog(value); }
+template <MathAccuracy A>
+double fnLnTier(double value) { return inLogRange(value) ? lnKernel<A>(value) : fnLn(value); }
+template <MathAccuracy A>
+double fnExpTier(double value) { return inExpRange(value) ? expKernel<A>(value) : fnExp(value); }
+
+typedef double (*UnaryFunction)(double);
+
+// Functions of one tier, indexed by OpCode like OP_TABLE[op].unary
+struct MathKernels {
+    UnaryFunction unary[OP_COUNT];
+};
+
+template <MathAccuracy A>
+constexpr MathKernels makeMathKernels() {
+    MathKernels kernels = {};
+    for (int op = 0; op < OP_COUNT; op++) {
+        kernels.unary[op] = OP_TABLE[op].unary;
+    }
+    if (A != ACCURACY_EXACT) {
+        kernels.unary[OP_SIN] = fnSinTier<A>;
+        kernels.unary[OP_COS] = fnCosTier<A>;
+        kernels.unary[OP_TAN] = fnTanTier<A>;
+        kernels.unary[OP_LOG] = fnLogTier<A>;
+    }
+    // libm's ln and exp (glibc's are table-driven and within 1 ulp) are
+    // faster one value at a time than the ulp polynomials, so the ulp tier
+    // uses those only in batches, where they vectorize
+    if (A == ACCURACY_FAST) {
+        kernels.unary[OP_LN] = fnLnTier<A>;
+        kernels.unary[OP_EXP] = fnExpTier<A>;
+    }
+    return kernels;
+}
+
+// Whether a function has kernels in the ulp and fast tiers
+inline bool hasTierKernel(OpCode func) {
+    return func == OP_SIN || func == OP_COS || func == OP_TAN ||
+           func == OP_LOG || func == OP_LN || func == OP_EXP;
+}
+
+// Indexed by MathAccuracy
+constexpr MathKernels MATH_KERNELS[] = {
+    makeMathKernels<ACCURACY_EXACT>(),
+    makeMathKernels<ACCURACY_ULP>(),
+    makeMathKernels<ACCURACY_FAST>()
+};
+static_assert(sizeof(MATH_KERNELS) / sizeof(MATH_KERNELS[0]) == ACCURACY_COUNT,
+              "MATH_KERNELS must have one entry per accuracy tier");
+
+// ========================================
+// SIMD KERNELS
+// Column-wide arithmetic used by batch
+// evaluation (AVX, SSE2 or scalar)
+// ========================================
+#if defined(__AVX__)
+#include <immintrin.h>
+typedef __m256d SimdVector;
+const size_t SIMD_WIDTH = 4;
+inline SimdVector simdLoad(const double* p) { return _mm256_loadu_pd(p); }
+inline SimdVector simdBroadcast(double v) { return _mm256_set1_pd(v); }
+inline void simdStore(double* p, SimdVector v) { _mm256_storeu_pd(p, v); }
+inline SimdVector simdAdd(SimdVector a, SimdVector b) { return _mm256_add_pd(a, b); }
+inline SimdVector simdSub(SimdVector a, SimdVector b) { return _mm256_sub_pd(a, b); }
+inline SimdVector simdMul(SimdVector a, SimdVector b) { return _mm256_mul_pd(a, b); }
+inline SimdVector simdDiv(SimdVector a, SimdVector b) { return _mm256_div_pd(a, b); }
+inline SimdVector simdSqrt(SimdVector a) { return _mm256_sqrt_pd(a); }
+inline SimdVector simdAbs(SimdVector a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+typedef __m128d SimdVector;
+const size_t SIMD_WIDTH = 2;
+inline SimdVector simdLoad(const double* p) { return _mm_loadu_pd(p); }
+inline SimdVector simdBroadcast(double v) { return _mm_set1_pd(v); }
+inline void simdStore(double* p, SimdVector v) { _mm_storeu_pd(p, v); }
+inline SimdVector simdAdd(SimdVector a, SimdVector b) { return _mm_add_pd(a, b); }
+inline SimdVector simdSub(SimdVector a, SimdVector b) { return _mm_sub_pd(a, b); }
+inline SimdVector simdMul(SimdVector a, SimdVector b) { return _mm_mul_pd(a, b); }
+inline SimdVector simdDiv(SimdVector a, SimdVector b) { return _mm_div_pd(a, b); }
+inline SimdVector simdSqrt(SimdVector a) { return _mm_sqrt_pd(a); }
+inline SimdVector simdAbs(SimdVector a) { return _mm_andnot_pd(_mm_set1_pd(-0.0), a); }
+#else
+const size_t SIMD_WIDTH = 1;
+#endif
+
+// Non-owning view over contiguous values (stand-in for C++20 std::span)
+template <typename T>
+struct Span {
+    T* data;
+    size_t size;
+
+    Span() : data(nullptr), size(0) {}
+    Span(T* d, size_t n) : data(d), size(n) {}
+    Span(vector<typename remove_const<T>::type>& v) : data(v.data()), size(v.size()) {}
+};
+
+// One operand of a batch operation: a column, or a single value for every row
+struct BatchOperand {
+    const double* column;   // nullptr when the operand is constant
+    double value;
+
+    bool isConstant() const { return column == nullptr; }
+};
+
+// Element-wise operations, each with a scalar and (if available) a SIMD form
+struct AddOp {
+    double operator()(double a, double b) const { return a + b; }
+#if defined(__AVX__) || defined(__SSE2__)
+    SimdVector operator()(SimdVector a, SimdVector b) const { return simdAdd(a, b); }
+#endif
+};
+
+struct SubOp {
+    double operator()(double a, double b) const { return a - b; }
+#if defined(__AVX__) || defined(__SSE2__)
+    SimdVector operator()(SimdVector a, SimdVector b) const { return simdSub(a, b); }
+#endif
+};
+
+struct MulOp {
+    double operator()(double a, double b) const { return a * b; }
+#if defined(__AVX__) || defined(__SSE2__)
+    SimdVector operator()(SimdVector a, SimdVector b) const { return simdMul(a, b); }
+#endif
+};
+
+struct DivOp {
+    double operator()(double a, double b) const { return a / b; }
+#if defined(__AVX__) || defined(__SSE2__)
+    SimdVector operator()(SimdVector a, SimdVector b) const { return simdDiv(a, b); }
+#endif
+};
+
+struct SqrtOp {
+    double operator()(double a) const { return sqrt(a); }
+#if defined(__AVX__) || defined(__SSE2__)
+    SimdVector operator()(SimdVector a) const { return simdSqrt(a); }
+#endif
+};
+
+struct AbsOp {
+    double operator()(double a) const { return fabs(a); }
+#if defined(__AVX__) || defined(__SSE2__)
+    SimdVector operator()(SimdVector a) const { return simdAbs(a); }
+#endif
+};
+
+struct NegOp {
+    double operator()(double a) const { return fnNeg(a); }
+#if defined(__AVX__) || defined(__SSE2__)
+    SimdVector operator()(SimdVector a) const { return simdSub(simdBroadcast(0.0), a); }
+#endif
+};
+
+// out[i] = op(a[i], b[i]); either operand may be a broadcast constant,
+// and out may alias an input column
+template <typename Op>
+void binaryKernel(const BatchOperand& a, const BatchOperand& b, double* out, size_t n, Op op) {
+    size_t i = 0;
+    if (!a.isConstant() && !b.isConstant()) {
+#if defined(__AVX__) || defined(__SSE2__)
+        for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH) {
+            simdStore(out + i, op(simdLoad(a.column + i), simdLoad(b.column + i)));
+        }
+#endif
+        for (; i < n; i++) out[i] = op(a.column[i], b.column[i]);
+    } else if (!a.isConstant()) {
+#if defined(__AVX__) || defined(__SSE2__)
+        SimdVector vb = simdBroadcast(b.value);
+        for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH) {
+            simdStore(out + i, op(simdLoad(a.column + i), vb));
+        }
+#endif
+        for (; i < n; i++) out[i] = op(a.column[i], b.value);
+    } else {
+#if defined(__AVX__) || defined(__SSE2__)
+        SimdVector va = simdBroadcast(a.value);
+        for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH) {
+            simdStore(out + i, op(va, simdLoad(b.column + i)));
+        }
+#endif
+        for (; i < n; i++) out[i] = op(a.value, b.column[i]);
+    }
+}
+
+// out[i] = op(a[i]) for a column operand
+template <typename Op>
+void unaryKernel(const double* a, double* out, size_t n, Op op) {
+    size_t i = 0;
+#if defined(__AVX__) || defined(__SSE2__)
+    for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH) {
+        simdStore(out + i, op(simdLoad(a + i)));
+    }
+#endif
+    for (; i < n; i++) out[i] = op(a[i]);
+}
+
+// True if any value in the operand satisfies the predicate (domain checks)
+template <typename Pred>
+bool anyValue(const BatchOperand& a, size_t n, Pred pred) {
+    if (a.isConstant()) return pred(a.value);
+    bool found = false;
+    for (size_t i = 0; i < n; i++) found |= pred(a.column[i]);  // Branch-free so it vectorizes
+    return found;
+}
+
+// out[i] = fn(a[i], b[i]) for operations without a SIMD form
+template <typename Fn>
+void scalarBinaryKernel(const BatchOperand& a, const BatchOperand& b, double* out, size_t n, Fn fn) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = fn(a.isConstant() ? a.value : a.column[i],
+                    b.isConstant() ? b.value : b.column[i]);
+    }
+}
+
+// Batch counterpart of applyBinaryOperator (same semantics and errors)
+void applyBinaryOperatorBatch(const BatchOperand& a, const BatchOperand& b,
+                              double* out, size_t n, OpCode op) {
+    switch (op) {
+        case OP_ADD: binaryKernel(a, b, out, n, AddOp()); return;
+        case OP_SUB: binaryKernel(a, b, out, n, SubOp()); return;
+        case OP_MUL: binaryKernel(a, b, out, n, MulOp()); return;
+        case OP_DIV:
+            if (anyValue(b, n, [](double v) { return v == 0; })) {
+                throw runtime_error("Division by zero!");
             }
-            // Letters (functions or variables)
-            else if (isalpha(c)) {
-                current += c;
-                // Continue reading letters
-                while (i + 1 < expression.length() && isalpha(expression[i + 1])) {
-                    current += expression[++i];
-                }
+            binaryKernel(a, b, out, n, DivOp());
+            return;
+        case OP_MOD:
+            if (anyValue(b, n, [](double v) { return v == 0; })) {
+                throw runtime_error("Modulo by zero!");
+            }
+            scalarBinaryKernel(a, b, out, n, [](double x, double y) { return fmod(x, y); });
+            return;
+        case OP_POW:
+            if (b.isConstant() && b.value == 2.0) {
+                binaryKernel(a, a, out, n, MulOp());  // x^2 is exact as x*x
+            } else {
+                scalarBinaryKernel(a, b, out, n, [](double x, double y) { return pow(x, y); });
+            }
+            return;
+        default: break;
+    }
+    throw runtime_error("Unknown operator!");
+}
 
-                if (isFunction(current)) {
-                    tokens.push_back(Token(FUNCTION, current));
-                } else {
-                    tokens.push_back(Token(VARIABLE, current));
-                }
-                current = "";
+// out[i] = Kernel(a[i]) in one branch-free pass, or Scalar (which falls
+// back to libm) when some input is outside the kernel's range
+template <double (*Kernel)(double), double (*Scalar)(double), bool (*InRange)(double)>
+void tierKernel(const double* a, double* out, size_t n) {
+    BatchOperand operand = { a, 0.0 };
+    if (anyValue(operand, n, [](double v) { return !InRange(v); })) {
+        for (size_t i = 0; i < n; i++) out[i] = Scalar(a[i]);
+        return;
+    }
+
+    // Fixed-size groups through a local buffer: no aliasing and no partial
+    // vectors, so the compiler vectorizes these even at -O2
+    const size_t LANES = 8;
+    double lanes[LANES];
+    size_t i = 0;
+    for (; i + LANES <= n; i += LANES) {
+        for (size_t j = 0; j < LANES; j++) lanes[j] = Kernel(a[i + j]);
+        for (size_t j = 0; j < LANES; j++) out[i + j] = lanes[j];
+    }
+    for (; i < n; i++) out[i] = Kernel(a[i]);
+}
+
+// Batch form of a tier's sin, cos, tan, log, ln or exp (domain checked)
+template <MathAccuracy A>
+void tierFunctionBatch(const double* a, double* out, size_t n, OpCode func) {
+    switch (func) {
+        case OP_SIN: tierKernel<sinDegrees<A>, fnSinTier<A>, inDegreeRange>(a, out, n); return;
+        case OP_COS: tierKernel<cosDegrees<A>, fnCosTier<A>, inDegreeRange>(a, out, n); return;
+        case OP_TAN: tierKernel<tanDegrees<A>, fnTanTier<A>, inDegreeRange>(a, out, n); return;
+        case OP_LOG: tierKernel<log10Kernel<A>, fnLogTier<A>, inLogRange>(a, out, n); return;
+        case OP_LN: tierKernel<lnKernel<A>, fnLnTier<A>, inLogRange>(a, out, n); return;
+        case OP_EXP: tierKernel<expKernel<A>, fnExpTier<A>, inExpRange>(a, out, n); return;
+        default: break;
+    }
+    throw runtime_error("Unknown function!");
+}
+
+// Batch counterpart of applyFunction (same semantics and errors)
+void applyFunctionBatch(const double* a, double* out, size_t n, OpCode func,
+                        MathAccuracy accuracy = ACCURACY_EXACT) {
+    BatchOperand operand = { a, 0.0 };
+    if (accuracy != ACCURACY_EXACT && hasTierKernel(func)) {
+        if ((func == OP_LOG || func == OP_LN) && anyValue(operand, n, [](double v) { return v <= 0; })) {
+            throw runtime_error(func == OP_LOG ? "log: value must be positive!" : "ln: value must be positive!");
+        }
+        if (accuracy == ACCURACY_FAST) {
+            tierFunctionBatch<ACCURACY_FAST>(a, out, n, func);
+        } else {
+            tierFunctionBatch<ACCURACY_ULP>(a, out, n, func);
+        }
+        return;
+    }
+    switch (func) {
+        case OP_SIN:
+            for (size_t i = 0; i < n; i++) out[i] = sin(a[i] * M_PI / 180.0);
+            return;
+        case OP_COS:
+            for (size_t i = 0; i < n; i++) out[i] = cos(a[i] * M_PI / 180.0);
+            return;
+        case OP_TAN:
+            for (size_t i = 0; i < n; i++) out[i] = tan(a[i] * M_PI / 180.0);
+            return;
+        case OP_LOG:
+            if (anyValue(operand, n, [](double v) { return v <= 0; })) {
+                throw runtime_error("log: value must be positive!");
             }
-            // Operators
-            else if (isOperator(c)) {
-                string op(1, c);
-                tokens.push_back(Token(OPERATOR, op));
+            for (size_t i = 0; i < n; i++) out[i] = log10(a[i]);
+            return;
+        case OP_LN:
+            if (anyValue(operand, n, [](double v) { return v <= 0; })) {
+                throw runtime_error("ln: value must be positive!");
             }
-            // Parentheses
-            else if (c == '(') {
-                tokens.push_back(Token(LPAREN, "("));
+            for (size_t i = 0; i < n; i++) out[i] = log(a[i]);
+            return;
+        case OP_SQRT:
+            if (anyValue(operand, n, [](double v) { return v < 0; })) {
+                throw runtime_error("sqrt: value must be non-negative!");
             }
-            else if (c == ')') {
-                tokens.push_back(Token(RPAREN, ")"));
+            unaryKernel(a, out, n, SqrtOp());
+            return;
+        case OP_ABS: unaryKernel(a, out, n, AbsOp()); return;
+        case OP_NEG: unaryKernel(a, out, n, NegOp()); return;
+        case OP_EXP:
+            for (size_t i = 0; i < n; i++) out[i] = exp(a[i]);
+            return;
+        default: break;
+    }
+    throw runtime_error("Unknown function!");
+}
+
+// ========================================
+// COMPILED EXPRESSION
+// Flat postfix program parsed once and
+// re-evaluated with new variable values
+// ========================================
+struct Instruction {
+    OpCode op;
+    uint32_t slot;      // OP_PUSH_VAR: variable table slot, OP_*_TEMP: temporary index
+    double value;       // OP_PUSH_CONST: literal value
+};
+
+// What the optimizer did to a program
+struct OptimizationStats {
+    size_t instructionsBefore;
+    size_t instructionsAfter;
+    size_t constantsFolded;         // Operations evaluated at compile time
+    size_t subexpressionsShared;    // Repeated subexpressions computed once
+};
+
+// integrate() or root() inside a program (defined below, evaluated by the
+// numerical methods)
+struct NumericCall;
+double numericCallValue(const NumericCall& call, const double* values, double a, double b);
+void numericCallGradient(const NumericCall& call, const double* values, const vector<uint32_t>& slots,
+                         const double* a, const double* b, double* result);
+Interval numericCallInterval(const NumericCall& call, const Interval* values, Interval a, Interval b);
+
+class CompiledExpression {
+private:
+    vector<Instruction> code;           // Postfix program
+    vector<string> variableNames;       // Variables the program reads
+    vector<uint32_t> variableSlots;     // Their variable table slots
+    vector<uint32_t> pushInputs;        // Per OP_PUSH_VAR, in code order: its index in variableSlots
+    uint32_t slotCount;                 // One past the highest slot read
+    size_t maxStackDepth;               // Deepest value stack the program needs
+    uint32_t tempCount;                 // Temporaries used by OP_*_TEMP
+    vector<shared_ptr<const NumericCall>> calls;    // Read by OP_INTEGRATE and OP_ROOT
+    OptimizationStats stats;
+
+    // Fill pushInputs once the code and inputs are final, so gradients do
+    // not search variableSlots on every push
+    void indexInputs() {
+        unordered_map<uint32_t, uint32_t> indexOf;
+        for (size_t i = 0; i < variableSlots.size(); i++) {
+            indexOf.emplace(variableSlots[i], static_cast<uint32_t>(i));
+        }
+        pushInputs.clear();
+        for (const Instruction& ins : code) {
+            if (ins.op == OP_PUSH_VAR) pushInputs.push_back(indexOf.at(ins.slot));
+        }
+    }
+
+    friend class ScientificCalculator;
+    friend class ExpressionOptimizer;
+    friend class SnapshotImage;
+
+public:
+    CompiledExpression() : slotCount(0), maxStackDepth(0), tempCount(0), stats() {}
+
+    const vector<Instruction>& getCode() const { return code; }
+    const vector<string>& getVariableNames() const { return variableNames; }
+    const vector<uint32_t>& getVariableSlots() const { return variableSlots; }
+    uint32_t getSlotCount() const { return slotCount; }
+    uint32_t getTempCount() const { return tempCount; }
+    size_t getMaxStackDepth() const { return maxStackDepth; }
+    const vector<shared_ptr<const NumericCall>>& getCalls() const { return calls; }
+    const OptimizationStats& getOptimizationStats() const { return stats; }
+
+    // Evaluate with values indexed by variable slot (at least getSlotCount()),
+    // computing functions at the given accuracy tier
+    double evaluate(const double* values, MathAccuracy accuracy = ACCURACY_EXACT) const {
+        // The program was validated when compiled, so the stack can neither
+        // underflow nor exceed maxStackDepth here
+        double localStack[32];
+        vector<double> heapStack;
+        double* stackBase = localStack;
+        if (maxStackDepth + tempCount > 32) {
+            heapStack.resize(maxStackDepth + tempCount);
+            stackBase = heapStack.data();
+        }
+        double* temps = stackBase + maxStackDepth;
+        const UnaryFunction* functions = MATH_KERNELS[accuracy].unary;
+
+        double* top = stackBase;  // One past the last pushed value
+        for (const Instruction& ins : code) {
+            switch (ins.op) {
+                case OP_PUSH_CONST:
+                    *top++ = ins.value;
+                    break;
+
+                case OP_PUSH_VAR:
+                    *top++ = values[ins.slot];
+                    break;
+
+                case OP_LOAD_TEMP:
+                    *top++ = temps[ins.slot];
+                    break;
+
+                case OP_STORE_TEMP:
+                    temps[ins.slot] = top[-1];
+                    break;
+
+                case OP_ADD:
+                    --top;
+                    top[-1] += top[0];
+                    break;
+
+                case OP_SUB:
+                    --top;
+                    top[-1] -= top[0];
+                    break;
+
+                case OP_MUL:
+                    --top;
+                    top[-1] *= top[0];
+                    break;
+
+                case OP_DIV: case OP_MOD: case OP_POW:
+                    --top;
+                    top[-1] = OP_TABLE[ins.op].binary(top[-1], top[0]);
+                    break;
+
+                case OP_INTEGRATE: case OP_ROOT:
+                    --top;
+                    top[-1] = numericCallValue(*calls[ins.slot], values, top[-1], top[0]);
+                    break;
+
+                default:
+                    top[-1] = functions[ins.op](top[-1]);
+                    break;
             }
         }
 
-        return tokens;
+        return top[-1];
     }
 
-    // Convert infix to postfix using Shunting Yard algorithm
-    queue<Token> infixToPostfix(const vector<Token>& tokens) {
-        queue<Token> output;
-        stack<Token> operators;
+    // Value and the partial derivative with respect to each variable, in
+    // getVariableNames() order, from one pass over the program. Every stack
+    // entry is a dual number: a value followed by one derivative per variable.
+    // The program must be optimized or read from a snapshot (which index it).
+    double evaluateGradient(const double* values, double* gradient) const {
+        const size_t width = variableSlots.size() + 1;
+        double localStorage[256];
+        vector<double> heapStorage;
+        double* storage = localStorage;
+        if ((maxStackDepth + tempCount) * width > 256) {
+            heapStorage.resize((maxStackDepth + tempCount) * width);
+            storage = heapStorage.data();
+        }
+        double* temps = storage + maxStackDepth * width;
 
-        for (const Token& token : tokens) {
-            switch (token.type) {
-                case NUMBER:
-                    output.push(token);
-                    break;
+        // Derivative terms of inputs that do not vary are skipped, so an
+        // undefined partial (such as d(a^b)/db for a < 0) cannot leak in
+        auto chain = [](double partial, double derivative) {
+            return derivative == 0 ? 0.0 : partial * derivative;
+        };
 
-                case VARIABLE:
-                    // Replace variable with its value
-                    if (variables.find(token.value) != variables.end()) {
-                        output.push(Token(NUMBER, token.value, variables[token.value]));
-                    } else {
-                        throw runtime_error("Undefined variable: " + token.value);
-                    }
+        const uint32_t* input = pushInputs.data();  // Index of the next pushed variable
+        double* top = storage;  // Start of the next free entry
+        for (const Instruction& ins : code) {
+            switch (ins.op) {
+                case OP_PUSH_CONST:
+                    top[0] = ins.value;
+                    fill(top + 1, top + width, 0.0);
+                    top += width;
                     break;
 
-                case FUNCTION:
-                    operators.push(token);
+                case OP_PUSH_VAR:
+                    top[0] = values[ins.slot];
+                    fill(top + 1, top + width, 0.0);
+                    top[1 + *input++] = 1.0;
+                    top += width;
                     break;
 
-                case OPERATOR:
-                    while (!operators.empty() &&
-                           operators.top().type != LPAREN &&
-                           ((operators.top().type == FUNCTION) ||
-                            (operators.top().type == OPERATOR &&
-                             getPrecedence(operators.top().value) >= getPrecedence(token.value)))) {
-                        output.push(operators.top());
-                        operators.pop();
-                    }
-                    operators.push(token);
+                case OP_LOAD_TEMP:
+                    copy(temps + ins.slot * width, temps + (ins.slot + 1) * width, top);
+                    top += width;
                     break;
 
-                case LPAREN:
-                    operators.push(token);
+                case OP_STORE_TEMP:
+                    copy(top - width, top, temps + ins.slot * width);
                     break;
 
-                case RPAREN:
-                    while (!operators.empty() && operators.top().type != LPAREN) {
-                        output.push(operators.top());
-                        operators.pop();
-                    }
-                    if (operators.empty()) {
-                        throw runtime_error("Mismatched parentheses!");
-                    }
-                    operators.pop(); // Remove left parenthesis
+                case OP_INTEGRATE: case OP_ROOT:
+                    top -= width;
+                    numericCallGradient(*calls[ins.slot], values, variableSlots, top - width, top, top - width);
+                    break;
 
-                    // If there's a function on top, pop it too
-                    if (!operators.empty() && operators.top().type == FUNCTION) {
-                        output.push(operators.top());
-                        operators.pop();
+                default:
+                    if (OP_TABLE[ins.op].arity == 2) {
+                        top -= width;
+                        double* a = top - width;
+                        const double* b = top;
+                        double result = OP_TABLE[ins.op].binary(a[0], b[0]);
+                        double da, db;
+                        OP_TABLE[ins.op].binaryPartials(a[0], b[0], da, db);
+                        for (size_t i = 1; i < width; i++) {
+                            a[i] = chain(da, a[i]) + chain(db, b[i]);
+                        }
+                        a[0] = result;
+                    } else {
+                        double* a = top - width;
+                        double result = OP_TABLE[ins.op].unary(a[0]);
+                        double derivative = OP_TABLE[ins.op].unaryDerivative(a[0]);
+                        for (size_t i = 1; i < width; i++) {
+                            a[i] = chain(derivative, a[i]);
+                        }
+                        a[0] = result;
                     }
                     break;
             }
         }
 
-        // Pop remaining operators
-        while (!operators.empty()) {
-            if (operators.top().type == LPAREN || operators.top().type == RPAREN) {
-                throw runtime_error("Mismatched parentheses!");
+        copy(storage + 1, storage + width, gradient);
+        return storage[0];
+    }
+
+    // Bounds on the value over a box of inputs, indexed by variable slot.
+    // A point value is the interval { v, v }.
+    Interval evaluateInterval(const Interval* values) const {
+        Interval localStack[32];
+        vector<Interval> heapStack;
+        Interval* stackBase = localStack;
+        if (maxStackDepth + tempCount > 32) {
+            heapStack.resize(maxStackDepth + tempCount);
+            stackBase = heapStack.data();
+        }
+        Interval* temps = stackBase + maxStackDepth;
+
+        Interval* top = stackBase;
+        for (const Instruction& ins : code) {
+            switch (ins.op) {
+                case OP_PUSH_CONST:
+                    *top++ = Interval{ ins.value, ins.value };
+                    break;
+
+                case OP_PUSH_VAR:
+                    *top++ = values[ins.slot];
+                    break;
+
+                case OP_LOAD_TEMP:
+                    *top++ = temps[ins.slot];
+                    break;
+
+                case OP_STORE_TEMP:
+                    temps[ins.slot] = top[-1];
+                    break;
+
+                case OP_INTEGRATE: case OP_ROOT:
+                    --top;
+                    top[-1] = numericCallInterval(*calls[ins.slot], values, top[-1], top[0]);
+                    break;
+
+                default:
+                    if (OP_TABLE[ins.op].arity == 2) {
+                        --top;
+                        top[-1] = OP_TABLE[ins.op].intervalBinary(top[-1], top[0]);
+                    } else {
+                        top[-1] = OP_TABLE[ins.op].intervalUnary(top[-1]);
+                    }
+                    break;
+            }
+        }
+
+        return top[-1];
+    }
+
+    // Evaluate with values looked up by name (once per variable, not per use)
+    double evaluate(const map<string, double>& bindings) const {
+        vector<double> values(slotCount);
+        for (size_t i = 0; i < variableNames.size(); i++) {
+            auto it = bindings.find(variableNames[i]);
+            if (it == bindings.end()) {
+                throw runtime_error("Undefined variable: " + variableNames[i]);
+            }
+            values[variableSlots[i]] = it->second;
+        }
+        return evaluate(values.data());
+    }
+
+    // Evaluate over many rows at once. bindings[slot] (at least getSlotCount()
+    // entries) supplies each variable as a column of output.size values or as
+    // a constant. Rows are processed in blocks so each instruction runs as
+    // one kernel over the whole block.
+    void evaluateBatch(const BatchOperand* bindings, Span<double> output,
+                       MathAccuracy accuracy = ACCURACY_EXACT) const {
+        const size_t BLOCK = 512;
+        vector<double> storage((maxStackDepth + tempCount) * BLOCK);  // Stack levels, then temps
+        vector<BatchOperand> operands(maxStackDepth);
+        vector<BatchOperand> temps(tempCount);
+
+        for (size_t start = 0; start < output.size; start += BLOCK) {
+            size_t n = min(BLOCK, output.size - start);
+            size_t depth = 0;
+
+            for (const Instruction& ins : code) {
+                switch (ins.op) {
+                    case OP_PUSH_CONST:
+                        operands[depth].column = nullptr;
+                        operands[depth].value = ins.value;
+                        depth++;
+                        break;
+
+                    case OP_PUSH_VAR:
+                        operands[depth] = bindings[ins.slot];
+                        if (!operands[depth].isConstant()) {
+                            operands[depth].column += start;  // Read inputs in place
+                        }
+                        depth++;
+                        break;
+
+                    case OP_LOAD_TEMP:
+                        operands[depth++] = temps[ins.slot];
+                        break;
+
+                    case OP_STORE_TEMP: {
+                        // Stack-level columns get overwritten, so keep a copy
+                        const BatchOperand& top = operands[depth - 1];
+                        temps[ins.slot] = top;
+                        if (!top.isConstant()) {
+                            double* column = &storage[(maxStackDepth + ins.slot) * BLOCK];
+                            copy(top.column, top.column + n, column);
+                            temps[ins.slot].column = column;
+                        }
+                        break;
+                    }
+
+                    case OP_ADD: case OP_SUB: case OP_MUL:
+                    case OP_DIV: case OP_MOD: case OP_POW: {
+                        depth--;
+                        BatchOperand& a = operands[depth - 1];
+                        const BatchOperand& b = operands[depth];
+                        if (a.isConstant() && b.isConstant()) {
+                            a.value = applyBinaryOperator(a.value, b.value, ins.op);
+                            break;
+                        }
+                        double* out = &storage[(depth - 1) * BLOCK];
+                        applyBinaryOperatorBatch(a, b, out, n, ins.op);
+                        a.column = out;
+                        break;
+                    }
+
+                    case OP_INTEGRATE: case OP_ROOT: {
+                        // One call per row, with that row's variables
+                        depth--;
+                        BatchOperand& a = operands[depth - 1];
+                        const BatchOperand& b = operands[depth];
+                        double* out = &storage[(depth - 1) * BLOCK];
+                        vector<double> row(slotCount);
+                        for (size_t i = 0; i < n; i++) {
+                            for (uint32_t slot : variableSlots) {
+                                const BatchOperand& input = bindings[slot];
+                                row[slot] = input.isConstant() ? input.value : input.column[start + i];
+                            }
+                            out[i] = numericCallValue(*calls[ins.slot], row.data(),
+                                                      a.isConstant() ? a.value : a.column[i],
+                                                      b.isConstant() ? b.value : b.column[i]);
+                        }
+                        a.column = out;
+                        break;
+                    }
+
+                    default: {
+                        BatchOperand& a = operands[depth - 1];
+                        if (a.isConstant()) {
+                            a.value = MATH_KERNELS[accuracy].unary[ins.op](a.value);
+                            break;
+                        }
+                        double* out = &storage[(depth - 1) * BLOCK];
+                        applyFunctionBatch(a.column, out, n, ins.op, accuracy);
+                        a.column = out;
+                        break;
+                    }
+                }
+            }
+
+            const BatchOperand& result = operands[0];
+            if (result.isConstant()) {
+                fill(output.data + start, output.data + start + n, result.value);
+            } else {
+                copy(result.column, result.column + n, output.data + start);
+            }
+        }
+    }
+};
+
+// integrate(f, a, b) or root(f, a, b) in a program. f is compiled once into
+// a program of its own, in which variable runs from a to b and the other
+// variables keep the values of the calling program, whose inputs they are.
+struct NumericCall {
+    OpCode op;                      // OP_INTEGRATE or OP_ROOT
+    CompiledExpression integrand;
+    uint32_t variable;              // Slot varied from a to b (unused if f does not read it)
+};
+
+// ========================================
+// EXPRESSION OPTIMIZER
+// Folds constant subtrees and computes
+// repeated subexpressions only once
+// ========================================
+class ExpressionOptimizer {
+private:
+    // Node of the expression DAG; identical nodes are created only once
+    struct Node {
+        OpCode op;
+        uint32_t slot;
+        double value;
+        int32_t left;       // Child node ids, -1 when absent
+        int32_t right;
+
+        bool operator==(const Node& other) const {
+            return op == other.op && slot == other.slot && left == other.left &&
+                   right == other.right && memcmp(&value, &other.value, sizeof(value)) == 0;
+        }
+    };
+
+    struct NodeHash {
+        size_t operator()(const Node& node) const {
+            uint64_t bits;
+            memcpy(&bits, &node.value, sizeof(bits));
+            size_t h = hash<uint64_t>()(bits);
+            h = h * 31 + node.op;
+            h = h * 31 + node.slot;
+            h = h * 31 + static_cast<uint32_t>(node.left);
+            h = h * 31 + static_cast<uint32_t>(node.right);
+            return h;
+        }
+    };
+
+    vector<Node> nodes;                                 // Children precede parents
+    unordered_map<Node, int32_t, NodeHash> nodeIds;
+    size_t constantsFolded;
+
+    ExpressionOptimizer() : constantsFolded(0) {}
+
+    int32_t intern(OpCode op, uint32_t slot, double value, int32_t left, int32_t right) {
+        Node node = { op, slot, value, left, right };
+        auto it = nodeIds.find(node);
+        if (it != nodeIds.end()) return it->second;
+
+        int32_t id = static_cast<int32_t>(nodes.size());
+        nodes.push_back(node);
+        nodeIds[node] = id;
+        return id;
+    }
+
+    bool isConstant(int32_t id) const { return nodes[id].op == OP_PUSH_CONST; }
+    bool isLeaf(int32_t id) const { return nodes[id].left < 0; }
+
+    // Operation node, folded when every operand is constant. Calls of
+    // integrate() and root() (slot: which one) are left for evaluation.
+    int32_t operation(OpCode op, int32_t a, int32_t b, uint32_t slot = 0) {
+        bool binary = OP_TABLE[op].arity == 2;
+        double value;
+        if (!isNumericCall(op) && isConstant(a) && (!binary || isConstant(b)) &&
+            foldConstant(op, nodes[a].value, binary ? nodes[b].value : 0.0, value)) {
+            constantsFolded++;
+            return intern(OP_PUSH_CONST, 0, value, -1, -1);
+        }
+
+        // Commutative operands in a fixed order so x*y and y*x are shared
+        if ((op == OP_ADD || op == OP_MUL) && a > b) swap(a, b);
+        return intern(op, slot, 0.0, a, binary ? b : -1);
+    }
+
+    // Emit the DAG below root as a postfix program; nodes used more than
+    // once are computed once, stored in a temporary and reloaded
+    void emit(int32_t root, CompiledExpression& program) {
+        vector<uint32_t> uses(nodes.size(), 0);
+        vector<bool> reachable(nodes.size(), false);
+        reachable[root] = true;
+        for (int32_t id = root; id >= 0; id--) {
+            if (!reachable[id] || isLeaf(id)) continue;
+            reachable[nodes[id].left] = true;
+            uses[nodes[id].left]++;
+            if (nodes[id].right >= 0) {
+                reachable[nodes[id].right] = true;
+                uses[nodes[id].right]++;
+            }
+        }
+
+        const int32_t NO_TEMP = -1;
+        vector<int32_t> tempOf(nodes.size(), NO_TEMP);
+        vector<pair<int32_t, bool>> work;   // (node, children already emitted)
+        work.push_back(make_pair(root, false));
+        size_t depth = 0;
+
+        while (!work.empty()) {
+            int32_t id = work.back().first;
+            bool expanded = work.back().second;
+            const Node& node = nodes[id];
+            Instruction ins = { node.op, node.slot, node.value };
+
+            if (!expanded && tempOf[id] != NO_TEMP) {
+                ins.op = OP_LOAD_TEMP;
+                ins.slot = static_cast<uint32_t>(tempOf[id]);
+                ins.value = 0.0;
+                depth++;
+            } else if (!expanded && !isLeaf(id)) {
+                work.back().second = true;
+                if (node.right >= 0) work.push_back(make_pair(node.right, false));
+                work.push_back(make_pair(node.left, false));
+                continue;
+            } else if (isLeaf(id)) {
+                depth++;
+            } else if (node.right >= 0) {
+                depth--;
+            }
+
+            work.pop_back();
+            program.code.push_back(ins);
+            program.maxStackDepth = max(program.maxStackDepth, depth);
+
+            if (expanded && uses[id] > 1) {
+                tempOf[id] = static_cast<int32_t>(program.tempCount++);
+                Instruction store = { OP_STORE_TEMP, static_cast<uint32_t>(tempOf[id]), 0.0 };
+                program.code.push_back(store);
+            }
+        }
+    }
+
+public:
+    // Return an equivalent, usually shorter, program
+    static CompiledExpression optimize(const CompiledExpression& program) {
+        ExpressionOptimizer optimizer;
+        vector<int32_t> stack;
+        vector<int32_t> tempNodes(program.tempCount);
+
+        for (const Instruction& ins : program.code) {
+            switch (ins.op) {
+                case OP_PUSH_CONST:
+                    stack.push_back(optimizer.intern(OP_PUSH_CONST, 0, ins.value, -1, -1));
+                    break;
+
+                case OP_PUSH_VAR:
+                    stack.push_back(optimizer.intern(OP_PUSH_VAR, ins.slot, 0.0, -1, -1));
+                    break;
+
+                case OP_LOAD_TEMP:
+                    stack.push_back(tempNodes[ins.slot]);
+                    break;
+
+                case OP_STORE_TEMP:
+                    tempNodes[ins.slot] = stack.back();
+                    break;
+
+                default:
+                    if (OP_TABLE[ins.op].arity == 2) {
+                        int32_t b = stack.back();
+                        stack.pop_back();
+                        stack.back() = optimizer.operation(ins.op, stack.back(), b, ins.slot);
+                    } else {
+                        stack.back() = optimizer.operation(ins.op, stack.back(), -1);
+                    }
+                    break;
+            }
+        }
+
+        CompiledExpression result;
+        result.variableNames = program.variableNames;
+        result.variableSlots = program.variableSlots;
+        result.slotCount = program.slotCount;
+        result.calls = program.calls;
+        optimizer.emit(stack.back(), result);
+        result.indexInputs();
+
+        result.stats.instructionsBefore = program.code.size();
+        result.stats.instructionsAfter = result.code.size();
+        result.stats.constantsFolded = optimizer.constantsFolded;
+        result.stats.subexpressionsShared = result.tempCount;
+        return result;
+    }
+};
+
+// ========================================
+// EXPRESSION CACHE
+// Least-recently-used map from expression
+// text to its compiled program
+// ========================================
+class ExpressionCache {
+private:
+    typedef pair<string, CompiledExpression> Entry;
+
+    list<Entry> entries;                                    // Most recent first
+    unordered_map<string, list<Entry>::iterator> index;     // Text -> entry
+    size_t capacity;
+
+public:
+    explicit ExpressionCache(size_t maxEntries = 256) : capacity(maxEntries) {}
+
+    // Returns nullptr on a miss; the pointer stays valid until the next insert
+    const CompiledExpression* find(const string& text) {
+        auto it = index.find(text);
+        if (it == index.end()) return nullptr;
+
+        entries.splice(entries.begin(), entries, it->second);  // Mark as most recent
+        return &it->second->second;
+    }
+
+    const CompiledExpression* insert(const string& text, const CompiledExpression& program) {
+        if (!entries.empty() && entries.size() >= capacity) {
+            index.erase(entries.back().first);  // Evict least recently used
+            entries.pop_back();
+        }
+
+        entries.push_front(Entry(text, program));
+        index[text] = entries.begin();
+        return &entries.front().second;
+    }
+
+    void clear() {
+        entries.clear();
+        index.clear();
+    }
+
+    size_t size() const { return entries.size(); }
+};
+
+// ========================================
+// NATIVE EXPRESSION BACKEND
+// Compiles a program into a tree of
+// template-specialized nodes
+// ========================================
+struct NativeNode {
+    virtual ~NativeNode() {}
+    virtual double eval(const double* vars, double* temps) const = 0;
+};
+
+// Operand of a node under construction: a constant, a variable,
+// a temporary or a subtree
+struct NativeOperand {
+    enum Kind { CONSTANT, VARIABLE_SLOT, TEMP_SLOT, SUBTREE };
+
+    Kind kind;
+    double value;
+    uint32_t slot;
+    unique_ptr<NativeNode> node;
+};
+
+// Leaves are stored inline in their parent, so constants and variables
+// cost no extra call
+struct ConstLeaf {
+    double value;
+    explicit ConstLeaf(NativeOperand& o) : value(o.value) {}
+    double get(const double*, double*) const { return value; }
+};
+
+struct VarLeaf {
+    uint32_t slot;
+    explicit VarLeaf(NativeOperand& o) : slot(o.slot) {}
+    double get(const double* vars, double*) const { return vars[slot]; }
+};
+
+struct TempLeaf {
+    uint32_t slot;
+    explicit TempLeaf(NativeOperand& o) : slot(o.slot) {}
+    double get(const double*, double* temps) const { return temps[slot]; }
+};
+
+struct SubtreeLeaf {
+    unique_ptr<NativeNode> node;
+    explicit SubtreeLeaf(NativeOperand& o) : node(move(o.node)) {}
+    double get(const double* vars, double* temps) const { return node->eval(vars, temps); }
+};
+
+// One instantiation per (operation, operand kinds) combination
+template <double (*F)(double, double), typename L, typename R>
+struct BinaryNode : NativeNode {
+    L left;
+    R right;
+    BinaryNode(NativeOperand& a, NativeOperand& b) : left(a), right(b) {}
+
+    double eval(const double* vars, double* temps) const override {
+        // Left before right, matching program order for temporaries
+        double a = left.get(vars, temps);
+        double b = right.get(vars, temps);
+        return F(a, b);
+    }
+};
+
+template <double (*F)(double), typename A>
+struct UnaryNode : NativeNode {
+    A arg;
+    explicit UnaryNode(NativeOperand& a) : arg(a) {}
+    double eval(const double* vars, double* temps) const override { return F(arg.get(vars, temps)); }
+};
+
+template <typename A>
+struct LeafNode : NativeNode {
+    A leaf;
+    explicit LeafNode(NativeOperand& a) : leaf(a) {}
+    double eval(const double* vars, double* temps) const override { return leaf.get(vars, temps); }
+};
+
+// Evaluates a shared subexpression and keeps its value for TempLeaf readers
+template <typename A>
+struct StoreTempNode : NativeNode {
+    A arg;
+    uint32_t slot;
+    StoreTempNode(NativeOperand& a, uint32_t s) : arg(a), slot(s) {}
+
+    double eval(const double* vars, double* temps) const override {
+        return temps[slot] = arg.get(vars, temps);
+    }
+};
+
+double fnSquare(double value) { return value * value; }   // x^2 is exact as x*x
+
+template <double (*F)(double, double), typename L>
+unique_ptr<NativeNode> makeBinaryNode(NativeOperand& a, NativeOperand& b) {
+    switch (b.kind) {
+        case NativeOperand::CONSTANT:
+            return unique_ptr<NativeNode>(new BinaryNode<F, L, ConstLeaf>(a, b));
+        case NativeOperand::VARIABLE_SLOT:
+            return unique_ptr<NativeNode>(new BinaryNode<F, L, VarLeaf>(a, b));
+        case NativeOperand::TEMP_SLOT:
+            return unique_ptr<NativeNode>(new BinaryNode<F, L, TempLeaf>(a, b));
+        default:
+            return unique_ptr<NativeNode>(new BinaryNode<F, L, SubtreeLeaf>(a, b));
+    }
+}
+
+template <double (*F)(double, double)>
+unique_ptr<NativeNode> makeBinaryNode(NativeOperand& a, NativeOperand& b) {
+    switch (a.kind) {
+        case NativeOperand::CONSTANT: return makeBinaryNode<F, ConstLeaf>(a, b);
+        case NativeOperand::VARIABLE_SLOT: return makeBinaryNode<F, VarLeaf>(a, b);
+        case NativeOperand::TEMP_SLOT: return makeBinaryNode<F, TempLeaf>(a, b);
+        default: return makeBinaryNode<F, SubtreeLeaf>(a, b);
+    }
+}
+
+template <double (*F)(double)>
+unique_ptr<NativeNode> makeUnaryNode(NativeOperand& a) {
+    switch (a.kind) {
+        case NativeOperand::CONSTANT:   // Only when folding would raise an error
+            return unique_ptr<NativeNode>(new UnaryNode<F, ConstLeaf>(a));
+        case NativeOperand::VARIABLE_SLOT:
+            return unique_ptr<NativeNode>(new UnaryNode<F, VarLeaf>(a));
+        case NativeOperand::TEMP_SLOT:
+            return unique_ptr<NativeNode>(new UnaryNode<F, TempLeaf>(a));
+        default:
+            return unique_ptr<NativeNode>(new UnaryNode<F, SubtreeLeaf>(a));
+    }
+}
+
+// Node for a function with a faster form in the lower accuracy tiers
+template <double (*Exact)(double), double (*Ulp)(double), double (*Fast)(double)>
+unique_ptr<NativeNode> makeTierNode(NativeOperand& a, MathAccuracy accuracy) {
+    switch (accuracy) {
+        case ACCURACY_ULP: return makeUnaryNode<Ulp>(a);
+        case ACCURACY_FAST: return makeUnaryNode<Fast>(a);
+        default: return makeUnaryNode<Exact>(a);
+    }
+}
+
+template <typename A>
+unique_ptr<NativeNode> makeLeafNode(NativeOperand& a) {
+    return unique_ptr<NativeNode>(new LeafNode<A>(a));
+}
+
+// Node computing an operand on its own
+unique_ptr<NativeNode> makeOperandNode(NativeOperand& a) {
+    switch (a.kind) {
+        case NativeOperand::CONSTANT: return makeLeafNode<ConstLeaf>(a);
+        case NativeOperand::VARIABLE_SLOT: return makeLeafNode<VarLeaf>(a);
+        case NativeOperand::TEMP_SLOT: return makeLeafNode<TempLeaf>(a);
+        default: return move(a.node);
+    }
+}
+
+// integrate() or root(), run by the numerical methods as in the interpreter
+struct NumericCallNode : NativeNode {
+    shared_ptr<const NumericCall> call;
+    unique_ptr<NativeNode> low;
+    unique_ptr<NativeNode> high;
+
+    NumericCallNode(const shared_ptr<const NumericCall>& c, NativeOperand& a, NativeOperand& b)
+        : call(c), low(makeOperandNode(a)), high(makeOperandNode(b)) {}
+
+    double eval(const double* vars, double* temps) const override {
+        double a = low->eval(vars, temps);
+        double b = high->eval(vars, temps);
+        return numericCallValue(*call, vars, a, b);
+    }
+};
+
+// Node for a non-constant operation (constant operands were folded earlier)
+unique_ptr<NativeNode> makeOperationNode(OpCode op, NativeOperand& a, NativeOperand& b,
+                                         MathAccuracy accuracy) {
+    switch (op) {
+        case OP_ADD: return makeBinaryNode<opAdd>(a, b);
+        case OP_SUB: return makeBinaryNode<opSub>(a, b);
+        case OP_MUL: return makeBinaryNode<opMul>(a, b);
+        case OP_DIV: return makeBinaryNode<opDiv>(a, b);
+        case OP_MOD: return makeBinaryNode<opMod>(a, b);
+        case OP_POW:
+            if (b.kind == NativeOperand::CONSTANT && b.value == 2.0) {
+                return makeUnaryNode<fnSquare>(a);
+            }
+            return makeBinaryNode<opPow>(a, b);
+        case OP_SIN:
+            return makeTierNode<fnSin, fnSinTier<ACCURACY_ULP>, fnSinTier<ACCURACY_FAST>>(a, accuracy);
+        case OP_COS:
+            return makeTierNode<fnCos, fnCosTier<ACCURACY_ULP>, fnCosTier<ACCURACY_FAST>>(a, accuracy);
+        case OP_TAN:
+            return makeTierNode<fnTan, fnTanTier<ACCURACY_ULP>, fnTanTier<ACCURACY_FAST>>(a, accuracy);
+        case OP_LOG:
+            return makeTierNode<fnLog, fnLogTier<ACCURACY_ULP>, fnLogTier<ACCURACY_FAST>>(a, accuracy);
+        case OP_LN:
+            return makeTierNode<fnLn, fnLn, fnLnTier<ACCURACY_FAST>>(a, accuracy);
+        case OP_SQRT: return makeUnaryNode<fnSqrt>(a);
+        case OP_ABS: return makeUnaryNode<fnAbs>(a);
+        case OP_EXP:
+            return makeTierNode<fnExp, fnExp, fnExpTier<ACCURACY_FAST>>(a, accuracy);
+        case OP_NEG: return makeUnaryNode<fnNeg>(a);
+        default: break;
+    }
+    throw runtime_error("Unknown operator!");
+}
+
+class NativeExpression {
+private:
+    unique_ptr<NativeNode> root;
+    vector<string> variableNames;
+    uint32_t tempCount;
+
+public:
+    // Build the node tree, folding every subtree without variables
+    explicit NativeExpression(const CompiledExpression& program, MathAccuracy accuracy = ACCURACY_EXACT)
+        : variableNames(program.getVariableNames()), tempCount(program.getTempCount()) {
+        vector<NativeOperand> operands;
+
+        for (const Instruction& ins : program.getCode()) {
+            NativeOperand result;
+            result.value = 0.0;
+            result.slot = 0;
+
+            if (ins.op == OP_PUSH_CONST) {
+                result.kind = NativeOperand::CONSTANT;
+                result.value = ins.value;
+            } else if (ins.op == OP_PUSH_VAR) {
+                result.kind = NativeOperand::VARIABLE_SLOT;
+                result.slot = ins.slot;
+            } else if (ins.op == OP_LOAD_TEMP) {
+                result.kind = NativeOperand::TEMP_SLOT;
+                result.slot = ins.slot;
+            } else if (ins.op == OP_STORE_TEMP) {
+                NativeOperand& top = operands.back();
+                result.kind = NativeOperand::SUBTREE;
+                switch (top.kind) {
+                    case NativeOperand::CONSTANT:
+                        result.node.reset(new StoreTempNode<ConstLeaf>(top, ins.slot));
+                        break;
+                    case NativeOperand::VARIABLE_SLOT:
+                        result.node.reset(new StoreTempNode<VarLeaf>(top, ins.slot));
+                        break;
+                    case NativeOperand::TEMP_SLOT:
+                        result.node.reset(new StoreTempNode<TempLeaf>(top, ins.slot));
+                        break;
+                    default:
+                        result.node.reset(new StoreTempNode<SubtreeLeaf>(top, ins.slot));
+                        break;
+                }
+                operands.pop_back();
+            } else if (isNumericCall(ins.op)) {
+                NativeOperand b = move(operands.back());
+                operands.pop_back();
+                NativeOperand a = move(operands.back());
+                operands.pop_back();
+                result.kind = NativeOperand::SUBTREE;
+                result.node.reset(new NumericCallNode(program.getCalls()[ins.slot], a, b));
+            } else if (OP_TABLE[ins.op].arity == 2) {
+                NativeOperand b = move(operands.back());
+                operands.pop_back();
+                NativeOperand a = move(operands.back());
+                operands.pop_back();
+
+                if (a.kind == NativeOperand::CONSTANT && b.kind == NativeOperand::CONSTANT &&
+                    foldConstant(ins.op, a.value, b.value, result.value)) {
+                    result.kind = NativeOperand::CONSTANT;
+                } else {
+                    result.kind = NativeOperand::SUBTREE;
+                    result.node = makeOperationNode(ins.op, a, b, accuracy);
+                }
+            } else {
+                NativeOperand a = move(operands.back());
+                operands.pop_back();
+
+                if (a.kind == NativeOperand::CONSTANT &&
+                    foldConstant(ins.op, a.value, 0.0, result.value)) {
+                    result.kind = NativeOperand::CONSTANT;
+                } else {
+                    result.kind = NativeOperand::SUBTREE;
+                    result.node = makeOperationNode(ins.op, a, a, accuracy);
+                }
+            }
+            operands.push_back(move(result));
+        }
+
+        root = makeOperandNode(operands.back());
+    }
+
+    const vector<string>& getVariableNames() const { return variableNames; }
+
+    // Evaluate with values indexed by variable slot
+    double operator()(const double* vars) const {
+        double localTemps[16];
+        vector<double> heapTemps;
+        double* temps = localTemps;
+        if (tempCount > 16) {
+            heapTemps.resize(tempCount);
+            temps = heapTemps.data();
+        }
+        return root->eval(vars, temps);
+    }
+};
+
+// ========================================
+// SNAPSHOT FILES
+// Variables and formula programs saved as a
+// relocatable image, used in place via mmap
+// ========================================
+// Read-only view of a whole file, memory-mapped where supported. Files
+// read in order (batch input) ask for aggressive read-ahead.
+class MappedFile {
+private:
+    const char* contents;
+    size_t length;
+    vector<char> buffer;    // Used when the file cannot be mapped
+
+public:
+    explicit MappedFile(const string& path, bool sequential = true) : contents(nullptr), length(0) {
+#ifdef __unix__
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw runtime_error("Cannot open " + path + ": " + strerror(errno));
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                madvise(mapped, info.st_size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+                contents = static_cast<const char*>(mapped);
+                length = info.st_size;
+            }
+        }
+        close(fd);
+        if (contents != nullptr) return;
+#endif
+        ifstream file(path, ios::binary);
+        if (!file) {
+            throw runtime_error("Cannot open " + path);
+        }
+        buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        contents = buffer.data();
+        length = buffer.size();
+    }
+
+    ~MappedFile() {
+#ifdef __unix__
+        if (buffer.empty() && contents != nullptr) {
+            munmap(const_cast<char*>(contents), length);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return contents; }
+    size_t size() const { return length; }
+};
+
+const char SNAPSHOT_MAGIC[8] = { 'C', 'A', 'L', 'C', 'S', 'N', 'A', 'P' };
+const uint32_t SNAPSHOT_VERSION = 2;     // 2: user functions
+const uint32_t NO_SLOT = UINT32_MAX;
+
+// Start of a snapshot. Sections are arrays at 8-byte aligned offsets from
+// the start of the file (native byte order), so the file holds no pointers
+// and can be mapped at any address.
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t slotCount;         // Variables, in slot order
+    uint32_t formulaCount;
+    uint32_t indexSize;         // Buckets of the name index (power of two)
+    uint64_t fileSize;
+    uint64_t names;             // SnapshotString[slotCount]
+    uint64_t values;            // double[slotCount]
+    uint64_t defined;           // uint8_t[slotCount]
+    uint64_t index;             // uint32_t[indexSize]: slot + 1, 0 when empty
+    uint64_t formulaOf;         // uint32_t[slotCount]: formula + 1, 0 when none
+    uint64_t formulas;          // SnapshotFormula[formulaCount]
+    uint64_t dependentStarts;   // uint32_t[slotCount + 1], into dependents
+    uint64_t dependents;        // uint32_t[]: slots whose formulas read each slot
+    uint64_t dependentCount;
+    uint64_t code;              // SnapshotInstruction[]
+    uint64_t codeCount;
+    uint64_t inputs;            // uint32_t[]: slots each formula reads
+    uint64_t inputCount;
+    uint64_t strings;           // char[]: names and formula texts
+    uint64_t stringsSize;
+    uint64_t functions;         // SnapshotFunction[functionCount]
+    uint64_t functionCount;
+};
+
+struct SnapshotString {
+    uint32_t offset;            // Into the string section
+    uint32_t length;
+};
+
+struct SnapshotInstruction {
+    uint8_t op;
+    uint8_t padding[3];
+    uint32_t slot;
+    double value;
+};
+
+struct SnapshotFunction {
+    SnapshotString name;
+    SnapshotString definition;
+    uint32_t parameterCount;
+    uint32_t code;              // First instruction of the body
+    uint32_t codeLength;
+    uint32_t padding;
+};
+
+struct SnapshotFormula {
+    SnapshotString expression;
+    uint32_t code;              // First instruction
+    uint32_t codeLength;
+    uint32_t inputs;            // First input slot
+    uint32_t inputCount;
+    uint32_t maxStackDepth;
+    uint32_t tempCount;
+};
+
+// FNV-1a, the hash of the snapshot name index
+uint64_t hashName(string_view name) {
+    uint64_t h = 14695981039346656037ull;
+    for (char c : name) {
+        h = (h ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+    return h;
+}
+
+// A mapped snapshot. Opening it checks only the header, so the cost does
+// not grow with the number of variables; each entry is checked when read.
+class SnapshotImage {
+private:
+    MappedFile file;
+    const SnapshotHeader* header;
+
+    template <typename T>
+    const T* section(uint64_t offset) const {
+        return reinterpret_cast<const T*>(file.data() + offset);
+    }
+
+    // Whether count items of size bytes at offset lie inside the file
+    bool fits(uint64_t offset, uint64_t count, uint64_t size) const {
+        return offset % 8 == 0 && offset <= file.size() && count <= (file.size() - offset) / size;
+    }
+
+    const SnapshotFormula& formula(uint32_t slot) const {
+        uint32_t id = section<uint32_t>(header->formulaOf)[slot] - 1;
+        if (id >= header->formulaCount) throw runtime_error("Corrupt snapshot: formula index");
+        return section<SnapshotFormula>(header->formulas)[id];
+    }
+
+    // Copy count stored instructions from first into out, checking that they
+    // keep the stack balanced and read only the given variables (any slot if
+    // inputs is null) and temporaries. Returns the deepest stack reached.
+    size_t readCode(uint32_t first, uint32_t count, const uint32_t* inputs, uint32_t inputCount,
+                    uint32_t temps, bool stores, vector<Instruction>& out) const {
+        if (first > header->codeCount || count > header->codeCount - first) {
+            throw runtime_error("Corrupt snapshot: code bounds");
+        }
+        const SnapshotInstruction* code = section<SnapshotInstruction>(header->code) + first;
+        out.reserve(count);
+        size_t depth = 0;
+        size_t deepest = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            const SnapshotInstruction& ins = code[i];
+            bool valid = ins.op < OP_COUNT && !isNumericCall(static_cast<OpCode>(ins.op)) &&
+                         (stores || ins.op != OP_STORE_TEMP);
+            if (valid && ins.op == OP_PUSH_VAR) {
+                valid = inputs == nullptr ? ins.slot < header->slotCount
+                                          : std::find(inputs, inputs + inputCount, ins.slot) != inputs + inputCount;
+            } else if (valid && (ins.op == OP_LOAD_TEMP || ins.op == OP_STORE_TEMP)) {
+                valid = ins.slot < temps;
+            }
+            if (valid) {
+                uint8_t arity = OP_TABLE[ins.op].arity;
+                if (ins.op == OP_STORE_TEMP) {
+                    valid = depth >= 1;
+                } else if (arity == 0) {
+                    deepest = max(deepest, ++depth);
+                } else {
+                    valid = depth >= arity;
+                    if (arity == 2) depth--;
+                }
+            }
+            if (!valid) throw runtime_error("Corrupt snapshot: invalid program");
+            out.push_back(Instruction{ static_cast<OpCode>(ins.op), ins.slot, ins.value });
+        }
+        if (depth != 1) throw runtime_error("Corrupt snapshot: invalid program");
+        return deepest;
+    }
+
+    string_view text(SnapshotString s) const {
+        if (s.offset > header->stringsSize || s.length > header->stringsSize - s.offset) {
+            throw runtime_error("Corrupt snapshot: string table");
+        }
+        return string_view(section<char>(header->strings) + s.offset, s.length);
+    }
+
+public:
+    explicit SnapshotImage(const string& path) : file(path, false), header(nullptr) {
+        if (file.size() < sizeof(SnapshotHeader) ||
+            memcmp(file.data(), SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+            throw runtime_error(path + " is not a calculator snapshot");
+        }
+        header = section<SnapshotHeader>(0);
+        if (header->version != SNAPSHOT_VERSION) {
+            throw runtime_error(path + ": unsupported snapshot version " + to_string(header->version));
+        }
+
+        uint64_t slots = header->slotCount;
+        bool valid = header->fileSize == file.size() &&
+                     header->indexSize > slots && (header->indexSize & (header->indexSize - 1)) == 0 &&
+                     fits(header->names, slots, sizeof(SnapshotString)) &&
+                     fits(header->values, slots, sizeof(double)) &&
+                     fits(header->defined, slots, 1) &&
+                     fits(header->index, header->indexSize, sizeof(uint32_t)) &&
+                     fits(header->formulaOf, slots, sizeof(uint32_t)) &&
+                     fits(header->formulas, header->formulaCount, sizeof(SnapshotFormula)) &&
+                     fits(header->dependentStarts, slots + 1, sizeof(uint32_t)) &&
+                     fits(header->dependents, header->dependentCount, sizeof(uint32_t)) &&
+                     fits(header->code, header->codeCount, sizeof(SnapshotInstruction)) &&
+                     fits(header->inputs, header->inputCount, sizeof(uint32_t)) &&
+                     fits(header->strings, header->stringsSize, 1) &&
+                     fits(header->functions, header->functionCount, sizeof(SnapshotFunction));
+        if (!valid) {
+            throw runtime_error("Corrupt snapshot: " + path);
+        }
+    }
+
+    uint32_t slotCount() const { return header->slotCount; }
+    const double* values() const { return section<double>(header->values); }
+    const uint8_t* defined() const { return section<uint8_t>(header->defined); }
+
+    string_view name(uint32_t slot) const {
+        return text(section<SnapshotString>(header->names)[slot]);
+    }
+
+    // Slot of a name, or NO_SLOT
+    uint32_t find(string_view key) const {
+        const uint32_t* index = section<uint32_t>(header->index);
+        uint32_t mask = header->indexSize - 1;
+        for (uint64_t i = hashName(key) & mask, probes = 0; probes <= mask; i = (i + 1) & mask, probes++) {
+            if (index[i] == 0) return NO_SLOT;
+            uint32_t slot = index[i] - 1;
+            if (slot >= header->slotCount) throw runtime_error("Corrupt snapshot: name index");
+            if (name(slot) == key) return slot;
+        }
+        return NO_SLOT;
+    }
+
+    bool hasFormula(uint32_t slot) const { return section<uint32_t>(header->formulaOf)[slot] != 0; }
+
+    string_view formulaText(uint32_t slot) const { return text(formula(slot).expression); }
+
+    // Whether the formula's program was saved (it is not when it calls
+    // integrate() or root())
+    bool storesProgram(uint32_t slot) const { return formula(slot).codeLength != 0; }
+
+    // Rebuild the stored program of a slot's formula without parsing it,
+    // checking that it cannot read outside the stack, temporaries or table
+    CompiledExpression program(uint32_t slot) const {
+        const SnapshotFormula& f = formula(slot);
+        if (f.inputs > header->inputCount || f.inputCount > header->inputCount - f.inputs ||
+            f.tempCount > f.codeLength) {
+            throw runtime_error("Corrupt snapshot: formula bounds");
+        }
+
+        CompiledExpression program;
+        const uint32_t* inputs = section<uint32_t>(header->inputs) + f.inputs;
+        for (uint32_t i = 0; i < f.inputCount; i++) {
+            if (inputs[i] >= header->slotCount) throw runtime_error("Corrupt snapshot: input slot");
+            program.variableSlots.push_back(inputs[i]);
+            program.variableNames.push_back(string(name(inputs[i])));
+            program.slotCount = max(program.slotCount, inputs[i] + 1);
+        }
+        program.tempCount = f.tempCount;
+        program.maxStackDepth = f.maxStackDepth;
+
+        if (readCode(f.code, f.codeLength, inputs, f.inputCount, f.tempCount, true, program.code) !=
+            f.maxStackDepth) {
+            throw runtime_error("Corrupt snapshot: invalid program");
+        }
+        program.indexInputs();
+        return program;
+    }
+
+    size_t functionCount() const { return header->functionCount; }
+
+    // Name, definition, parameter count and body of user function i
+    void function(size_t i, string& name, string& definition, uint32_t& parameterCount,
+                  vector<Instruction>& body) const {
+        const SnapshotFunction& f = section<SnapshotFunction>(header->functions)[i];
+        name = string(text(f.name));
+        definition = string(text(f.definition));
+        parameterCount = f.parameterCount;
+        readCode(f.code, f.codeLength, nullptr, 0, f.parameterCount, false, body);
+    }
+
+    // Slots whose stored formulas read slot
+    pair<const uint32_t*, const uint32_t*> dependentsOf(uint32_t slot) const {
+        const uint32_t* starts = section<uint32_t>(header->dependentStarts);
+        if (starts[slot] > starts[slot + 1] || starts[slot + 1] > header->dependentCount) {
+            throw runtime_error("Corrupt snapshot: dependents");
+        }
+        const uint32_t* dependents = section<uint32_t>(header->dependents);
+        for (uint32_t i = starts[slot]; i < starts[slot + 1]; i++) {
+            if (dependents[i] >= header->slotCount) throw runtime_error("Corrupt snapshot: dependents");
+        }
+        return make_pair(dependents + starts[slot], dependents + starts[slot + 1]);
+    }
+};
+
+// ========================================
+// VARIABLE TABLE
+// Names interned to integer slots once,
+// values kept in one contiguous array
+// ========================================
+const uint32_t VARIABLE_BLOCK = 256;    // Slots per block whose writes are counted
+
+class VariableTable {
+private:
+    shared_ptr<const SnapshotImage> image;  // Names the first imageSlots slots
+    uint32_t imageSlots;
+    unordered_map<string, uint32_t> slots;  // Name -> slot, for the other slots
+    vector<string> names;                   // Slot - imageSlots -> name
+    vector<double> values;                  // Slot -> value, read as vars[slot]
+    vector<char> defined;                   // Slot -> has a value
+    vector<uint64_t> blockWrites;           // Slot / VARIABLE_BLOCK -> writes so far
+
+    // Count a write to every block, after the slots were replaced
+    void touchAll() {
+        blockWrites.resize((size() + VARIABLE_BLOCK - 1) / VARIABLE_BLOCK, 0);
+        for (uint64_t& writes : blockWrites) writes++;
+    }
+
+public:
+    VariableTable() : imageSlots(0) {}
+
+    // Slot for a name, adding an undefined variable on first use.
+    // Slots are never reused, so compiled programs stay valid.
+    uint32_t intern(string_view name) {
+        if (image) {
+            uint32_t slot = image->find(name);
+            if (slot != NO_SLOT) return slot;
+        }
+        string key(name);
+        auto it = slots.find(key);
+        if (it != slots.end()) {
+            return it->second;
+        }
+        uint32_t slot = static_cast<uint32_t>(size());
+        slots.emplace(key, slot);
+        names.push_back(key);
+        values.push_back(0.0);
+        defined.push_back(0);
+        if (slot % VARIABLE_BLOCK == 0) blockWrites.push_back(0);
+        blockWrites[slot / VARIABLE_BLOCK]++;
+        return slot;
+    }
+
+    // Replace the whole table by a snapshot's variables. Names stay in the
+    // mapped file; only the values are copied, so they can change.
+    void attach(shared_ptr<const SnapshotImage> snapshot) {
+        image = snapshot;
+        imageSlots = snapshot->slotCount();
+        slots.clear();
+        names.clear();
+        values.assign(snapshot->values(), snapshot->values() + imageSlots);
+        defined.assign(snapshot->defined(), snapshot->defined() + imageSlots);
+        touchAll();
+    }
+
+    bool isDefined(uint32_t slot) const { return defined[slot] != 0; }
+    double get(uint32_t slot) const { return values[slot]; }
+    string_view nameOf(uint32_t slot) const {
+        return slot < imageSlots ? image->name(slot) : string_view(names[slot - imageSlots]);
+    }
+    const double* data() const { return values.data(); }
+    size_t size() const { return values.size(); }
+
+    // Writes (values set or erased, slots added) to a block of slots so
+    // far. A copy of the block is current while this has not changed.
+    uint64_t writesTo(size_t block) const { return blockWrites[block]; }
+
+    void set(uint32_t slot, double value) {
+        values[slot] = value;
+        defined[slot] = 1;
+        blockWrites[slot / VARIABLE_BLOCK]++;
+    }
+
+    // Forget one value but keep the slot
+    void erase(uint32_t slot) {
+        values[slot] = 0.0;
+        defined[slot] = 0;
+        blockWrites[slot / VARIABLE_BLOCK]++;
+    }
+
+    // Forget every value but keep the slots
+    void clear() {
+        fill(values.begin(), values.end(), 0.0);
+        fill(defined.begin(), defined.end(), 0);
+        touchAll();
+    }
+
+    // Slots holding a value, ordered by name
+    vector<uint32_t> definedSlots() const {
+        vector<uint32_t> result;
+        for (uint32_t slot = 0; slot < values.size(); slot++) {
+            if (defined[slot]) result.push_back(slot);
+        }
+        sort(result.begin(), result.end(), [this](uint32_t a, uint32_t b) {
+            return nameOf(a) < nameOf(b);
+        });
+        return result;
+    }
+};
+
+// ========================================
+// CALCULATION HISTORY
+// Fixed-size ring of compact records,
+// formatted only when displayed or saved
+// ========================================
+struct HistoryRecord {
+    uint32_t expressionId;      // Index into the history's expression texts
+    double result;
+    int64_t timestamp;          // Nanoseconds since the Unix epoch
+};
+
+// Lock-free ring for one writer (the calculator) and any number of readers.
+// When full, the oldest record is overwritten. Each slot carries a sequence
+// number so a reader can tell whether the record it copied was overwritten
+// while it was reading.
+class HistoryRing {
+private:
+    struct Slot {
+        atomic<uint64_t> sequence;      // 2 * (position + 1) when written, odd while writing
+        atomic<uint32_t> expressionId;
+        atomic<double> result;
+        atomic<int64_t> timestamp;
+    };
+
+    unique_ptr<Slot[]> slots;
+    size_t mask;                        // Capacity - 1 (capacity is a power of two)
+    atomic<uint64_t> head;              // Records ever pushed
+
+public:
+    explicit HistoryRing(size_t capacity) : head(0) {
+        size_t size = 1;
+        while (size < capacity) size *= 2;
+        slots.reset(new Slot[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; i++) {
+            slots[i].sequence.store(0, memory_order_relaxed);
+        }
+    }
+
+    size_t capacity() const { return mask + 1; }
+
+    // Position one past the newest record
+    uint64_t end() const { return head.load(memory_order_acquire); }
+
+    // Position of the oldest record still held
+    uint64_t begin() const {
+        uint64_t last = end();
+        return last > capacity() ? last - capacity() : 0;
+    }
+
+    // Single writer only
+    void push(const HistoryRecord& record) {
+        uint64_t position = head.load(memory_order_relaxed);
+        Slot& slot = slots[position & mask];
+
+        slot.sequence.store(2 * position + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        slot.expressionId.store(record.expressionId, memory_order_relaxed);
+        slot.result.store(record.result, memory_order_relaxed);
+        slot.timestamp.store(record.timestamp, memory_order_relaxed);
+        slot.sequence.store(2 * position + 2, memory_order_release);
+
+        head.store(position + 1, memory_order_release);
+    }
+
+    // Copy the record at position. False if it has been overwritten.
+    bool read(uint64_t position, HistoryRecord& record) const {
+        const Slot& slot = slots[position & mask];
+        uint64_t expected = 2 * position + 2;
+        if (slot.sequence.load(memory_order_acquire) != expected) return false;
+
+        record.expressionId = slot.expressionId.load(memory_order_relaxed);
+        record.result = slot.result.load(memory_order_relaxed);
+        record.timestamp = slot.timestamp.load(memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        return slot.sequence.load(memory_order_relaxed) == expected;
+    }
+};
+
+// History records plus the text of each distinct expression, stored once.
+// A text is kept only while records in the ring use it, so the texts are
+// bounded by the ring's capacity too.
+class CalculationHistory {
+private:
+    HistoryRing ring;
+    unordered_map<string, uint32_t> expressionIds;  // Used by the owner thread only
+    vector<string> expressions;                     // Id -> text
+    vector<uint32_t> uses;                          // Id -> records in the ring (owner only)
+    vector<uint32_t> freeIds;                       // Ids of released texts (owner only)
+    mutable mutex expressionsMutex;                 // Changed texts vs. background readers
+    uint64_t shownFrom;                             // Position of the first record displayed
+
+    // Id of expression's text, stored if it is new
+    uint32_t intern(const string& expression) {
+        auto it = expressionIds.find(expression);
+        if (it != expressionIds.end()) return it->second;
+
+        uint32_t id;
+        {
+            lock_guard<mutex> lock(expressionsMutex);
+            if (freeIds.empty()) {
+                id = static_cast<uint32_t>(expressions.size());
+                expressions.push_back(expression);
+                uses.push_back(0);
+            } else {
+                id = freeIds.back();
+                freeIds.pop_back();
+                expressions[id] = expression;
+            }
+        }
+        expressionIds.emplace(expression, id);
+        return id;
+    }
+
+    // Drop one use of a text, releasing it after its last record is gone.
+    // Readers format records under expressionsMutex, so none still needs it.
+    void release(uint32_t id) {
+        if (--uses[id] > 0) return;
+        expressionIds.erase(expressions[id]);
+        lock_guard<mutex> lock(expressionsMutex);
+        string().swap(expressions[id]);
+        freeIds.push_back(id);
+    }
+
+public:
+    explicit CalculationHistory(size_t capacity = 1024) : ring(capacity), shownFrom(0) {}
+
+    void record(const string& expression, double result) {
+        HistoryRecord entry;
+        entry.expressionId = intern(expression);
+        entry.result = result;
+        entry.timestamp = chrono::duration_cast<chrono::nanoseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+        uses[entry.expressionId]++;
+
+        // The record this one overwrites, if the ring is full
+        HistoryRecord overwritten;
+        bool full = ring.end() >= ring.capacity() && ring.read(ring.end() - ring.capacity(), overwritten);
+        ring.push(entry);
+        if (full) release(overwritten.expressionId);
+    }
+
+    size_t capacity() const { return ring.capacity(); }
+    uint64_t begin() const { return ring.begin(); }
+    uint64_t end() const { return ring.end(); }
+    bool read(uint64_t position, HistoryRecord& entry) const { return ring.read(position, entry); }
+
+    // Hide the records so far from display (streaming is not affected)
+    void clear() { shownFrom = ring.end(); }
+
+    // Print the records still held, oldest first (owner thread only)
+    void display() const {
+        uint64_t first = max(shownFrom, ring.begin());
+        if (first == ring.end()) {
+            cout << "No calculations yet." << endl;
+            return;
+        }
+        if (first > shownFrom) {
+            cout << "(only the last " << ring.capacity() << " calculations are kept)" << endl;
+        }
+        for (uint64_t position = first; position < ring.end(); position++) {
+            HistoryRecord entry;
+            if (!ring.read(position, entry)) continue;
+            cout << position - shownFrom + 1 << ". " << expressions[entry.expressionId]
+                 << " = " << fixed << setprecision(6) << entry.result << endl;
+        }
+    }
+
+    // Append one "seconds<TAB>expression = result" line per record still
+    // held in [from, to); returns how many were overwritten. Records are
+    // read under expressionsMutex, so their texts cannot be released
+    // before they are formatted.
+    uint64_t format(uint64_t from, uint64_t to, ostream& out) const {
+        uint64_t dropped = 0;
+        lock_guard<mutex> lock(expressionsMutex);
+        for (uint64_t position = from; position < to; position++) {
+            HistoryRecord entry;
+            if (!ring.read(position, entry)) {
+                dropped++;
+                continue;
+            }
+            out << entry.timestamp / 1000000000 << '.' << setfill('0') << setw(3)
+                << entry.timestamp / 1000000 % 1000 << setfill(' ') << '\t'
+                << expressions[entry.expressionId] << " = "
+                << fixed << setprecision(6) << entry.result << '\n';
+        }
+        return dropped;
+    }
+};
+
+// Background thread appending new history records to a file in batches
+class HistoryWriter {
+private:
+    const CalculationHistory& history;
+    ofstream file;
+    uint64_t next;                  // Next position to write
+    mutex wakeMutex;
+    condition_variable wake;
+    bool stopping;
+    thread worker;
+
+    // Write every record added since the last batch
+    void writeBatch() {
+        uint64_t end = history.end();
+        uint64_t dropped = 0;
+        if (next < history.begin()) {
+            dropped = history.begin() - next;
+            next = history.begin();
+        }
+
+        stringstream batch;
+        dropped += history.format(next, end, batch);
+        next = end;
+
+        if (dropped > 0) {
+            file << "# " << dropped << " calculations overwritten before they were saved\n";
+        }
+        file << batch.str();
+        file.flush();
+    }
+
+    void run() {
+        unique_lock<mutex> lock(wakeMutex);
+        while (true) {
+            wake.wait_for(lock, chrono::milliseconds(200));
+            bool last = stopping;
+            lock.unlock();
+            writeBatch();
+            if (last) return;
+            lock.lock();
+        }
+    }
+
+public:
+    // Appends to path, starting with the records the history still holds
+    HistoryWriter(const CalculationHistory& source, const string& path)
+        : history(source), file(path, ios::app), next(source.begin()), stopping(false) {
+        if (!file) {
+            throw runtime_error("Cannot open history file: " + path);
+        }
+        worker = thread(&HistoryWriter::run, this);
+    }
+
+    // Write a batch now instead of at the next interval
+    void nudge() { wake.notify_one(); }
+
+    // Writes the final batch before returning
+    ~HistoryWriter() {
+        {
+            lock_guard<mutex> lock(wakeMutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+};
+
+// ========================================
+// NUMERICAL METHODS
+// Integration and root finding over a
+// compiled formula in one variable
+// ========================================
+// Run body(0) ... body(count - 1) on every core. Each index writes its own
+// result and callers combine them in index order, so the outcome does not
+// depend on the number of threads or on their timing.
+template <typename Body>
+void parallelFor(size_t count, Body body) {
+    size_t threadCount = min<size_t>(max(thread::hardware_concurrency(), 1u), count);
+    atomic<size_t> next(0);
+    auto work = [&] {
+        for (size_t i = next++; i < count; i = next++) {
+            body(i);
+        }
+    };
+
+    vector<thread> threads;
+    for (size_t t = 1; t < threadCount; t++) {
+        threads.emplace_back(work);
+    }
+    work();
+    for (thread& t : threads) {
+        t.join();
+    }
+}
+
+// A compiled program seen as f(x), where x is one of its variables and the
+// others keep fixed values. Copies are independent, one per thread.
+class UnivariateFunction {
+private:
+    const CompiledExpression* program;
+    vector<double> values;      // Indexed by variable slot
+    uint32_t slot;              // Slot of x
+    size_t index;               // Position of x in the gradient, or SIZE_MAX
+    vector<double> gradient;
+
+public:
+    // stored holds a value for every slot the program reads other than x
+    UnivariateFunction(const CompiledExpression& compiled, const double* stored, uint32_t variableSlot)
+        : program(&compiled),
+          values(compiled.getSlotCount()),
+          slot(variableSlot),
+          index(SIZE_MAX),
+          gradient(compiled.getVariableSlots().size()) {
+        const vector<uint32_t>& slots = compiled.getVariableSlots();
+        for (size_t i = 0; i < slots.size(); i++) {
+            if (slots[i] == slot) {
+                index = i;
+            } else {
+                values[slots[i]] = stored[slots[i]];
+            }
+        }
+    }
+
+    double operator()(double x) {
+        if (index != SIZE_MAX) values[slot] = x;
+        return program->evaluate(values.data());
+    }
+
+    // f(x) and f'(x) in one pass
+    double withDerivative(double x, double& derivative) {
+        double value = gradientAt(x);
+        derivative = index == SIZE_MAX ? 0.0 : gradient[index];
+        return value;
+    }
+
+    // f(x), leaving the partial derivatives with respect to every variable
+    // of the program (x included) in partials()
+    double gradientAt(double x) {
+        if (index != SIZE_MAX) values[slot] = x;
+        return program->evaluateGradient(values.data(), gradient.data());
+    }
+
+    const vector<double>& partials() const { return gradient; }
+    size_t variableIndex() const { return index; }
+};
+
+// One partial derivative of a function's program as a function of x, for
+// differentiating an integral under the integral sign
+class PartialDerivative {
+private:
+    UnivariateFunction f;
+    size_t input;               // Position in the program's gradient
+
+public:
+    PartialDerivative(const UnivariateFunction& function, size_t i) : f(function), input(i) {}
+
+    double operator()(double x) {
+        f.gradientAt(x);
+        return f.partials()[input];
+    }
+};
+
+// 15-point Gauss-Kronrod rule on [left, right]. The error estimate is the
+// difference from the embedded 7-point Gauss rule.
+template <typename Function>
+double gaussKronrod(Function& f, double left, double right, double& error) {
+    static const double NODES[8] = {
+        0.991455371120812639206854697526329, 0.949107912342758524526189684047851,
+        0.864864423359769072789712788640926, 0.741531185599394439863864773280788,
+        0.586087235467691130294144845693013, 0.405845151377397166906606412076961,
+        0.207784955007898467600689403773245, 0.0
+    };
+    static const double KRONROD_WEIGHTS[8] = {
+        0.022935322010529224963732008058970, 0.063092092629978553290700663189204,
+        0.104790010322250183839876322541518, 0.140653259715525918745189590510238,
+        0.169004726639267902826583426598550, 0.190350578064785409913256402421014,
+        0.204432940075298892414161999234649, 0.209482141084727828012999174891714
+    };
+    static const double GAUSS_WEIGHTS[4] = {    // For NODES[1], [3], [5], [7]
+        0.129484966168869693270611432679082, 0.279705391489276667901467771423780,
+        0.381830050505118944950369775488975, 0.417959183673469387755102040816327
+    };
+
+    double center = (left + right) / 2;
+    double halfWidth = (right - left) / 2;
+    double fc = f(center);
+    double kronrod = fc * KRONROD_WEIGHTS[7];
+    double gauss = fc * GAUSS_WEIGHTS[3];
+    for (int j = 0; j < 7; j++) {
+        double offset = halfWidth * NODES[j];
+        double pair = f(center - offset) + f(center + offset);
+        kronrod += KRONROD_WEIGHTS[j] * pair;
+        if (j % 2 == 1) gauss += GAUSS_WEIGHTS[j / 2] * pair;
+    }
+
+    error = fabs((kronrod - gauss) * halfWidth);
+    return kronrod * halfWidth;
+}
+
+// Bisect [left, right] until every piece meets the tolerance or the depth
+// limit is reached (always in the same order, so results repeat exactly)
+template <typename Function>
+double adaptiveGaussKronrod(Function& f, double left, double right, int depth) {
+    const double ABSOLUTE_TOLERANCE = 1e-12;    // Per unit of interval width
+    const double RELATIVE_TOLERANCE = 1e-10;
+
+    double error;
+    double result = gaussKronrod(f, left, right, error);
+    if (!isfinite(result) || depth == 0 ||
+        error <= max(ABSOLUTE_TOLERANCE * fabs(right - left), RELATIVE_TOLERANCE * fabs(result))) {
+        return result;
+    }
+    double middle = (left + right) / 2;
+    return adaptiveGaussKronrod(f, left, middle, depth - 1) +
+           adaptiveGaussKronrod(f, middle, right, depth - 1);
+}
+
+// Integral of f from a to b: fixed panels integrated adaptively in
+// parallel, then summed in panel order
+template <typename Function>
+double integrateFunction(const Function& f, double a, double b) {
+    const size_t PANELS = 128;
+    vector<double> results(PANELS);
+    vector<exception_ptr> errors(PANELS);
+    double width = (b - a) / PANELS;
+
+    parallelFor(PANELS, [&](size_t i) {
+        Function local(f);
+        double left = a + width * i;
+        double right = (i + 1 == PANELS) ? b : a + width * (i + 1);
+        try {
+            results[i] = adaptiveGaussKronrod(local, left, right, 30);
+        } catch (...) {
+            errors[i] = current_exception();
+        }
+    });
+
+    double total = 0;
+    for (size_t i = 0; i < PANELS; i++) {
+        if (errors[i]) rethrow_exception(errors[i]);
+        total += results[i];
+    }
+    return total;
+}
+
+// Shrink a bracket [low, high] with f(low), f(high) of opposite signs using
+// Newton steps, falling back to bisection when a step leaves the bracket
+double refineRoot(UnivariateFunction& f, double low, double high, double fLow) {
+    double x = (low + high) / 2;
+    for (int iteration = 0; iteration < 200; iteration++) {
+        double slope;
+        double fx = f.withDerivative(x, slope);
+        if (fx == 0) return x;
+
+        if ((fx < 0) == (fLow < 0)) {
+            low = x;
+            fLow = fx;
+        } else {
+            high = x;
+        }
+
+        double next = x - fx / slope;
+        if (!(slope != 0 && next > min(low, high) && next < max(low, high))) {
+            next = (low + high) / 2;
+        }
+        if (fabs(next - x) <= 1e-15 * (1 + fabs(x)) || fabs(high - low) <= 1e-15 * (1 + fabs(x))) {
+            return next;
+        }
+        x = next;
+    }
+    return x;
+}
+
+// A root of f in [a, b]: the leftmost sign change among panel edges
+// (evaluated in parallel), then refined within that panel. Edges where f
+// is undefined are skipped.
+double findRoot(const UnivariateFunction& f, double a, double b) {
+    const size_t PANELS = 64;
+    vector<double> edges(PANELS + 1);
+    vector<char> defined(PANELS + 1, 0);
+    auto edge = [&](size_t i) { return i == PANELS ? b : a + (b - a) * i / PANELS; };
+
+    parallelFor(PANELS + 1, [&](size_t i) {
+        UnivariateFunction local(f);
+        try {
+            edges[i] = local(edge(i));
+            defined[i] = isfinite(edges[i]);
+        } catch (const exception&) {
+            defined[i] = 0;
+        }
+    });
+
+    for (size_t i = 0; i <= PANELS; i++) {
+        if (!defined[i]) continue;
+        if (edges[i] == 0) return edge(i);
+        if (i < PANELS && defined[i + 1] && (edges[i] < 0) != (edges[i + 1] < 0)) {
+            UnivariateFunction local(f);
+            return refineRoot(local, edge(i), edge(i + 1), edges[i]);
+        }
+    }
+    throw runtime_error("root: f does not change sign between a and b");
+}
+
+double numericCallValue(const NumericCall& call, const double* values, double a, double b) {
+    UnivariateFunction f(call.integrand, values, call.variable);
+    double value = call.op == OP_INTEGRATE ? integrateFunction(f, a, b) : findRoot(f, a, b);
+    if (!isfinite(value)) {
+        throw runtime_error(string(OP_TABLE[call.op].name) + ": result is not finite");
+    }
+    return value;
+}
+
+// Dual number of a call from those of a and b; each has a value, then one
+// derivative per variable of the calling program (slots). The integral
+// moves with its limits by f there, and with the variables of f by the
+// integral of its partial derivatives. A root moves with the variables of
+// f by -(df/dv) / (df/dx) there, and not with the limits.
+void numericCallGradient(const NumericCall& call, const double* values, const vector<uint32_t>& slots,
+                         const double* a, const double* b, double* result) {
+    const size_t width = slots.size() + 1;
+    const vector<uint32_t>& inputs = call.integrand.getVariableSlots();
+    UnivariateFunction f(call.integrand, values, call.variable);
+    vector<double> dual(width, 0.0);
+    dual[0] = numericCallValue(call, values, a[0], b[0]);
+
+    if (call.op == OP_INTEGRATE) {
+        auto limit = [&](const double* bound, double sign) {
+            if (all_of(bound + 1, bound + width, [](double d) { return d == 0; })) return;
+            double edge = sign * f(bound[0]);
+            for (size_t i = 1; i < width; i++) {
+                if (bound[i] != 0) dual[i] += edge * bound[i];
+            }
+        };
+        limit(b, 1.0);
+        limit(a, -1.0);
+        for (size_t k = 0; k < inputs.size(); k++) {
+            if (k == f.variableIndex()) continue;
+            size_t i = find(slots.begin(), slots.end(), inputs[k]) - slots.begin();
+            if (i < slots.size()) dual[1 + i] += integrateFunction(PartialDerivative(f, k), a[0], b[0]);
+        }
+    } else {
+        f.gradientAt(dual[0]);
+        double slope = f.variableIndex() == SIZE_MAX ? 0.0 : f.partials()[f.variableIndex()];
+        for (size_t k = 0; k < inputs.size(); k++) {
+            double partial = f.partials()[k];
+            if (k == f.variableIndex() || partial == 0) continue;
+            size_t i = find(slots.begin(), slots.end(), inputs[k]) - slots.begin();
+            if (i < slots.size()) dual[1 + i] -= partial / slope;
+        }
+    }
+    copy(dual.begin(), dual.end(), result);
+}
+
+// The integral is (b - a) times a value f takes between them, and a root
+// lies between a and b
+Interval numericCallInterval(const NumericCall& call, const Interval* values, Interval a, Interval b) {
+    Interval span = { min(a.lo, b.lo), max(a.hi, b.hi) };
+    if (call.op == OP_ROOT) return span;
+
+    vector<Interval> box(call.integrand.getSlotCount());
+    for (uint32_t slot : call.integrand.getVariableSlots()) {
+        box[slot] = slot == call.variable ? span : values[slot];
+    }
+    return iMul(iSub(b, a), call.integrand.evaluateInterval(box.data()));
+}
+
+// Bounds on the smallest and largest value of a program over a box
+struct RangeBounds {
+    Interval minimum;   // Contains the smallest value
+    Interval maximum;   // Contains the largest value
+    size_t boxes;       // Interval evaluations used
+};
+
+// Branch and bound for the minimum of sign * f over box (sign -1 finds the
+// maximum). Boxes are bisected along their widest split variable, lowest
+// bound first; a box whose bound exceeds a value already seen at some point
+// cannot hold the minimum and is dropped. Returns { lower bound, best value }.
+Interval searchMinimum(const CompiledExpression& program, const vector<Interval>& box,
+                       const vector<uint32_t>& splitSlots, double sign,
+                       double tolerance, size_t maxBoxes, size_t& boxes) {
+    struct Candidate {
+        double bound;
+        vector<Interval> box;
+        bool operator>(const Candidate& other) const { return bound > other.bound; }
+    };
+    priority_queue<Candidate, vector<Candidate>, greater<Candidate>> candidates;
+    double best = INF;          // Smallest value seen at a point
+    double settled = INF;       // Lowest bound of boxes too small to split
+    vector<double> point(box.size());
+
+    // Bound a box and sample its midpoint; false if no point of it is defined
+    auto examine = [&](const vector<Interval>& candidate, double& lower) {
+        boxes++;
+        Interval range;
+        try {
+            range = program.evaluateInterval(candidate.data());
+        } catch (const exception&) {
+            return false;
+        }
+        lower = sign > 0 ? range.lo : 0.0 - range.hi;
+        if (isnan(lower)) lower = -INF;
+
+        for (size_t i = 0; i < candidate.size(); i++) {
+            point[i] = candidate[i].lo + (candidate[i].hi - candidate[i].lo) / 2;
+        }
+        try {
+            double value = sign * program.evaluate(point.data());
+            if (!isnan(value)) best = min(best, value);
+        } catch (const exception&) {
+            // Midpoint outside the domain; the bound still holds
+        }
+        return true;
+    };
+
+    double lower;
+    if (examine(box, lower)) {
+        candidates.push(Candidate{ lower, box });
+    }
+
+    while (!candidates.empty() && boxes + 2 <= maxBoxes) {
+        const Candidate& top = candidates.top();
+        if (best - top.bound <= tolerance * (1 + fabs(best))) break;
+
+        vector<Interval> parent = top.box;
+        double parentBound = top.bound;
+        candidates.pop();
+
+        if (splitSlots.empty()) {
+            settled = min(settled, parentBound);
+            continue;
+        }
+        uint32_t widest = splitSlots[0];
+        for (uint32_t slot : splitSlots) {
+            if (parent[slot].hi - parent[slot].lo > parent[widest].hi - parent[widest].lo) widest = slot;
+        }
+        double middle = parent[widest].lo + (parent[widest].hi - parent[widest].lo) / 2;
+        if (!(middle > parent[widest].lo && middle < parent[widest].hi)) {
+            settled = min(settled, parentBound);
+            continue;
+        }
+
+        for (int half = 0; half < 2; half++) {
+            vector<Interval> child = parent;
+            (half == 0 ? child[widest].hi : child[widest].lo) = middle;
+            if (examine(child, lower) && lower <= best) {
+                candidates.push(Candidate{ lower, move(child) });
+            }
+        }
+    }
+
+    if (best == INF && candidates.empty() && settled == INF) {
+        throw runtime_error("range: expression is undefined everywhere in the box");
+    }
+    lower = min(settled, candidates.empty() ? best : candidates.top().bound);
+    return Interval{ lower, best };
+}
+
+// Bounds on the minimum and maximum of a program over a box indexed by
+// slot. Only the variables in splitSlots vary; each needs a finite range.
+RangeBounds boundRange(const CompiledExpression& program, const vector<Interval>& box,
+                       const vector<uint32_t>& splitSlots, double tolerance, size_t maxBoxes) {
+    size_t lowBoxes = 0, highBoxes = 0;
+    Interval low = searchMinimum(program, box, splitSlots, 1, tolerance, maxBoxes / 2, lowBoxes);
+    Interval high = searchMinimum(program, box, splitSlots, -1, tolerance, maxBoxes / 2, highBoxes);
+
+    RangeBounds result;
+    result.boxes = lowBoxes + highBoxes;
+    result.minimum = low;
+    result.maximum = Interval{ 0.0 - high.hi, 0.0 - high.lo };
+    return result;
+}
+
+// ========================================
+// UNIT REGISTRY
+// Units as (dimension, scale, offset) rows,
+// with every pairwise conversion precomputed
+// ========================================
+// base value = value * scale + offset, where each dimension has one base
+// unit (kelvin, meter, kilogram, second, liter)
+struct UnitDefinition {
+    const char* symbol;     // What users type
+    const char* label;      // What is printed after a value
+    const char* name;
+    const char* dimension;
+    double scale;
+    double offset;
+};
+
+const UnitDefinition DEFAULT_UNITS[] = {
+    { "K",   "K",     "Kelvin",      "Temperature", 1.0,              0.0 },
+    { "C",   "C",  "Celsius",     "Temperature", 1.0,              273.15 },
+    { "F",   "F",  "Fahrenheit",  "Temperature", 5.0 / 9.0,        459.67 * 5.0 / 9.0 },
+    { "m",   "m",     "Meters",      "Length",      1.0,              0.0 },
+    { "km",  "km",    "Kilometers",  "Length",      1000.0,           0.0 },
+    { "cm",  "cm",    "Centimeters", "Length",      0.01,             0.0 },
+    { "mm",  "mm",    "Millimeters", "Length",      0.001,            0.0 },
+    { "ft",  "ft",    "Feet",        "Length",      0.3048,           0.0 },
+    { "in",  "in",    "Inches",      "Length",      0.0254,           0.0 },
+    { "yd",  "yd",    "Yards",       "Length",      0.9144,           0.0 },
+    { "mi",  "mi",    "Miles",       "Length",      1609.344,         0.0 },
+    { "kg",  "kg",    "Kilograms",   "Weight",      1.0,              0.0 },
+    { "g",   "g",     "Grams",       "Weight",      0.001,            0.0 },
+    { "lb",  "lbs",   "Pounds",      "Weight",      0.45359237,       0.0 },
+    { "oz",  "oz",    "Ounces",      "Weight",      0.028349523125,   0.0 },
+    { "s",   "s",     "Seconds",     "Time",        1.0,              0.0 },
+    { "min", "min",   "Minutes",     "Time",        60.0,             0.0 },
+    { "h",   "h",     "Hours",       "Time",        3600.0,           0.0 },
+    { "L",   "L",     "Liters",      "Volume",      1.0,              0.0 },
+    { "mL",  "mL",    "Milliliters", "Volume",      0.001,            0.0 },
+    { "gal", "gal",   "US gallons",  "Volume",      3.785411784,      0.0 }
+};
+
+// to = from * scale + offset for one pair of units
+struct AffineOp {
+    double scale;
+    double offset;
+
+    double operator()(double a) const { return a * scale + offset; }
+#if defined(__AVX__) || defined(__SSE2__)
+    SimdVector operator()(SimdVector a) const {
+        return simdAdd(simdMul(a, simdBroadcast(scale)), simdBroadcast(offset));
+    }
+#endif
+};
+
+class UnitRegistry {
+private:
+    vector<UnitDefinition> units;
+    unordered_map<string, uint32_t> indexBySymbol;
+    vector<AffineOp> matrix;                // units.size()^2, row = from, column = to
+    vector<char> compatible;                // Same shape: dimensions match
+
+    // Compose from -> base -> to for every pair
+    void rebuild() {
+        size_t n = units.size();
+        matrix.assign(n * n, AffineOp{ 0.0, 0.0 });
+        compatible.assign(n * n, 0);
+        for (size_t from = 0; from < n; from++) {
+            for (size_t to = 0; to < n; to++) {
+                if (strcmp(units[from].dimension, units[to].dimension) != 0) continue;
+                double scale = units[from].scale / units[to].scale;
+                double offset = (units[from].offset - units[to].offset) / units[to].scale;
+                matrix[from * n + to] = AffineOp{ scale, offset };
+                compatible[from * n + to] = 1;
+            }
+        }
+    }
+
+public:
+    UnitRegistry() {
+        for (const UnitDefinition& unit : DEFAULT_UNITS) {
+            units.push_back(unit);
+            indexBySymbol[unit.symbol] = static_cast<uint32_t>(units.size() - 1);
+        }
+        rebuild();
+    }
+
+    // Add (or redefine) a unit; the strings must outlive the registry
+    void addUnit(const UnitDefinition& unit) {
+        if (unit.scale == 0) {
+            throw runtime_error("Unit scale must be non-zero!");
+        }
+        auto it = indexBySymbol.find(unit.symbol);
+        if (it != indexBySymbol.end()) {
+            units[it->second] = unit;
+        } else {
+            units.push_back(unit);
+            indexBySymbol[unit.symbol] = static_cast<uint32_t>(units.size() - 1);
+        }
+        rebuild();
+    }
+
+    const vector<UnitDefinition>& getUnits() const { return units; }
+
+    uint32_t indexOf(const string& symbol) const {
+        auto it = indexBySymbol.find(symbol);
+        if (it == indexBySymbol.end()) {
+            throw runtime_error("Unknown unit: " + symbol);
+        }
+        return it->second;
+    }
+
+    const UnitDefinition& unit(uint32_t index) const { return units[index]; }
+
+    // Precomputed conversion between two units of the same dimension
+    const AffineOp& conversion(uint32_t from, uint32_t to) const {
+        size_t cell = from * units.size() + to;
+        if (!compatible[cell]) {
+            throw runtime_error(string("Cannot convert ") + units[from].dimension +
+                                " to " + units[to].dimension + "!");
+        }
+        return matrix[cell];
+    }
+
+    double convert(double value, uint32_t from, uint32_t to) const {
+        return conversion(from, to)(value);
+    }
+
+    // Convert a whole column; output may alias input. Large columns are
+    // split across cores, each block through the SIMD kernel.
+    void convert(Span<const double> input, Span<double> output, uint32_t from, uint32_t to) const {
+        if (input.size != output.size) {
+            throw runtime_error("Input and output sizes differ!");
+        }
+        const size_t BLOCK = 1 << 18;
+        AffineOp op = conversion(from, to);
+        size_t blocks = (input.size + BLOCK - 1) / BLOCK;
+        auto convertBlock = [&](size_t b) {
+            size_t begin = b * BLOCK;
+            size_t count = min(BLOCK, input.size - begin);
+            unaryKernel(input.data + begin, output.data + begin, count, op);
+        };
+        if (blocks > 1) {
+            parallelFor(blocks, convertBlock);
+        } else if (blocks == 1) {
+            convertBlock(0);
+        }
+    }
+};
+
+// ========================================
+// CALCULATOR CLASS
+// Main calculator with all operations
+// ========================================
+// Formula kept for a variable assigned from other variables
+struct Formula {
+    string expression;
+    CompiledExpression program;
+};
+
+// Function defined as name(a, b) = expression. The body is the parsed,
+// unoptimized program with parameter i read as OP_LOAD_TEMP i; each call
+// copies it into the caller with the parameters replaced by the arguments.
+struct UserFunction {
+    string definition;          // As typed, e.g. "hyp(a, b) = sqrt(a^2 + b^2)"
+    uint32_t parameterCount;
+    vector<Instruction> body;
+};
+
+typedef map<string, UserFunction, less<>> FunctionTable;
+
+// Write every variable and formula (indexed by slot, nullptr for plain
+// values) as a snapshot. The file is written beside path and renamed over
+// it, so readers never see half a snapshot.
+void writeSnapshot(const string& path, const VariableTable& table, const vector<const Formula*>& formulas,
+                   const FunctionTable& functions) {
+    uint32_t slotCount = static_cast<uint32_t>(table.size());
+    uint32_t indexSize = 1;
+    while (indexSize < slotCount * 2 + 1) indexSize *= 2;   // Load factor <= 1/2
+
+    string strings;
+    auto addString = [&](string_view text) {
+        if (strings.size() + text.size() > UINT32_MAX) throw runtime_error("Snapshot too large");
+        SnapshotString s = { static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(text.size()) };
+        strings.append(text.data(), text.size());
+        return s;
+    };
+
+    vector<SnapshotString> names(slotCount);
+    vector<double> values(table.data(), table.data() + slotCount);
+    vector<uint8_t> defined(slotCount);
+    vector<uint32_t> index(indexSize, 0);
+    for (uint32_t slot = 0; slot < slotCount; slot++) {
+        names[slot] = addString(table.nameOf(slot));
+        defined[slot] = table.isDefined(slot) ? 1 : 0;
+        uint64_t bucket = hashName(table.nameOf(slot)) & (indexSize - 1);
+        while (index[bucket] != 0) bucket = (bucket + 1) & (indexSize - 1);
+        index[bucket] = slot + 1;
+    }
+
+    vector<uint32_t> formulaOf(slotCount, 0);
+    vector<SnapshotFormula> records;
+    vector<SnapshotInstruction> code;
+    vector<uint32_t> inputs;
+    vector<uint32_t> dependentStarts(slotCount + 1, 0);
+    for (uint32_t slot = 0; slot < slotCount; slot++) {
+        const Formula* formula = formulas[slot];
+        if (formula == nullptr) continue;
+        const CompiledExpression& program = formula->program;
+
+        // A formula with integrate() or root() is saved without its code,
+        // as its integrands are programs of their own; it is compiled from
+        // its text when first needed
+        SnapshotFormula record = {};
+        record.expression = addString(formula->expression);
+        record.code = static_cast<uint32_t>(code.size());
+        record.inputs = static_cast<uint32_t>(inputs.size());
+        record.inputCount = static_cast<uint32_t>(program.getVariableSlots().size());
+        if (program.getCalls().empty()) {
+            record.codeLength = static_cast<uint32_t>(program.getCode().size());
+            record.maxStackDepth = static_cast<uint32_t>(program.getMaxStackDepth());
+            record.tempCount = program.getTempCount();
+            for (const Instruction& ins : program.getCode()) {
+                SnapshotInstruction stored = {};
+                stored.op = ins.op;
+                stored.slot = ins.slot;
+                stored.value = ins.value;
+                code.push_back(stored);
+            }
+        }
+        for (uint32_t input : program.getVariableSlots()) {
+            inputs.push_back(input);
+            dependentStarts[input + 1]++;
+        }
+        records.push_back(record);
+        formulaOf[slot] = static_cast<uint32_t>(records.size());
+    }
+
+    vector<SnapshotFunction> functionRecords;
+    for (const auto& entry : functions) {
+        SnapshotFunction record = {};
+        record.name = addString(entry.first);
+        record.definition = addString(entry.second.definition);
+        record.parameterCount = entry.second.parameterCount;
+        record.code = static_cast<uint32_t>(code.size());
+        record.codeLength = static_cast<uint32_t>(entry.second.body.size());
+        for (const Instruction& ins : entry.second.body) {
+            SnapshotInstruction stored = {};
+            stored.op = ins.op;
+            stored.slot = ins.slot;
+            stored.value = ins.value;
+            code.push_back(stored);
+        }
+        functionRecords.push_back(record);
+    }
+
+    // Reverse edges (input -> formulas reading it) grouped by input slot
+    for (uint32_t slot = 0; slot < slotCount; slot++) {
+        dependentStarts[slot + 1] += dependentStarts[slot];
+    }
+    vector<uint32_t> dependents(dependentStarts[slotCount]);
+    vector<uint32_t> next(dependentStarts.begin(), dependentStarts.end() - 1);
+    for (uint32_t slot = 0; slot < slotCount; slot++) {
+        if (formulas[slot] == nullptr) continue;
+        for (uint32_t input : formulas[slot]->program.getVariableSlots()) {
+            dependents[next[input]++] = slot;
+        }
+    }
+
+    // Lay the sections out after the header, each 8-byte aligned
+    SnapshotHeader header = {};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.slotCount = slotCount;
+    header.formulaCount = static_cast<uint32_t>(records.size());
+    header.indexSize = indexSize;
+    header.dependentCount = dependents.size();
+    header.codeCount = code.size();
+    header.inputCount = inputs.size();
+    header.stringsSize = strings.size();
+    header.functionCount = functionRecords.size();
+
+    vector<pair<uint64_t*, pair<const void*, size_t>>> sections = {
+        { &header.names, { names.data(), names.size() * sizeof(SnapshotString) } },
+        { &header.values, { values.data(), values.size() * sizeof(double) } },
+        { &header.defined, { defined.data(), defined.size() } },
+        { &header.index, { index.data(), index.size() * sizeof(uint32_t) } },
+        { &header.formulaOf, { formulaOf.data(), formulaOf.size() * sizeof(uint32_t) } },
+        { &header.formulas, { records.data(), records.size() * sizeof(SnapshotFormula) } },
+        { &header.dependentStarts, { dependentStarts.data(), dependentStarts.size() * sizeof(uint32_t) } },
+        { &header.dependents, { dependents.data(), dependents.size() * sizeof(uint32_t) } },
+        { &header.code, { code.data(), code.size() * sizeof(SnapshotInstruction) } },
+        { &header.inputs, { inputs.data(), inputs.size() * sizeof(uint32_t) } },
+        { &header.strings, { strings.data(), strings.size() } },
+        { &header.functions, { functionRecords.data(), functionRecords.size() * sizeof(SnapshotFunction) } }
+    };
+    uint64_t offset = (sizeof(SnapshotHeader) + 7) / 8 * 8;
+    for (auto& section : sections) {
+        *section.first = offset;
+        offset = (offset + section.second.second + 7) / 8 * 8;
+    }
+    header.fileSize = offset;
+
+    string temporary = path + ".tmp";
+    {
+        ofstream file(temporary, ios::binary | ios::trunc);
+        if (!file) throw runtime_error("Cannot create " + temporary);
+        const char zeros[8] = {};
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        uint64_t written = sizeof(header);
+        for (auto& section : sections) {
+            file.write(zeros, *section.first - written);
+            file.write(static_cast<const char*>(section.second.first), section.second.second);
+            written = *section.first + section.second.second;
+        }
+        file.write(zeros, header.fileSize - written);
+        if (!file.flush()) throw runtime_error("Cannot write " + temporary);
+    }
+    if (rename(temporary.c_str(), path.c_str()) != 0) {
+        remove(temporary.c_str());
+        throw runtime_error("Cannot replace " + path + ": " + strerror(errno));
+    }
+}
+
+class ScientificCalculator {
+private:
+    VariableTable variables;                            // Store variables
+    unordered_map<uint32_t, Formula> formulas;          // Slots defined by formulas
+    unordered_map<uint32_t, set<uint32_t>> dependents;  // Slot -> formulas that read it
+    vector<uint32_t> visitMarks;                        // Slot -> last search that reached it
+    uint32_t visitEpoch;                                // Number of the current search
+    shared_ptr<const SnapshotImage> image;              // Loaded snapshot, for its formulas
+    unordered_set<uint32_t> loadedFormulas;             // Snapshot formulas moved to formulas
+    FunctionTable functions;                            // User functions by name
+    CalculationHistory history;             // Calculation history
+    UnitRegistry units;                     // Unit conversion table
+    ExpressionCache compiledCache;          // Compiled programs by expression text
+    vector<Token> tokenBuffer;              // Reused token storage for tokenize()
+    bool echo;                              // Print assignments and updates
+    MathAccuracy accuracy;                  // Tier of sin, cos, tan, log, ln and exp
+    unique_ptr<HistoryWriter> historyWriter; // Streams history to a file, if set
+
+    // Tokenize the input expression into tokenBuffer. Tokens point into
+    // the expression text, which must outlive them.
+    const vector<Token>& tokenize(string_view expression) {
+        tokenBuffer.clear();    // Keeps the capacity of earlier calls
+        const char* end = expression.data() + expression.size();
+
+        for (size_t i = 0; i < expression.length(); i++) {
+            unsigned char c = expression[i];
+
+            // Skip whitespace
+            if (isspace(c)) continue;
+
+            // Numbers (decimals and scientific notation such as 1.5e-3)
+            if (isdigit(c) || c == '.') {
+                double number = 0.0;
+                const char* first = expression.data() + i;
+                from_chars_result parsed = from_chars(first, end, number);
+                if (parsed.ec == errc::result_out_of_range) {
+                    throw runtime_error("Number out of range!");
+                }
+                if (parsed.ec != errc()) {
+                    throw runtime_error("Invalid number!");
+                }
+
+                size_t length = parsed.ptr - first;
+                tokenBuffer.push_back(Token(NUMBER, expression.substr(i, length), number));
+                i += length - 1;
+            }
+            // Letters (functions or variables)
+            else if (isalpha(c)) {
+                size_t start = i;
+                // Continue reading letters
+                while (i + 1 < expression.length() &&
+                       isalpha(static_cast<unsigned char>(expression[i + 1]))) {
+                    i++;
+                }
+
+                string_view name = expression.substr(start, i - start + 1);
+                OpCode func = lookupFunction(name);
+                double constant;
+                if (lookupConstant(name, constant)) {
+                    tokenBuffer.push_back(Token(NUMBER, name, constant));
+                } else if (func != OP_COUNT) {
+                    tokenBuffer.push_back(Token(FUNCTION, name, 0.0, func));
+                } else if (functions.find(name) != functions.end()) {
+                    tokenBuffer.push_back(Token(FUNCTION, name, 0.0, OP_COUNT));
+                } else {
+                    tokenBuffer.push_back(Token(VARIABLE, name));
+                }
+            }
+            // Operators
+            else if (lookupOperator(c) != OP_COUNT) {
+                tokenBuffer.push_back(Token(OPERATOR, expression.substr(i, 1), 0.0, lookupOperator(c)));
+            }
+            // Parentheses
+            else if (c == '(') {
+                tokenBuffer.push_back(Token(LPAREN, expression.substr(i, 1)));
+            }
+            else if (c == ')') {
+                tokenBuffer.push_back(Token(RPAREN, expression.substr(i, 1)));
+            }
+            else if (c == ',') {
+                tokenBuffer.push_back(Token(COMMA, expression.substr(i, 1)));
+            }
+        }
+
+        return tokenBuffer;
+    }
+
+    // Position of the parser in the token list and the program it emits
+    struct ParseState {
+        const vector<Token>& tokens;
+        size_t next;                // Index of the next unread token
+        size_t depth;               // Values on the evaluation stack so far
+        size_t nesting;             // Open parentheses, calls, signs and powers
+        CompiledExpression& program;
+        const vector<string_view>* parameters;  // Of the function body being defined
+    };
+
+    // Each level of nesting is a level of recursion
+    static constexpr size_t MAX_NESTING = 10000;
+
+    // Calls copy their arguments into the body, so nested calls can grow
+    // a program exponentially
+    static constexpr size_t MAX_INLINED_CODE = 1 << 20;
+
+    void enter(ParseState& state) {
+        if (++state.nesting > MAX_NESTING) {
+            throw runtime_error("Expression is nested too deeply!");
+        }
+    }
+
+    void emit(ParseState& state, OpCode op, uint32_t slot = 0, double value = 0.0) {
+        state.program.code.push_back(Instruction{ op, slot, value });
+        if (OP_TABLE[op].arity == 0) {
+            state.depth++;
+            state.program.maxStackDepth = max(state.program.maxStackDepth, state.depth);
+        } else if (OP_TABLE[op].arity == 2) {
+            state.depth--;
+        }
+    }
+
+    void addInput(CompiledExpression& program, uint32_t slot) {
+        if (find(program.variableSlots.begin(), program.variableSlots.end(),
+                 slot) == program.variableSlots.end()) {
+            program.variableSlots.push_back(slot);
+            program.variableNames.push_back(string(variables.nameOf(slot)));
+            program.slotCount = max(program.slotCount, slot + 1);
+        }
+    }
+
+    void useVariable(ParseState& state, uint32_t slot) {
+        addInput(state.program, slot);
+        emit(state, OP_PUSH_VAR, slot);
+    }
+
+    // Re-emit code parsed earlier, adding the variables it reads as inputs
+    void emitCode(ParseState& state, const vector<Instruction>& code) {
+        for (const Instruction& ins : code) {
+            if (ins.op == OP_PUSH_VAR) {
+                useVariable(state, ins.slot);
+            } else {
+                emit(state, ins.op, ins.slot, ins.value);
+            }
+        }
+    }
+
+    // integrate(f, a, b) or root(f, a, b), f a formula in x, or with the
+    // variable named: integrate(f, t, a, b). f is parsed into a program of
+    // its own, held by the call; a and b are parsed in place, like the
+    // operands of an operator. The variables f reads, other than the one
+    // it varies, become inputs of the calling program.
+    void parseNumericCall(ParseState& state, string_view name) {
+        if (state.parameters != nullptr) {
+            throw runtime_error(string(name) + " cannot be used in a function body");
+        }
+        state.next++;   // (
+        enter(state);
+
+        shared_ptr<NumericCall> call = make_shared<NumericCall>();
+        call->op = name == "integrate" ? OP_INTEGRATE : OP_ROOT;
+        CompiledExpression integrand;
+        ParseState inner = { state.tokens, state.next, 0, state.nesting, integrand, nullptr };
+        parseExpression(inner, 0);
+        state.next = inner.next;
+        call->integrand = ExpressionOptimizer::optimize(integrand);
+
+        // The other arguments, with the tokens each was parsed from
+        vector<vector<Instruction>> arguments;
+        vector<pair<size_t, size_t>> spans;
+        vector<Instruction>& code = state.program.code;
+        size_t inputs = state.program.variableSlots.size();
+        while (true) {
+            TokenType next = state.next < state.tokens.size() ? state.tokens[state.next].type : RPAREN;
+            if (state.next == state.tokens.size() || (next != COMMA && next != RPAREN)) {
+                throw runtime_error("Mismatched parentheses!");
+            }
+            state.next++;
+            if (next == RPAREN) break;
+
+            size_t firstToken = state.next;
+            size_t first = code.size();
+            parseExpression(state, 0);
+            arguments.push_back(vector<Instruction>(code.begin() + first, code.end()));
+            spans.emplace_back(firstToken, state.next);
+            code.resize(first);
+            state.depth--;          // Re-emitted below
+        }
+        state.nesting--;
+        state.program.variableSlots.resize(inputs);
+        state.program.variableNames.resize(inputs);
+
+        call->variable = variables.intern("x");
+        if (arguments.size() == 3) {
+            const Token& first = state.tokens[spans[0].first];
+            if (spans[0].second - spans[0].first != 1 || first.type != VARIABLE) {
+                const Token& last = state.tokens[spans[0].second - 1];
+                throw runtime_error(string(name) + ": expected a variable name, got " +
+                                    string(first.text.data(), last.text.data() + last.text.size()));
+            }
+            call->variable = variables.intern(first.text);
+            arguments.erase(arguments.begin());
+        }
+        if (arguments.size() != 2) {
+            throw runtime_error(string(name) + " takes 3 or 4 arguments: " + string(name) + "(f, a, b) or " +
+                                string(name) + "(f, variable, a, b)");
+        }
+
+        for (uint32_t input : call->integrand.variableSlots) {
+            if (input != call->variable) addInput(state.program, input);
+        }
+        emitCode(state, arguments[0]);
+        emitCode(state, arguments[1]);
+        state.program.calls.push_back(call);
+        emit(state, call->op, static_cast<uint32_t>(state.program.calls.size() - 1));
+    }
+
+    // Call of a user function: name(argument, ...). Each argument is parsed
+    // on its own, then the body is copied in with each parameter replaced
+    // by its argument's code. The optimizer folds constants across the call
+    // and computes an argument used several times only once.
+    void parseCall(ParseState& state, string_view name) {
+        const UserFunction& function = functions.find(name)->second;
+        if (state.next == state.tokens.size() || state.tokens[state.next].type != LPAREN) {
+            throw runtime_error(string(name) + " needs arguments in parentheses");
+        }
+        state.next++;
+        enter(state);
+
+        // Arguments count as inputs only where the body reads them
+        vector<vector<Instruction>> arguments;
+        vector<Instruction>& code = state.program.code;
+        size_t inputs = state.program.variableSlots.size();
+        if (state.next < state.tokens.size() && state.tokens[state.next].type == RPAREN) {
+            state.next++;
+        } else {
+            while (true) {
+                size_t first = code.size();
+                parseExpression(state, 0);
+                arguments.push_back(vector<Instruction>(code.begin() + first, code.end()));
+                code.resize(first);
+                state.depth--;      // Re-emitted where the body reads it
+
+                TokenType next = state.next < state.tokens.size() ? state.tokens[state.next].type : RPAREN;
+                if (state.next == state.tokens.size() || (next != COMMA && next != RPAREN)) {
+                    throw runtime_error("Mismatched parentheses!");
+                }
+                state.next++;
+                if (next == RPAREN) break;
+            }
+        }
+        state.nesting--;
+        state.program.variableSlots.resize(inputs);
+        state.program.variableNames.resize(inputs);
+
+        if (arguments.size() != function.parameterCount) {
+            throw runtime_error(string(name) + " takes " + to_string(function.parameterCount) +
+                                " argument" + (function.parameterCount == 1 ? "" : "s"));
+        }
+        for (const Instruction& ins : function.body) {
+            if (ins.op == OP_LOAD_TEMP) {
+                emitCode(state, arguments[ins.slot]);
+            } else if (ins.op == OP_PUSH_VAR) {
+                useVariable(state, ins.slot);
+            } else {
+                emit(state, ins.op, ins.slot, ins.value);
+            }
+        }
+        if (code.size() > MAX_INLINED_CODE) {
+            throw runtime_error("Expression is too large after inlining " + string(name) + "!");
+        }
+    }
+
+    // One operand: a number, variable, parenthesized expression, function
+    // call or negation. Functions bind tighter than any operator
+    // (sin 30 + 1 is sin(30) + 1); a sign binds looser than ^ (-x^2 is -(x^2)).
+    void parseOperand(ParseState& state) {
+        if (state.next == state.tokens.size()) {
+            throw runtime_error("Invalid expression!");
+        }
+        const Token& token = state.tokens[state.next++];
+
+        switch (token.type) {
+            case NUMBER:
+                emit(state, OP_PUSH_CONST, 0, token.numValue);
+                return;
+
+            case VARIABLE:
+                if ((token.text == "integrate" || token.text == "root") &&
+                    state.next < state.tokens.size() && state.tokens[state.next].type == LPAREN) {
+                    parseNumericCall(state, token.text);
+                    return;
+                }
+                if (state.parameters != nullptr) {
+                    auto parameter = find(state.parameters->begin(), state.parameters->end(), token.text);
+                    if (parameter != state.parameters->end()) {
+                        emit(state, OP_LOAD_TEMP, static_cast<uint32_t>(parameter - state.parameters->begin()));
+                        return;
+                    }
+                }
+                useVariable(state, variables.intern(token.text));
+                return;
+
+            case LPAREN:
+                enter(state);
+                parseExpression(state, 0);
+                if (state.next == state.tokens.size() || state.tokens[state.next].type != RPAREN) {
+                    throw runtime_error("Mismatched parentheses!");
+                }
+                state.next++;
+                state.nesting--;
+                return;
+
+            case FUNCTION:
+                if (token.op == OP_COUNT) {
+                    parseCall(state, token.text);
+                    return;
+                }
+                enter(state);
+                parseOperand(state);
+                state.nesting--;
+                emit(state, token.op);
+                return;
+
+            case OPERATOR:
+                if (token.op == OP_SUB) {
+                    enter(state);
+                    parseExpression(state, OP_TABLE[OP_POW].precedence);
+                    state.nesting--;
+                    emit(state, OP_NEG);
+                    return;
+                }
+                break;
+
+            default:
+                break;
+        }
+        throw runtime_error("Invalid expression!");
+    }
+
+    // Operands joined by operators of at least minPrecedence (Pratt parsing).
+    // Left-associative operators loop; right-associative ones recurse.
+    void parseExpression(ParseState& state, uint8_t minPrecedence) {
+        parseOperand(state);
+        while (state.next < state.tokens.size() && state.tokens[state.next].type == OPERATOR) {
+            OpCode op = state.tokens[state.next].op;
+            const OpInfo& info = OP_TABLE[op];
+            if (info.precedence < minPrecedence) {
+                break;
+            }
+            state.next++;
+
+            if (info.rightAssociative) {
+                enter(state);
+                parseExpression(state, info.precedence);
+                state.nesting--;
+            } else {
+                parseExpression(state, info.precedence + 1);
+            }
+            emit(state, op);
+        }
+    }
+
+    // Parse tokens straight into a flat program. Every token other than a
+    // user function call emits at most one instruction, so the code buffer
+    // is usually allocated once up front. A function body is parsed with
+    // its parameter names.
+    CompiledExpression parseProgram(const vector<Token>& tokens,
+                                    const vector<string_view>* parameters = nullptr) {
+        CompiledExpression program;
+        program.code.reserve(tokens.size());
+        ParseState state = { tokens, 0, 0, 0, program, parameters };
+
+        parseExpression(state, 0);
+        if (state.next < tokens.size()) {
+            throw runtime_error(tokens[state.next].type == RPAREN ? "Mismatched parentheses!"
+                                                                  : "Invalid expression!");
+        }
+        return program;
+    }
+
+    // Whether slot's formula is still only in the loaded snapshot
+    bool inSnapshot(uint32_t slot) const {
+        return image && slot < image->slotCount() && image->hasFormula(slot) &&
+               loadedFormulas.count(slot) == 0;
+    }
+
+    // Formula defining slot (nullptr if none). Snapshot formulas are
+    // rebuilt, without parsing, the first time they are needed.
+    Formula* formulaOf(uint32_t slot) {
+        auto it = formulas.find(slot);
+        if (it != formulas.end()) return &it->second;
+        if (!inSnapshot(slot)) return nullptr;
+
+        Formula& formula = formulas[slot];
+        formula.expression = string(image->formulaText(slot));
+        formula.program = image->storesProgram(slot) ? image->program(slot) : compile(formula.expression);
+        for (uint32_t input : formula.program.getVariableSlots()) {
+            dependents[input].insert(slot);
+        }
+        loadedFormulas.insert(slot);
+        return &formula;
+    }
+
+    // Collect variables downstream of slot in DFS post-order. The stack is
+    // explicit, as chains of formulas can be far deeper than the call stack.
+    // Slots are marked with the epoch of the search, so a search costs only
+    // the slots it reaches.
+    void collectDependents(uint32_t slot, vector<uint32_t>& order) {
+        if (++visitEpoch == 0) {    // Wrapped: old marks could match again
+            fill(visitMarks.begin(), visitMarks.end(), 0);
+            visitEpoch = 1;
+        }
+        size_t slots = max<size_t>(variables.size(), image ? image->slotCount() : 0);
+        if (visitMarks.size() < slots) visitMarks.resize(slots, 0);
+
+        // (slot, whether its dependents are already on the stack)
+        vector<pair<uint32_t, bool>> stack = { { slot, false } };
+        while (!stack.empty()) {
+            pair<uint32_t, bool> top = stack.back();
+            stack.pop_back();
+            if (top.second) {
+                order.push_back(top.first);
+                continue;
+            }
+            if (visitMarks[top.first] == visitEpoch) continue;
+            visitMarks[top.first] = visitEpoch;
+            stack.emplace_back(top.first, true);
+
+            auto it = dependents.find(top.first);
+            if (it != dependents.end()) {
+                for (uint32_t dependent : it->second) {
+                    if (visitMarks[dependent] != visitEpoch) stack.emplace_back(dependent, false);
+                }
+            }
+            if (image && top.first < image->slotCount()) {
+                auto stored = image->dependentsOf(top.first);
+                for (const uint32_t* dependent = stored.first; dependent != stored.second; dependent++) {
+                    if (visitMarks[*dependent] != visitEpoch && inSnapshot(*dependent)) {
+                        stack.emplace_back(*dependent, false);
+                    }
+                }
+            }
+        }
+    }
+
+    // Variables whose formulas read slot, directly or indirectly, in the
+    // order they must be recomputed (topological order)
+    vector<uint32_t> downstreamOf(uint32_t slot) {
+        vector<uint32_t> order;
+        collectDependents(slot, order);
+        order.pop_back();   // slot itself
+        reverse(order.begin(), order.end());
+        return order;
+    }
+
+    // Throw if a variable the program reads has no value
+    void requireDefined(const CompiledExpression& program, uint32_t except = UINT32_MAX) {
+        for (size_t i = 0; i < program.variableSlots.size(); i++) {
+            uint32_t slot = program.variableSlots[i];
+            if (slot != except && !variables.isDefined(slot)) {
+                throw runtime_error("Undefined variable: " + program.variableNames[i]);
+            }
+        }
+    }
+
+    // Evaluate a program against the stored variables
+    double evaluateStored(const CompiledExpression& program) {
+        requireDefined(program);
+        return program.evaluate(variables.data(), accuracy);
+    }
+
+    // Store a variable and its formula, then recompute only the variables
+    // that depend on it. A right-hand side that reads the variable itself
+    // (x = x + 1) is evaluated once, from its current value, and stored as
+    // a plain value.
+    double assignVariable(const string& name, const string& expression,
+                          const CompiledExpression& program) {
+        if (functions.count(name) != 0) {
+            throw runtime_error("Cannot assign to function: " + name);
+        }
+        uint32_t slot = variables.intern(name);
+        const vector<uint32_t>& inputs = program.getVariableSlots();
+        bool readsItself = find(inputs.begin(), inputs.end(), slot) != inputs.end();
+
+        // A formula may not read a variable that depends on the one it defines
+        vector<uint32_t> downstream = downstreamOf(slot);
+        for (uint32_t input : inputs) {
+            if (input != slot && find(downstream.begin(), downstream.end(), input) != downstream.end()) {
+                throw runtime_error("Circular dependency: " + name + " depends on itself");
+            }
+        }
+
+        // Evaluated as if the right-hand side had been calculated on its own
+        double value;
+        try {
+            value = evaluateStored(program);
+        } catch (const exception& e) {
+            throw runtime_error(string("Error: ") + e.what());
+        }
+        recordHistory(expression, value);
+
+        // Replace the old dependency edges
+        Formula* old = formulaOf(slot);
+        if (old != nullptr) {
+            for (uint32_t input : old->program.getVariableSlots()) {
+                dependents[input].erase(slot);
+            }
+            formulas.erase(slot);
+        }
+        if (!inputs.empty() && !readsItself) {
+            Formula formula = { expression, program };
+            formulas[slot] = formula;
+            for (uint32_t input : inputs) {
+                dependents[input].insert(slot);
+            }
+        }
+
+        variables.set(slot, value);
+        if (echo) cout << name << " = " << value << endl;
+
+        for (uint32_t dependent : downstream) {
+            string_view dependentName = variables.nameOf(dependent);
+            try {
+                variables.set(dependent, evaluateStored(formulaOf(dependent)->program));
+                if (echo) cout << dependentName << " = " << variables.get(dependent) << " (updated)" << endl;
+            } catch (const exception& e) {
+                if (echo) cout << "Warning: " << dependentName << " not updated: " << e.what() << endl;
+            }
+        }
+        return value;
+    }
+
+    // integrate or root of formula f in variable over [a, b]
+    double runNumericCommand(const string& command, const string& f,
+                             const string& variable, double a, double b) {
+        string name = variable;
+        name.erase(remove_if(name.begin(), name.end(), ::isspace), name.end());
+        const CompiledExpression& program = compileCached(f);
+        uint32_t slot = variables.intern(name);
+        requireDefined(program, slot);
+
+        UnivariateFunction function(program, variables.data(), slot);
+        return command == "integrate" ? integrateFunction(function, a, b) : findRoot(function, a, b);
+    }
+
+    // Input box for interval evaluation: each variable with a range spans it
+    // (its slot is added to splitSlots), the others are their stored value
+    vector<Interval> intervalBox(const CompiledExpression& program, const map<string, Interval>& ranges,
+                                 vector<uint32_t>& splitSlots) {
+        vector<Interval> box(program.slotCount);
+        for (size_t i = 0; i < program.variableSlots.size(); i++) {
+            uint32_t slot = program.variableSlots[i];
+            auto range = ranges.find(program.variableNames[i]);
+            if (range != ranges.end()) {
+                if (!(range->second.lo <= range->second.hi)) {
+                    throw runtime_error("Invalid range for " + range->first);
+                }
+                box[slot] = range->second;
+                splitSlots.push_back(slot);
+            } else if (variables.isDefined(slot)) {
+                box[slot] = Interval{ variables.get(slot), variables.get(slot) };
+            } else {
+                throw runtime_error("Undefined variable: " + program.variableNames[i]);
+            }
+        }
+        return box;
+    }
+
+    void recordHistory(const string& expression, double result) {
+        history.record(expression, result);
+        if (historyWriter && history.end() % (history.capacity() / 2) == 0) {
+            historyWriter->nudge();     // Save before the ring wraps
+        }
+    }
+
+    // Fetch the compiled program for an expression, compiling on a cache miss
+    const CompiledExpression& compileCached(const string& expression) {
+        const CompiledExpression* program = compiledCache.find(expression);
+        if (program == nullptr) {
+            program = compiledCache.insert(expression, compile(expression));
+        }
+        return *program;
+    }
+
+    // Times tokenize and parseProgram separately
+    friend void benchmarkParserStages();
+
+public:
+    // Constructor
+    ScientificCalculator() : visitEpoch(0), echo(true), accuracy(ACCURACY_EXACT) {
+        // Initialize some common constants
+        variables.set(variables.intern("pi"), M_PI);
+        variables.set(variables.intern("e"), M_E);
+    }
+
+    // Slot of a variable (created undefined if new), for evaluating
+    // compiled programs against arrays indexed by slot
+    uint32_t variableSlot(const string& name) {
+        return variables.intern(name);
+    }
+
+    const VariableTable& getVariables() const { return variables; }
+
+    // Turn printing of assignments off for headless use
+    void setEcho(bool on) { echo = on; }
+
+    // Trade precision for speed in evaluation (constants are still folded
+    // with libm, and derivatives, intervals and the solver stay exact)
+    void setAccuracy(MathAccuracy tier) { accuracy = tier; }
+    MathAccuracy getAccuracy() const { return accuracy; }
+
+    // Copy the values of slots [begin, end) (every slot by default) from
+    // another table (anything with size, nameOf, isDefined and get).
+    // slotMap translates source slots to ours and grows as needed.
+    template <typename Variables>
+    void syncVariables(const Variables& source, vector<uint32_t>& slotMap,
+                       uint32_t begin = 0, uint32_t end = UINT32_MAX) {
+        end = static_cast<uint32_t>(min<size_t>(end, source.size()));
+        while (slotMap.size() < end) {
+            slotMap.push_back(variables.intern(source.nameOf(static_cast<uint32_t>(slotMap.size()))));
+        }
+        for (uint32_t slot = begin; slot < end; slot++) {
+            if (source.isDefined(slot)) {
+                variables.set(slotMap[slot], source.get(slot));
+            } else {
+                variables.erase(slotMap[slot]);
+            }
+        }
+    }
+
+    // Parse an expression once into a reusable, optimized program
+    CompiledExpression compile(const string& expression) {
+        return ExpressionOptimizer::optimize(parseProgram(tokenize(expression)));
+    }
+
+    // Compile an expression into a native node tree for the hottest formulas
+    NativeExpression compileNative(const string& expression) {
+        return NativeExpression(compile(expression), accuracy);
+    }
+
+    // Rebind a program compiled by another calculator to our variable slots.
+    // slotMap translates its slots to ours and grows as needed. The variable
+    // of an integrand that does not read it is left as it was, unused.
+    void adoptProgram(CompiledExpression& program, vector<uint32_t>& slotMap) {
+        program.slotCount = 0;
+        for (size_t i = 0; i < program.variableSlots.size(); i++) {
+            uint32_t foreign = program.variableSlots[i];
+            if (foreign >= slotMap.size()) {
+                slotMap.resize(foreign + 1, UINT32_MAX);
+            }
+            if (slotMap[foreign] == UINT32_MAX) {
+                slotMap[foreign] = variables.intern(program.variableNames[i]);
+            }
+            program.variableSlots[i] = slotMap[foreign];
+            program.slotCount = max(program.slotCount, slotMap[foreign] + 1);
+        }
+        for (Instruction& ins : program.code) {
+            if (ins.op == OP_PUSH_VAR) ins.slot = slotMap[ins.slot];
+        }
+
+        // Integrands may be shared with the other calculator's programs,
+        // so each call is copied before it is rebound
+        for (shared_ptr<const NumericCall>& call : program.calls) {
+            shared_ptr<NumericCall> adopted = make_shared<NumericCall>(*call);
+            const vector<uint32_t>& inputs = call->integrand.variableSlots;
+            size_t variable = find(inputs.begin(), inputs.end(), call->variable) - inputs.begin();
+            adoptProgram(adopted->integrand, slotMap);
+            if (variable < inputs.size()) adopted->variable = adopted->integrand.variableSlots[variable];
+            call = adopted;
+        }
+    }
+
+    // Evaluate an adopted program without recording history
+    double evaluateProgram(const CompiledExpression& program) {
+        try {
+            return evaluateStored(program);
+        } catch (const exception& e) {
+            throw runtime_error(string("Error: ") + e.what());
+        }
+    }
+
+    // Assign from an adopted program, as calculate("name = expression") would
+    double assignProgram(const string& name, const string& expression,
+                         const CompiledExpression& program) {
+        try {
+            double constant;
+            if (lookupConstant(name, constant)) {
+                throw runtime_error("Cannot assign to constant: " + name);
+            }
+            return assignVariable(name, expression, program);
+        } catch (const exception& e) {
+            throw runtime_error(string("Error: ") + e.what());
+        }
+    }
+
+    // Evaluate an expression (no assignment) without recording history
+    double evaluate(const string& expression) {
+        try {
+            return evaluateStored(compileCached(expression));
+        } catch (const exception& e) {
+            throw runtime_error(string("Error: ") + e.what());
+        }
+    }
+
+    // Whether text defines a function: name(parameters) = expression
+    static bool isFunctionDefinition(const string& text) {
+        size_t equalPos = text.find('=');
+        return equalPos != string::npos && text.find('(') < equalPos;
+    }
+
+    // Define or replace a function from "name(a, b) = expression". Calls
+    // are inlined when a caller is compiled, so programs and formulas
+    // compiled earlier keep the definition they were compiled with.
+    void defineFunction(const string& definition) {
+        try {
+            size_t equalPos = definition.find('=');
+            size_t open = definition.find('(');
+            size_t close = definition.find(')');
+            if (equalPos == string::npos || open > equalPos || close > equalPos || close < open ||
+                definition.find_first_not_of(" \t", close + 1) != equalPos) {
+                throw runtime_error("Expected name(parameters) = expression");
+            }
+
+            // Names are letters only, as the tokenizer reads them
+            auto validName = [this](string_view name) {
+                double constant;
+                return !name.empty() &&
+                       all_of(name.begin(), name.end(), [](char c) { return isalpha(static_cast<unsigned char>(c)); }) &&
+                       lookupFunction(name) == OP_COUNT && !lookupConstant(name, constant) &&
+                       name != "integrate" && name != "root";
+            };
+            auto trim = [](string_view text) {
+                size_t first = text.find_first_not_of(" \t");
+                if (first == string_view::npos) return string_view();
+                return text.substr(first, text.find_last_not_of(" \t") - first + 1);
+            };
+
+            string_view text(definition);
+            string name(trim(text.substr(0, open)));
+            if (!validName(name)) {
+                throw runtime_error("Invalid function name: " + name);
+            }
+            if (variables.isDefined(variables.intern(name))) {
+                throw runtime_error("Function name is already a variable: " + name);
+            }
+
+            vector<string_view> parameters;
+            string_view list = trim(text.substr(open + 1, close - open - 1));
+            while (!list.empty()) {
+                size_t comma = list.find(',');
+                string_view parameter = trim(list.substr(0, comma));
+                if (!validName(parameter) || parameter == name || functions.count(parameter) != 0 ||
+                    find(parameters.begin(), parameters.end(), parameter) != parameters.end()) {
+                    throw runtime_error("Invalid parameter of " + name + ": " + string(parameter));
+                }
+                parameters.push_back(parameter);
+                if (comma == string_view::npos) break;
+                list = list.substr(comma + 1);
+                if (trim(list).empty()) throw runtime_error("Invalid parameter of " + name + ": ");
+            }
+
+            CompiledExpression body = parseProgram(tokenize(text.substr(equalPos + 1)), &parameters);
+            UserFunction function = { string(trim(text)), static_cast<uint32_t>(parameters.size()),
+                                      move(body.code) };
+            functions[name] = move(function);
+            compiledCache.clear();      // Cached programs inlined the old body
+
+            if (echo) cout << "Defined " << functions[name].definition << endl;
+        } catch (const exception& e) {
+            throw runtime_error(string("Error: ") + e.what());
+        }
+    }
+
+    const FunctionTable& getFunctions() const { return functions; }
+
+    // Copy another calculator's functions. Their bodies read variables by
+    // slot, translated as in syncVariables (source is the other table).
+    template <typename Variables>
+    void syncFunctions(const FunctionTable& source, const Variables& sourceVariables,
+                       vector<uint32_t>& slotMap) {
+        functions = source;
+        for (auto& entry : functions) {
+            for (Instruction& ins : entry.second.body) {
+                if (ins.op != OP_PUSH_VAR) continue;
+                while (slotMap.size() <= ins.slot) {
+                    slotMap.push_back(variables.intern(sourceVariables.nameOf(static_cast<uint32_t>(slotMap.size()))));
+                }
+                ins.slot = slotMap[ins.slot];
+            }
+        }
+        compiledCache.clear();
+    }
+
+    // Main calculation function
+    double calculate(const string& expression) {
+        if (isFunctionDefinition(expression)) {
+            defineFunction(expression);
+            return 0.0;
+        }
+
+        try {
+            // Check if it's a variable assignment
+            size_t equalPos = expression.find('=');
+            if (equalPos != string::npos) {
+                string varName = expression.substr(0, equalPos);
+                string varExpr = expression.substr(equalPos + 1);
+
+                // Remove whitespace from variable name
+                varName.erase(remove_if(varName.begin(), varName.end(), ::isspace), varName.end());
+
+                double constant;
+                if (lookupConstant(varName, constant)) {
+                    throw runtime_error("Cannot assign to constant: " + varName);
+                }
+
+                // Calculate the value and update dependent variables
+                return assignVariable(varName, varExpr, compileCached(varExpr));
+            }
+
+            // Compile (or reuse the cached program) and evaluate
+            double result = evaluateStored(compileCached(expression));
+
+            // Add to history (formatted only when displayed)
+            recordHistory(expression, result);
+
+            return result;
+
+        } catch (const exception& e) {
+            throw runtime_error(string("Error: ") + e.what());
+        }
+    }
+
+    // Value of an expression and its partial derivative with respect to
+    // each variable it reads, computed together in one pass
+    double gradient(const string& expression, map<string, double>& partials) {
+        try {
+            const CompiledExpression& program = compileCached(expression);
+            requireDefined(program);
+            vector<double> derivatives(program.variableSlots.size());
+            double value = program.evaluateGradient(variables.data(), derivatives.data());
+
+            partials.clear();
+            for (size_t i = 0; i < derivatives.size(); i++) {
+                partials[program.variableNames[i]] = derivatives[i];
+            }
+            return value;
+        } catch (const exception& e) {
+            throw runtime_error(string("Error: ") + e.what());
+        }
+    }
+
+    // Find where expression = 0 (or lhs = rhs) with Newton's method, starting
+    // from guess. Other variables keep their stored values, and the variable
+    // solved for is not changed.
+    double solve(const string& expression, const string& variable, double guess) {
+        try {
+            string equation = expression;
+            size_t equalPos = equation.find('=');
+            if (equalPos != string::npos) {
+                equation = "(" + expression.substr(0, equalPos) + ") - (" +
+                           expression.substr(equalPos + 1) + ")";
+            }
+
+            string name = variable;
+            name.erase(remove_if(name.begin(), name.end(), ::isspace), name.end());
+            const CompiledExpression& program = compileCached(equation);
+            uint32_t slot = variables.intern(name);
+            auto it = find(program.variableSlots.begin(), program.variableSlots.end(), slot);
+            if (it == program.variableSlots.end()) {
+                throw runtime_error("Equation does not depend on " + name);
+            }
+            size_t index = it - program.variableSlots.begin();
+            requireDefined(program, slot);
+
+            const int MAX_ITERATIONS = 50;
+            vector<double> values(variables.data(), variables.data() + variables.size());
+            vector<double> derivatives(program.variableSlots.size());
+            double x = guess;
+            for (int iteration = 0; iteration < MAX_ITERATIONS; iteration++) {
+                values[slot] = x;
+                double f = program.evaluateGradient(values.data(), derivatives.data());
+                if (f == 0) return x;
+
+                double slope = derivatives[index];
+                if (slope == 0 || !isfinite(slope)) {
+                    throw runtime_error("solve: derivative is zero or undefined at " + name +
+                                        " = " + to_string(x));
+                }
+                double step = f / slope;
+                x -= step;
+                if (!isfinite(x)) {
+                    throw runtime_error("solve: Newton iteration diverged");
+                }
+                if (fabs(step) <= 1e-12 * (1 + fabs(x))) return x;
+            }
+            throw runtime_error("solve: no convergence after " + to_string(MAX_ITERATIONS) + " iterations");
+        } catch (const exception& e) {
+            throw runtime_error(string("Error: ") + e.what());
+        }
+    }
+
+    // Integral of formula f in variable from a to b (adaptive Gauss-Kronrod
+    // on panels spread across all cores; same result for any core count)
+    double integrate(const string& f, const string& variable, double a, double b) {
+        try {
+            return runNumericCommand("integrate", f, variable, a, b);
+        } catch (const exception& e) {
+            throw runtime_error(string("Error: ") + e.what());
+        }
+    }
+
+    // A root of formula f in variable between a and b (the leftmost sign
+    // change found on a grid, refined by safeguarded Newton steps)
+    double root(const string& f, const string& variable, double a, double b) {
+        try {
+            return runNumericCommand("root", f, variable, a, b);
+        } catch (const exception& e) {
+            throw runtime_error(string("Error: ") + e.what());
+        }
+    }
+
+    // Guaranteed bounds on an expression while the variables in ranges vary
+    // over them (others keep their stored values), from one evaluation
+    Interval bound(const string& expression, const map<string, Interval>& ranges) {
+        try {
+            const CompiledExpression& program = compileCached(expression);
+            vector<uint32_t> splitSlots;
+            vector<Interval> box = intervalBox(program, ranges, splitSlots);
+            return program.evaluateInterval(box.data());
+        } catch (const exception& e) {
+            throw runtime_error(string("Error: ") + e.what());
+        }
+    }
+
+    // Bounds on the smallest and largest value of an expression over finite
+    // ranges, tightened by branch and bound until each is within tolerance
+    // (relative to 1 + |value|) or maxBoxes interval evaluations are spent
+    RangeBounds boundRange(const string& expression, const map<string, Interval>& ranges,
+                           double tolerance = 1e-4, size_t maxBoxes = 100000) {
+        try {
+            const CompiledExpression& program = compileCached(expression);
+            vector<uint32_t> splitSlots;
+            vector<Interval> box = intervalBox(program, ranges, splitSlots);
+            for (uint32_t slot : splitSlots) {
+                if (!isfinite(box[slot].lo) || !isfinite(box[slot].hi)) {
+                    throw runtime_error("range: variable ranges must be finite");
+                }
+            }
+            return ::boundRange(program, box, splitSlots, tolerance, maxBoxes);
+        } catch (const exception& e) {
+            throw runtime_error(string("Error: ") + e.what());
+        }
+    }
+
+    // Evaluate an expression over columns of inputs, one result per row.
+    // Variables without a column use their stored value for every row.
+    void evaluateBatch(const string& expression,
+                       const map<string, Span<const double>>& columns,
+                       Span<double> output) {
+        const CompiledExpression& program = compileCached(expression);
+        const vector<string>& names = program.getVariableNames();
+        vector<BatchOperand> bindings(program.getSlotCount());
+
+        for (size_t i = 0; i < names.size(); i++) {
+            uint32_t slot = program.getVariableSlots()[i];
+            auto column = columns.find(names[i]);
+            if (column != columns.end()) {
+                if (column->second.size != output.size) {
+                    throw runtime_error("Column size mismatch for variable: " + names[i]);
+                }
+                bindings[slot].column = column->second.data;
+                bindings[slot].value = 0.0;
+                continue;
+            }
+
+            if (!variables.isDefined(slot)) {
+                throw runtime_error("Undefined variable: " + names[i]);
+            }
+            bindings[slot].column = nullptr;
+            bindings[slot].value = variables.get(slot);
+        }
+
+        program.evaluateBatch(bindings.data(), output, accuracy);
+    }
+
+    // Display all variables
+    void displayVariables() {
+        cout << "\n========================================" << endl;
+        cout << "STORED VARIABLES" << endl;
+        cout << "========================================" << endl;
+
+        vector<uint32_t> slots = variables.definedSlots();
+        if (slots.empty()) {
+            cout << "No variables defined." << endl;
+        } else {
+            for (uint32_t slot : slots) {
+                cout << left << setw(10) << variables.nameOf(slot) << " = "
+                     << fixed << setprecision(6) << variables.get(slot);
+
+                const Formula* formula = formulaOf(slot);
+                if (formula != nullptr) {
+                    cout << "   (=" << formula->expression << ")";
+                }
+                cout << endl;
+            }
+        }
+        for (const auto& entry : functions) {
+            cout << entry.second.definition << endl;
+        }
+        cout << "========================================\n" << endl;
+    }
+
+    // Display calculation history
+    void displayHistory() {
+        cout << "\n========================================" << endl;
+        cout << "CALCULATION HISTORY" << endl;
+        cout << "========================================" << endl;
+
+        history.display();
+        cout << "========================================\n" << endl;
+    }
+
+    // Append history to a file from a background thread, in batches.
+    // An empty path stops streaming.
+    void streamHistory(const string& path) {
+        historyWriter.reset();      // Writes the last batch of the old file
+        if (!path.empty()) {
+            historyWriter.reset(new HistoryWriter(history, path));
+        }
+    }
+
+    // Clear history
+    void clearHistory() {
+        history.clear();
+        cout << "History cleared!" << endl;
+    }
+
+    // Clear variables (except constants)
+    void clearVariables() {
+        uint32_t pi = variables.intern("pi");
+        uint32_t e = variables.intern("e");
+        double pi_value = variables.get(pi);
+        double e_value = variables.get(e);
+        variables.clear();
+        formulas.clear();
+        dependents.clear();
+        image.reset();
+        loadedFormulas.clear();
+        variables.set(pi, pi_value);
+        variables.set(e, e_value);
+        cout << "Variables cleared!" << endl;
+    }
+
+    // Save every variable, formula and function, all as compiled programs
+    void saveSnapshot(const string& path) {
+        try {
+            vector<const Formula*> bySlot(variables.size(), nullptr);
+            for (uint32_t slot = 0; slot < bySlot.size(); slot++) {
+                bySlot[slot] = formulaOf(slot);
+            }
+            writeSnapshot(path, variables, bySlot, functions);
+        } catch (const exception& e) {
+            throw runtime_error("Error: " + string(e.what()));
+        }
+    }
+
+    // Replace all variables, formulas and functions by a saved snapshot. The file is
+    // mapped rather than parsed: values are copied in one block, and names
+    // and formulas are read from it as they are used.
+    void loadSnapshot(const string& path) {
+        try {
+            shared_ptr<const SnapshotImage> loaded = make_shared<SnapshotImage>(path);
+            FunctionTable loadedFunctions;
+            for (size_t i = 0; i < loaded->functionCount(); i++) {
+                string name;
+                UserFunction function;
+                loaded->function(i, name, function.definition, function.parameterCount, function.body);
+                loadedFunctions[name] = move(function);
+            }
+
+            variables.attach(loaded);
+            functions.swap(loadedFunctions);
+            formulas.clear();
+            dependents.clear();
+            loadedFormulas.clear();
+            image = loaded;
+            compiledCache.clear();      // Programs hold slots of the old table
+        } catch (const exception& e) {
+            throw runtime_error("Error: " + string(e.what()));
+        }
+    }
+
+    // Convert one value between two unit symbols
+    double convertUnits(double value, const string& from, const string& to) {
+        try {
+            return units.convert(value, units.indexOf(from), units.indexOf(to));
+        } catch (const exception& e) {
+            throw runtime_error("Error: " + string(e.what()));
+        }
+    }
+
+    // Convert a column of values in one call (output may alias input)
+    void convertUnits(Span<const double> input, Span<double> output,
+                      const string& from, const string& to) {
+        try {
+            units.convert(input, output, units.indexOf(from), units.indexOf(to));
+        } catch (const exception& e) {
+            throw runtime_error("Error: " + string(e.what()));
+        }
+    }
+
+    const UnitRegistry& getUnits() const { return units; }
+
+    // Unit conversion menu
+    void unitConversion() {
+        cout << "\n========================================" << endl;
+        cout << "UNIT CONVERSION" << endl;
+        cout << "========================================" << endl;
+
+        // One line per dimension, in table order
+        vector<string> dimensions;
+        map<string, string> symbols;
+        for (const UnitDefinition& unit : units.getUnits()) {
+            string& line = symbols[unit.dimension];
+            if (line.empty()) {
+                dimensions.push_back(unit.dimension);
+            } else {
+                line += ", ";
+            }
+            line += unit.symbol;
+        }
+        for (const string& dimension : dimensions) {
+            cout << left << setw(13) << dimension + ":" << right << symbols[dimension] << endl;
+        }
+        cout << "========================================" << endl;
+
+        double value;
+        string from, to;
+        cout << "Enter value, from and to units (e.g. 100 C F): ";
+        if (!(cin >> value >> from >> to)) {
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            cout << "Invalid input!" << endl;
+            return;
+        }
+
+        try {
+            double result = convertUnits(value, from, to);
+            cout << value << units.unit(units.indexOf(from)).label << " = "
+                 << result << units.unit(units.indexOf(to)).label << endl;
+        } catch (const exception& e) {
+            cout << e.what() << endl;
+        }
+    }
+
+    // Help display
+    void displayHelp() {
+        cout << "\n========================================" << endl;
+        cout << "CALCULATOR HELP" << endl;
+        cout << "========================================" << endl;
+        cout << "\nOPERATORS:" << endl;
+        cout << "  +    Addition" << endl;
+        cout << "  -    Subtraction" << endl;
+        cout << "  *    Multiplication" << endl;
+        cout << "  /    Division" << endl;
+        cout << "  %    Modulo" << endl;
+        cout << "  ^    Power" << endl;
+
+        cout << "\nFUNCTIONS:" << endl;
+        cout << "  sin(x)   Sine (degrees)" << endl;
+        cout << "  cos(x)   Cosine (degrees)" << endl;
+        cout << "  tan(x)   Tangent (degrees)" << endl;
+        cout << "  log(x)   Base-10 logarithm" << endl;
+        cout << "  ln(x)    Natural logarithm" << endl;
+        cout << "  sqrt(x)  Square root" << endl;
+        cout << "  abs(x)   Absolute value" << endl;
+        cout << "  exp(x)   e^x" << endl;
+
+        cout << "\nCONSTANTS:" << endl;
+        cout << "  pi       3.14159..." << endl;
+        cout << "  e        2.71828..." << endl;
+
+        cout << "\nVARIABLES:" << endl;
+        cout << "  x = 5        Assign value to variable" << endl;
+        cout << "  y = x * 2    Use variables in expressions" << endl;
+        cout << "               (y is recomputed whenever x changes)" << endl;
+
+        cout << "\nUSER FUNCTIONS:" << endl;
+        cout << "  hyp(a, b) = sqrt(a^2 + b^2)   Define a function" << endl;
+        cout << "  hyp(3, 4)                     Call it (inlined when compiled)" << endl;
+
+        cout << "\nNUMERICAL (f is a formula in x):" << endl;
+        cout << "  integrate(f, a, b)   Integral of f from a to b" << endl;
+        cout << "  root(f, a, b)        Where f = 0 between a and b" << endl;
+        cout << "  integrate(f, t, a, b)  The same with f a formula in t" << endl;
+        cout << "  d = integrate(x^2, 0, y)   d is recomputed whenever y changes" << endl;
+
+        cout << "\nACCURACY (menu option 12):" << endl;
+        cout << "  exact    libm for sin, cos, tan, log, ln, exp" << endl;
+        cout << "  ulp      Polynomials within about 1 ulp, faster" << endl;
+        cout << "  fast     Relative error below 1e-7, fastest" << endl;
+
+        cout << "\nSOLVER (menu option 9):" << endl;
+        cout << "  x^2 = 2      Newton's method from a starting guess" << endl;
+        cout << "               (derivatives are exact, not estimated)" << endl;
+
+        cout << "\nEXAMPLES:" << endl;
+        cout << "  2 + 3 * 4" << endl;
+        cout << "  (2 + 3) * 4" << endl;
+        cout << "  sqrt(16) + log(100)" << endl;
+        cout << "  sin(30) + cos(60)" << endl;
+        cout << "  2 ^ 8" << endl;
+        cout << "  x = 10" << endl;
+        cout << "  y = x * pi" << endl;
+        cout << "========================================\n" << endl;
+    }
+};
+
+// ========================================
+// EXPRESSION SERVER
+// Headless mode evaluating requests from
+// many clients on a thread pool
+// ========================================
+// VARIABLE_BLOCK slots of a published variable table
+struct VariableBlock {
+    uint64_t writes;                        // VariableTable::writesTo the block when copied
+    double values[VARIABLE_BLOCK];
+    char defined[VARIABLE_BLOCK];
+    shared_ptr<const vector<string>> names; // Shared until a slot is added to the block
+};
+
+// Variables as of one assignment. Readers keep the snapshot they started
+// with, so an assignment never blocks or changes an evaluation in flight.
+// Blocks no assignment wrote since the previous snapshot are shared with it.
+struct VariableSnapshot {
+    uint64_t version;
+    uint32_t slotCount;
+    vector<shared_ptr<const VariableBlock>> blocks;
+    shared_ptr<const FunctionTable> functions;  // Shared until a function is defined
+    MathAccuracy accuracy;
+
+    // Read like a VariableTable by ScientificCalculator::syncVariables
+    size_t size() const { return slotCount; }
+    bool isDefined(uint32_t slot) const {
+        return blocks[slot / VARIABLE_BLOCK]->defined[slot % VARIABLE_BLOCK] != 0;
+    }
+    double get(uint32_t slot) const { return blocks[slot / VARIABLE_BLOCK]->values[slot % VARIABLE_BLOCK]; }
+    string_view nameOf(uint32_t slot) const {
+        return (*blocks[slot / VARIABLE_BLOCK]->names)[slot % VARIABLE_BLOCK];
+    }
+};
+
+class ExpressionServer {
+private:
+    // One queued evaluation and the variables it must see
+    struct Job {
+        string expression;
+        shared_ptr<const VariableSnapshot> snapshot;
+        promise<string> response;
+    };
+
+    // Per-thread calculator, so compiled programs are cached without locks
+    struct Worker {
+        ScientificCalculator calc;
+        shared_ptr<const VariableSnapshot> snapshot;    // Last one synced
+        shared_ptr<const FunctionTable> functions;      // Last functions synced
+        vector<uint32_t> slotMap;                       // Snapshot slot -> calc slot
+    };
+
+    ScientificCalculator master;                    // Owns formulas; assignments only
+    mutex masterMutex;                              // Serializes assignments
+    shared_ptr<const VariableSnapshot> current;     // Read with atomic_load
+
+    deque<Job> jobs;
+    mutex jobsMutex;
+    condition_variable jobsReady;
+    bool stopping;
+    vector<thread> threads;
+
+    mutex clientsMutex;                             // Socket clients being served
+    condition_variable clientsDone;
+    size_t clientCount;
+
+    static string formatResult(double value) {
+        stringstream ss;
+        ss << setprecision(15) << value;
+        return ss.str();
+    }
+
+    // Copy one block of the master's variables. Names are kept from the
+    // previous copy unless slots were added (or the table was replaced).
+    shared_ptr<const VariableBlock> copyBlock(size_t block, const VariableBlock* previous,
+                                              bool renamed) {
+        const VariableTable& table = master.getVariables();
+        uint32_t begin = static_cast<uint32_t>(block * VARIABLE_BLOCK);
+        uint32_t count = static_cast<uint32_t>(min<size_t>(VARIABLE_BLOCK, table.size() - begin));
+
+        shared_ptr<VariableBlock> copy = make_shared<VariableBlock>();
+        copy->writes = table.writesTo(block);
+        for (uint32_t i = 0; i < count; i++) {
+            copy->values[i] = table.get(begin + i);
+            copy->defined[i] = table.isDefined(begin + i);
+        }
+        if (previous && !renamed && previous->names->size() == count) {
+            copy->names = previous->names;
+        } else {
+            vector<string> names;
+            names.reserve(count);
+            for (uint32_t i = 0; i < count; i++) {
+                names.emplace_back(table.nameOf(begin + i));
+            }
+            copy->names = make_shared<const vector<string>>(move(names));
+        }
+        return copy;
+    }
+
+    // Publish the master's variables (and its functions, if they changed),
+    // copying only the blocks written since the last publish. After a
+    // snapshot is loaded every slot may have a new name.
+    void publish(bool functionsChanged, bool renamed = false) {
+        const VariableTable& table = master.getVariables();
+        shared_ptr<VariableSnapshot> next = make_shared<VariableSnapshot>();
+        next->version = current->version + 1;
+        next->slotCount = static_cast<uint32_t>(table.size());
+        next->blocks.resize((table.size() + VARIABLE_BLOCK - 1) / VARIABLE_BLOCK);
+        for (size_t block = 0; block < next->blocks.size(); block++) {
+            const VariableBlock* previous =
+                block < current->blocks.size() ? current->blocks[block].get() : nullptr;
+            if (previous && !renamed && previous->writes == table.writesTo(block)) {
+                next->blocks[block] = current->blocks[block];
+            } else {
+                next->blocks[block] = copyBlock(block, previous, renamed);
+            }
+        }
+        next->functions = functionsChanged ? make_shared<FunctionTable>(master.getFunctions())
+                                           : current->functions;
+        next->accuracy = master.getAccuracy();
+        atomic_store(&current, shared_ptr<const VariableSnapshot>(next));
+    }
+
+    // Bring a worker's calculator up to a snapshot, copying only the
+    // blocks that differ from the one it last synced
+    static void syncWorker(Worker& worker, const shared_ptr<const VariableSnapshot>& snapshot) {
+        for (size_t block = 0; block < snapshot->blocks.size(); block++) {
+            if (worker.snapshot && block < worker.snapshot->blocks.size() &&
+                worker.snapshot->blocks[block] == snapshot->blocks[block]) {
+                continue;
+            }
+            uint32_t begin = static_cast<uint32_t>(block * VARIABLE_BLOCK);
+            worker.calc.syncVariables(*snapshot, worker.slotMap, begin, begin + VARIABLE_BLOCK);
+        }
+        if (snapshot->functions != worker.functions) {
+            worker.calc.syncFunctions(*snapshot->functions, *snapshot, worker.slotMap);
+            worker.functions = snapshot->functions;
+        }
+        worker.calc.setAccuracy(snapshot->accuracy);
+        worker.snapshot = snapshot;
+    }
+
+    // Apply an assignment or function definition to the master calculator
+    // and publish the result
+    string assign(const string& request) {
+        lock_guard<mutex> lock(masterMutex);
+        try {
+            if (ScientificCalculator::isFunctionDefinition(request)) {
+                master.defineFunction(request);
+                publish(true);
+                string head = request.substr(0, request.find('='));
+                return "Defined " + head.substr(0, head.find_last_not_of(" \t") + 1);
+            }
+
+            double value = master.calculate(request);
+            publish(false);
+
+            string name = request.substr(0, request.find('='));
+            name.erase(remove_if(name.begin(), name.end(), ::isspace), name.end());
+            return name + " = " + formatResult(value);
+        } catch (const exception& e) {
+            return e.what();
+        }
+    }
+
+    void workerLoop() {
+        Worker worker;
+        while (true) {
+            Job job;
+            {
+                unique_lock<mutex> lock(jobsMutex);
+                jobsReady.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (jobs.empty()) return;   // Stopping and drained
+                job = move(jobs.front());
+                jobs.pop_front();
+            }
+
+            if (job.snapshot != worker.snapshot) {
+                syncWorker(worker, job.snapshot);
+            }
+            try {
+                job.response.set_value(formatResult(worker.calc.evaluate(job.expression)));
+            } catch (const exception& e) {
+                job.response.set_value(e.what());
+            }
+        }
+    }
+
+    // Read requests until readLine fails and write each response in request
+    // order. Responses are written by a second thread, so a slow request
+    // does not stop later ones from being read and queued.
+    template <typename ReadLine, typename WriteLine>
+    void serveLines(ReadLine readLine, WriteLine writeLine) {
+        deque<future<string>> pending;
+        mutex pendingMutex;
+        condition_variable pendingReady;
+        bool done = false;
+
+        thread writer([&] {
+            while (true) {
+                future<string> next;
+                {
+                    unique_lock<mutex> lock(pendingMutex);
+                    pendingReady.wait(lock, [&] { return done || !pending.empty(); });
+                    if (pending.empty()) return;
+                    next = move(pending.front());
+                    pending.pop_front();
+                }
+                string response = next.get();
+                bool idle;
+                {
+                    lock_guard<mutex> lock(pendingMutex);
+                    idle = pending.empty();
+                }
+                writeLine(response, idle);  // Flush only when caught up
+            }
+        });
+
+        string line;
+        while (readLine(line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty()) continue;
+            future<string> response = submit(line);
+            {
+                lock_guard<mutex> lock(pendingMutex);
+                pending.push_back(move(response));
+            }
+            pendingReady.notify_one();
+        }
+
+        {
+            lock_guard<mutex> lock(pendingMutex);
+            done = true;
+        }
+        pendingReady.notify_one();
+        writer.join();
+    }
+
+#ifdef __unix__
+    // Serve one socket client until it disconnects
+    void serveConnection(int fd) {
+        string buffer;
+        char chunk[4096];
+
+        auto readLine = [&](string& line) {
+            size_t newline;
+            while ((newline = buffer.find('\n')) == string::npos) {
+                ssize_t n = read(fd, chunk, sizeof(chunk));
+                if (n <= 0) {
+                    if (buffer.empty()) return false;
+                    line.swap(buffer);  // Last line without a newline
+                    buffer.clear();
+                    return true;
+                }
+                buffer.append(chunk, n);
+            }
+            line.assign(buffer, 0, newline);
+            buffer.erase(0, newline + 1);
+            return true;
+        };
+
+        auto writeLine = [&](const string& response, bool) {
+            string text = response + "\n";
+            size_t written = 0;
+            while (written < text.size()) {
+                // A closed client must not raise SIGPIPE, which would end the server
+                ssize_t n = send(fd, text.data() + written, text.size() - written, MSG_NOSIGNAL);
+                if (n <= 0) return;     // Client went away
+                written += n;
+            }
+        };
+
+        serveLines(readLine, writeLine);
+        close(fd);
+    }
+#endif
+
+public:
+    explicit ExpressionServer(size_t threadCount) : stopping(false), clientCount(0) {
+        master.setEcho(false);
+        shared_ptr<VariableSnapshot> initial = make_shared<VariableSnapshot>();
+        initial->version = 0;
+        initial->slotCount = 0;
+        initial->functions = make_shared<FunctionTable>();
+        initial->accuracy = ACCURACY_EXACT;
+        current = initial;
+        publish(false);
+
+        for (size_t i = 0; i < max<size_t>(threadCount, 1); i++) {
+            threads.emplace_back(&ExpressionServer::workerLoop, this);
+        }
+    }
+
+    // Finishes queued requests before returning
+    ~ExpressionServer() {
+        {
+            lock_guard<mutex> lock(jobsMutex);
+            stopping = true;
+        }
+        jobsReady.notify_all();
+        for (thread& t : threads) {
+            t.join();
+        }
+    }
+
+    size_t getThreadCount() const { return threads.size(); }
+
+    // Start from a saved snapshot. Call before serving: workers map the
+    // variables they have already seen by slot.
+    void loadSnapshot(const string& path) {
+        lock_guard<mutex> lock(masterMutex);
+        master.loadSnapshot(path);
+        publish(true, true);
+    }
+
+    // Accuracy tier of every evaluation from now on
+    void setAccuracy(MathAccuracy tier) {
+        lock_guard<mutex> lock(masterMutex);
+        master.setAccuracy(tier);
+        publish(false);
+    }
+
+    // Queue one request. An assignment is applied before this returns, so
+    // requests submitted after it see the new value and earlier ones do not.
+    future<string> submit(const string& request) {
+        if (request.find('=') != string::npos) {
+            promise<string> response;
+            response.set_value(assign(request));
+            return response.get_future();
+        }
+
+        Job job;
+        job.expression = request;
+        job.snapshot = atomic_load(&current);
+        future<string> response = job.response.get_future();
+        {
+            lock_guard<mutex> lock(jobsMutex);
+            jobs.push_back(move(job));
+        }
+        jobsReady.notify_one();
+        return response;
+    }
+
+    // One request per line on in, one response per line on out
+    void serve(istream& in, ostream& out) {
+        serveLines([&](string& line) { return static_cast<bool>(getline(in, line)); },
+                   [&](const string& response, bool flush) {
+                       out << response << '\n';
+                       if (flush) out.flush();
+                   });
+    }
+
+#ifdef __unix__
+    // Accept clients on a Unix domain socket, each served on its own
+    // detached thread; returns once every client has disconnected
+    void serveSocket(const string& path) {
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0) {
+            throw runtime_error("Cannot create socket: " + string(strerror(errno)));
+        }
+
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            close(listener);
+            throw runtime_error("Socket path too long: " + path);
+        }
+        strcpy(address.sun_path, path.c_str());
+        unlink(path.c_str());
+
+        if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+            listen(listener, 16) < 0) {
+            string reason = strerror(errno);
+            close(listener);
+            throw runtime_error("Cannot listen on " + path + ": " + reason);
+        }
+
+        while (true) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            {
+                lock_guard<mutex> lock(clientsMutex);
+                clientCount++;
+            }
+            thread([this, fd] {
+                serveConnection(fd);
+                lock_guard<mutex> lock(clientsMutex);
+                clientCount--;
+                clientsDone.notify_all();
+            }).detach();
+        }
+        close(listener);
+
+        unique_lock<mutex> lock(clientsMutex);
+        clientsDone.wait(lock, [&] { return clientCount == 0; });
+    }
+#endif
+};
+
+// ========================================
+// BATCH MODE
+// Evaluates a file of expressions with
+// pipelined parse and evaluate stages
+// ========================================
+struct BatchStats {
+    size_t lines;
+    size_t assignments;
+    size_t errors;
+    double seconds;
+};
+
+// Parser threads compile chunks of lines ahead while one evaluator thread
+// runs them in file order, since any assignment can change the inputs of
+// every later line. Results are written one line per input line.
+class BatchProcessor {
+private:
+    enum LineKind { BLANK, EXPRESSION, ASSIGNMENT, DEFERRED };
+
+    struct ParsedLine {
+        LineKind kind;
+        string_view text;
+        string name;                // ASSIGNMENT: target variable
+        string expression;          // ASSIGNMENT: right-hand side
+        CompiledExpression program;
+    };
+
+    // About CHUNK_BYTES of whole lines, parsed by one thread
+    struct Chunk {
+        const char* begin;
+        const char* end;
+        size_t parser;              // Index of the thread that parsed it
+        vector<ParsedLine> lines;
+        bool ready;
+    };
+
+    static constexpr size_t CHUNK_BYTES = 64 * 1024;
+
+    size_t parserCount;
+    vector<Chunk> chunks;
+    size_t nextChunk;               // Next chunk to hand to a parser
+    size_t evaluatedChunks;
+    mutex chunksMutex;
+    condition_variable chunkParsed;
+    condition_variable chunkEvaluated;
+
+    // Split the input into chunks ending at line breaks
+    void splitChunks(const char* data, size_t size) {
+        const char* end = data + size;
+        const char* begin = data;
+        while (begin < end) {
+            const char* stop = begin + min(CHUNK_BYTES, static_cast<size_t>(end - begin));
+            if (stop < end) {
+                const void* newline = memchr(stop, '\n', end - stop);
+                stop = newline ? static_cast<const char*>(newline) + 1 : end;
+            }
+            Chunk chunk = { begin, stop, 0, {}, false };
+            chunks.push_back(move(chunk));
+            begin = stop;
+        }
+    }
+
+    // Compile through the parser thread's own cache (files repeat formulas)
+    static const CompiledExpression& compileCached(ScientificCalculator& parser, ExpressionCache& cache,
+                                                   const string& text) {
+        const CompiledExpression* program = cache.find(text);
+        if (program == nullptr) {
+            program = cache.insert(text, parser.compile(text));
+        }
+        return *program;
+    }
+
+    static void parseLine(ScientificCalculator& parser, ExpressionCache& cache,
+                          string_view text, ParsedLine& line) {
+        line.text = text;
+        if (text.find_first_not_of(" \t") == string_view::npos) {
+            line.kind = BLANK;
+            return;
+        }
+        // Function definitions change the calculator, so run the whole
+        // line later
+        if (ScientificCalculator::isFunctionDefinition(string(text))) {
+            line.kind = DEFERRED;
+            return;
+        }
+
+        try {
+            size_t equalPos = text.find('=');
+            if (equalPos == string_view::npos) {
+                line.kind = EXPRESSION;
+                line.program = compileCached(parser, cache, string(text));
+                return;
+            }
+            line.kind = ASSIGNMENT;
+            line.name = string(text.substr(0, equalPos));
+            line.name.erase(remove_if(line.name.begin(), line.name.end(), ::isspace), line.name.end());
+            line.expression = string(text.substr(equalPos + 1));
+            line.program = compileCached(parser, cache, line.expression);
+        } catch (const exception&) {
+            // Parsers do not know the functions defined earlier in the file,
+            // so the line is compiled again in order (and fails there if it
+            // really is invalid)
+            line.kind = DEFERRED;
+        }
+    }
+
+    void parserLoop(size_t index) {
+        ScientificCalculator parser;
+        ExpressionCache cache;
+        while (true) {
+            Chunk* chunk;
+            {
+                // Stay a bounded distance ahead of the evaluator
+                unique_lock<mutex> lock(chunksMutex);
+                chunkEvaluated.wait(lock, [&] {
+                    return nextChunk >= chunks.size() || nextChunk < evaluatedChunks + 4 * parserCount;
+                });
+                if (nextChunk >= chunks.size()) return;
+                chunk = &chunks[nextChunk++];
+            }
+
+            const char* p = chunk->begin;
+            while (p < chunk->end) {
+                const char* newline = static_cast<const char*>(memchr(p, '\n', chunk->end - p));
+                const char* stop = newline ? newline : chunk->end;
+                size_t length = stop - p;
+                if (length > 0 && p[length - 1] == '\r') length--;
+
+                chunk->lines.emplace_back();
+                parseLine(parser, cache, string_view(p, length), chunk->lines.back());
+                p = stop + 1;
+            }
+
+            {
+                lock_guard<mutex> lock(chunksMutex);
+                chunk->parser = index;
+                chunk->ready = true;
+            }
+            chunkParsed.notify_all();
+        }
+    }
+
+    static void appendNumber(string& out, double value) {
+        char text[32];
+        to_chars_result written = to_chars(text, text + sizeof(text), value, chars_format::general, 15);
+        out.append(text, written.ptr);
+    }
+
+public:
+    explicit BatchProcessor(size_t parsers)
+        : parserCount(max<size_t>(parsers, 1)), nextChunk(0), evaluatedChunks(0) {}
+
+    // Evaluate every line of data with calc, writing results to out
+    BatchStats run(ScientificCalculator& calc, const char* data, size_t size, ostream& out) {
+        BatchStats stats = { 0, 0, 0, 0.0 };
+        auto start = chrono::steady_clock::now();
+
+        chunks.clear();
+        nextChunk = 0;
+        evaluatedChunks = 0;
+        splitChunks(data, size);
+
+        vector<thread> parsers;
+        for (size_t i = 0; i < parserCount; i++) {
+            parsers.emplace_back(&BatchProcessor::parserLoop, this, i);
+        }
+
+        vector<vector<uint32_t>> slotMaps(parserCount);    // Per parser: its slots -> calc's
+        string output;
+        for (size_t c = 0; c < chunks.size(); c++) {
+            Chunk& chunk = chunks[c];
+            {
+                unique_lock<mutex> lock(chunksMutex);
+                chunkParsed.wait(lock, [&] { return chunk.ready; });
+            }
+
+            output.clear();
+            for (ParsedLine& line : chunk.lines) {
+                stats.lines++;
+                try {
+                    switch (line.kind) {
+                        case BLANK:
+                            break;
+
+                        case EXPRESSION:
+                            calc.adoptProgram(line.program, slotMaps[chunk.parser]);
+                            appendNumber(output, calc.evaluateProgram(line.program));
+                            break;
+
+                        case ASSIGNMENT: {
+                            calc.adoptProgram(line.program, slotMaps[chunk.parser]);
+                            double value = calc.assignProgram(line.name, line.expression, line.program);
+                            stats.assignments++;
+                            output += line.name;
+                            output += " = ";
+                            appendNumber(output, value);
+                            break;
+                        }
+
+                        case DEFERRED: {
+                            string text(line.text);
+                            if (ScientificCalculator::isFunctionDefinition(text)) {
+                                calc.defineFunction(text);
+                                string head = text.substr(0, text.find('='));
+                                output += "Defined " + head.substr(0, head.find_last_not_of(" \t") + 1);
+                                break;
+                            }
+                            double value = calc.calculate(text);
+                            size_t equalPos = text.find('=');
+                            if (equalPos != string::npos) {
+                                string name = text.substr(0, equalPos);
+                                name.erase(remove_if(name.begin(), name.end(), ::isspace), name.end());
+                                stats.assignments++;
+                                output += name;
+                                output += " = ";
+                            }
+                            appendNumber(output, value);
+                            break;
+                        }
+                    }
+                } catch (const exception& e) {
+                    stats.errors++;
+                    output += e.what();
+                }
+                output += '\n';
+            }
+            out.write(output.data(), output.size());
+
+            {
+                lock_guard<mutex> lock(chunksMutex);
+                vector<ParsedLine>().swap(chunk.lines);     // Free the programs
+                evaluatedChunks = c + 1;
+            }
+            chunkEvaluated.notify_all();
+        }
+
+        for (thread& parser : parsers) {
+            parser.join();
+        }
+        out.flush();
+        stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return stats;
+    }
+};
+
+// ========================================
+// BENCHMARKS
+// Run with: calculator --bench
+// ========================================
+
+// Expressions from the TESTING SUGGESTIONS block
+const char* BENCHMARK_EXPRESSIONS[] = {
+    "2 + 3 * 4", "(2 + 3) * 4", "10 / 3", "2 ^ 8",
+    "sqrt(16)", "sin(30)", "log(100)", "abs(5)",
+    "sqrt(x^2 + y^2)", "(sin(45) + cos(45)) * sqrt(2)", "log(100) + ln(e^2)"
+};
+
+// Seconds elapsed since start
+double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Set when a benchmark's results are wrong; --bench then exits with 1
+bool benchmarkFailed = false;
+
+void benchmarkCheck(bool passed, const string& what) {
+    if (passed) return;
+    cout << "FAILED: " << what << endl;
+    benchmarkFailed = true;
+}
+
+// Variable values indexed by slot, with x = 10 and y = 20
+vector<double> benchmarkValues(ScientificCalculator& calc) {
+    uint32_t x = calc.variableSlot("x");
+    uint32_t y = calc.variableSlot("y");
+    const VariableTable& table = calc.getVariables();
+    vector<double> values(table.data(), table.data() + table.size());
+    values[x] = 10;
+    values[y] = 20;
+    return values;
+}
+
+// Letters-only variable name for an index (va, vb, ..., vz, vba, ...)
+string benchmarkVariableName(size_t index) {
+    string name;
+    do {
+        name.insert(name.begin(), static_cast<char>('a' + index % 26));
+        index /= 26;
+    } while (index > 0);
+    return "v" + name;
+}
+
+// Per-instruction cost of the compiled-program interpreter
+void benchmarkEvaluation() {
+    ScientificCalculator calc;
+    vector<double> values = benchmarkValues(calc);
+    const size_t ITERATIONS = 2000000;
+    double totalSeconds = 0;
+    size_t totalInstructions = 0;
+
+    cout << "\n--- Evaluation (" << ITERATIONS << " runs each) ---" << endl;
+    for (const char* expression : BENCHMARK_EXPRESSIONS) {
+        CompiledExpression program = calc.compile(expression);
+
+        volatile double sink = 0;
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < ITERATIONS; i++) {
+            sink = sink + program.evaluate(values.data());
+        }
+        double seconds = secondsSince(start);
+
+        size_t instructions = program.getCode().size();
+        cout << left << setw(32) << expression << right
+             << setw(4) << instructions << " instr "
+             << fixed << setprecision(1) << setw(8) << seconds * 1e9 / ITERATIONS << " ns/eval "
+             << setprecision(2) << setw(7) << seconds * 1e9 / (ITERATIONS * instructions) << " ns/instr" << endl;
+
+        totalSeconds += seconds;
+        totalInstructions += instructions * ITERATIONS;
+    }
+    cout << "Mean: " << fixed << setprecision(2) << totalSeconds * 1e9 / totalInstructions
+         << " ns per instruction" << endl;
+}
+
+// Cost of compiling (tokenize + parse + lower) a long expression
+void benchmarkCompilation() {
+    ScientificCalculator calc;
+    string expression;
+    while (expression.size() < 200) {
+        expression += "sqrt(x^2 + 1.5e-3 * y) - sin(30) / 2.25 + ";
+    }
+    expression += "1";
+
+    const size_t ITERATIONS = 200000;
+    volatile size_t sink = 0;
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < ITERATIONS; i++) {
+        sink = sink + calc.compile(expression).getCode().size();
+    }
+    double seconds = secondsSince(start);
+
+    cout << "\n--- Compilation (" << expression.size() << "-char expression) ---" << endl;
+    cout << fixed << setprecision(1) << seconds * 1e9 / ITERATIONS << " ns/compile, "
+         << setprecision(2) << seconds * 1e9 / (ITERATIONS * expression.size()) << " ns/char" << endl;
+}
+
+// Native node tree versus the bytecode interpreter
+void benchmarkNativeBackend() {
+    ScientificCalculator calc;
+    vector<double> values = benchmarkValues(calc);
+    const size_t ITERATIONS = 2000000;
+
+    cout << "\n--- Native backend vs interpreter (ns/eval) ---" << endl;
+    for (const char* expression : BENCHMARK_EXPRESSIONS) {
+        CompiledExpression program = calc.compile(expression);
+        NativeExpression native = calc.compileNative(expression);
+
+        volatile double sink = 0;
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < ITERATIONS; i++) {
+            sink = sink + program.evaluate(values.data());
+        }
+        double interpreted = secondsSince(start);
+
+        start = chrono::steady_clock::now();
+        for (size_t i = 0; i < ITERATIONS; i++) {
+            sink = sink + native(values.data());
+        }
+        double compiled = secondsSince(start);
+
+        cout << left << setw(32) << expression << right << fixed << setprecision(1)
+             << " interpreter " << setw(6) << interpreted * 1e9 / ITERATIONS
+             << "  native " << setw(6) << compiled * 1e9 / ITERATIONS
+             << "  (" << setprecision(2) << interpreted / compiled << "x)" << endl;
+    }
+}
+
+// Program size and speed before/after constant folding and CSE
+void benchmarkOptimizer() {
+    ScientificCalculator calc;
+    const char* expressions[] = {
+        "sin(30) * x + sin(30) * y + pi * 2",
+        "sqrt(x^2 + y^2) / (1 + sqrt(x^2 + y^2))",
+        "(x + y) * (x + y) - (y + x) * 2 + log(100)"
+    };
+    const size_t ITERATIONS = 2000000;
+    vector<double> values = benchmarkValues(calc);
+
+    cout << "\n--- Optimizer (instructions before -> after) ---" << endl;
+    for (const char* expression : expressions) {
+        CompiledExpression program = calc.compile(expression);
+        const OptimizationStats& stats = program.getOptimizationStats();
+
+        volatile double sink = 0;
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < ITERATIONS; i++) {
+            sink = sink + program.evaluate(values.data());
+        }
+        double seconds = secondsSince(start);
+
+        cout << left << setw(44) << expression << right
+             << setw(3) << stats.instructionsBefore << " -> " << setw(2) << stats.instructionsAfter
+             << "  folded " << stats.constantsFolded << ", shared " << stats.subexpressionsShared
+             << ", " << fixed << setprecision(1) << seconds * 1e9 / ITERATIONS << " ns/eval" << endl;
+    }
+}
+
+// Dual-number gradient versus central differences (two extra evaluations
+// per variable), with the error of the differences against the exact value
+void benchmarkGradient() {
+    ScientificCalculator calc;
+    vector<double> values = benchmarkValues(calc);
+    const char* expressions[] = {
+        "sqrt(x^2 + y^2)",
+        "sin(x) * cos(y) + ln(x * y)",
+        "exp(x / 10) / (1 + y^3) + x ^ (y / 20)"
+    };
+    const size_t ITERATIONS = 1000000;
+
+    cout << "\n--- Gradient: dual numbers vs central differences ---" << endl;
+    for (const char* expression : expressions) {
+        CompiledExpression program = calc.compile(expression);
+        const vector<uint32_t>& slots = program.getVariableSlots();
+        vector<double> exact(slots.size()), estimate(slots.size());
+
+        volatile double sink = 0;
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < ITERATIONS; i++) {
+            sink = sink + program.evaluateGradient(values.data(), exact.data());
+        }
+        double dual = secondsSince(start);
+
+        const double h = 1e-6;
+        start = chrono::steady_clock::now();
+        for (size_t i = 0; i < ITERATIONS; i++) {
+            sink = sink + program.evaluate(values.data());
+            for (size_t v = 0; v < slots.size(); v++) {
+                double saved = values[slots[v]];
+                values[slots[v]] = saved + h;
+                double above = program.evaluate(values.data());
+                values[slots[v]] = saved - h;
+                double below = program.evaluate(values.data());
+                values[slots[v]] = saved;
+                estimate[v] = (above - below) / (2 * h);
+            }
+        }
+        double differences = secondsSince(start);
+
+        double worst = 0;
+        for (size_t v = 0; v < slots.size(); v++) {
+            worst = max(worst, fabs(estimate[v] - exact[v]) / max(1.0, fabs(exact[v])));
+        }
+        cout << left << setw(40) << expression << right << fixed << setprecision(1)
+             << " dual " << setw(6) << dual * 1e9 / ITERATIONS << " ns"
+             << "  differences " << setw(6) << differences * 1e9 / ITERATIONS << " ns"
+             << "  (error " << scientific << setprecision(1) << worst << ")" << endl;
+    }
+}
+
+// integrate()/root() versus scripting the same work as calculate() calls
+void benchmarkNumerical() {
+    ScientificCalculator calc;
+    calc.setEcho(false);
+    const char* commands[] = {
+        "integrate(sin(x) * x, 0, 36000)",
+        "integrate(sqrt(x) * exp(0 - x / 100), 0, 1000)",
+        "root(x^3 - 5 * x - 7, 0, 10)"
+    };
+    const size_t RUNS = 20;
+
+    cout << "\n--- Integration and root finding (" << max(thread::hardware_concurrency(), 1u)
+         << " threads) ---" << endl;
+    for (const char* command : commands) {
+        volatile double sink = 0;
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < RUNS; i++) {
+            sink = sink + calc.calculate(command);
+        }
+        double seconds = secondsSince(start) / RUNS;
+        cout << left << setw(48) << command << right << fixed << setprecision(3)
+             << setw(9) << seconds * 1e3 << " ms  = " << setprecision(6) << sink / RUNS << endl;
+    }
+
+    // Composite Simpson rule driven by one assignment and one calculate()
+    // per sample, as scripts did before
+    const size_t SAMPLES = 100000;
+    const double a = 0, b = 36000;
+    double h = (b - a) / SAMPLES;
+    double sum = 0;
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i <= SAMPLES; i++) {
+        stringstream assignment;
+        assignment << "x = " << setprecision(17) << a + h * i;
+        calc.calculate(assignment.str());
+        double weight = (i == 0 || i == SAMPLES) ? 1 : (i % 2 == 1 ? 4 : 2);
+        sum += weight * calc.calculate("sin(x) * x");
+    }
+    double seconds = secondsSince(start);
+    cout << "Scripted Simpson, " << SAMPLES << " samples: " << fixed << setprecision(1)
+         << seconds * 1e3 << " ms (" << seconds * 1e4 << " ms per 1e6 samples) = "
+         << setprecision(6) << sum * h / 3 << endl;
+    // A formula calling integrate() keeps its compiled call when its
+    // input changes, so an update costs the integration only
+    const size_t UPDATES = 200;
+    calc.calculate("upper = 1");
+    calc.calculate("area = integrate(x^2, 0, upper)");
+    start = chrono::steady_clock::now();
+    bool exact = true;
+    for (size_t i = 1; i <= UPDATES; i++) {
+        calc.calculate("upper = " + to_string(i));
+        double expected = i * i * static_cast<double>(i) / 3;
+        exact = exact && fabs(calc.evaluate("area") - expected) <= 1e-9 * expected;
+    }
+    seconds = secondsSince(start) / UPDATES;
+    cout << "area = integrate(x^2, 0, upper), per update of upper: " << fixed << setprecision(3)
+         << seconds * 1e3 << " ms" << endl;
+    benchmarkCheck(exact, "area follows upper");
+}
+
+// Startup with many saved definitions: re-issuing every assignment versus
+// loading a snapshot and using a formula from it
+void benchmarkSnapshot() {
+    const size_t COUNTS[] = { 1000, 4000, 16000 };
+    const string path = "calculator_bench.snap";
+
+    cout << "\n--- Startup with N definitions (half formulas) ---" << endl;
+    cout << left << setw(8) << "N" << right << setw(14) << "replay ms" << setw(14) << "load ms"
+         << setw(16) << "first use ms" << setw(12) << "file KB" << endl;
+    for (size_t count : COUNTS) {
+        vector<string> assignments;
+        for (size_t i = 0; i < count / 2; i++) {
+            string name = benchmarkVariableName(i);
+            assignments.push_back(name + " = " + to_string(i));
+            assignments.push_back("f" + name + " = " + name + " * 2 + " + benchmarkVariableName(i / 2));
+        }
+
+        ScientificCalculator replayed;
+        replayed.setEcho(false);
+        auto start = chrono::steady_clock::now();
+        for (const string& assignment : assignments) {
+            replayed.calculate(assignment);
+        }
+        double replay = secondsSince(start);
+        replayed.saveSnapshot(path);
+
+        ScientificCalculator loaded;
+        loaded.setEcho(false);
+        start = chrono::steady_clock::now();
+        loaded.loadSnapshot(path);
+        double load = secondsSince(start);
+
+        // Reassigning an input rebuilds just the formulas that read it
+        string name = benchmarkVariableName(count / 4);
+        start = chrono::steady_clock::now();
+        loaded.calculate(name + " = 1");
+        double value = loaded.evaluate("f" + name);
+        double firstUse = secondsSince(start);
+
+        replayed.calculate(name + " = 1");
+        if (value != replayed.evaluate("f" + name)) {
+            cout << "Snapshot result differs for f" << name << endl;
+        }
+
+        cout << left << setw(8) << count << right << fixed << setprecision(3)
+             << setw(14) << replay * 1e3 << setw(14) << load * 1e3 << setw(16) << firstUse * 1e3
+             << setprecision(0) << setw(12) << MappedFile(path).size() / 1024.0 << endl;
+    }
+    remove(path.c_str());
+}
+
+// Range of formulas over a box of x and y: sampling a grid (batch
+// evaluation) versus one interval evaluation and branch and bound
+void benchmarkIntervals() {
+    ScientificCalculator calc;
+    calc.setEcho(false);
+    const char* expressions[] = {
+        "x * y - x^2 + 3 * y",
+        "sin(x) * cos(y) + x / 100",
+        "sqrt(x^2 + y^2) * exp(0 - y / 50)",
+        "(x - 3)^2 * (y + 1) - ln(x + y)"
+    };
+    const Interval X = { 1, 90 };
+    const Interval Y = { 0.5, 40 };
+    const size_t GRID = 1000;
+
+    vector<double> xs(GRID * GRID), ys(GRID * GRID), results(GRID * GRID);
+    for (size_t i = 0; i < GRID; i++) {
+        for (size_t j = 0; j < GRID; j++) {
+            xs[i * GRID + j] = X.lo + (X.hi - X.lo) * i / (GRID - 1);
+            ys[i * GRID + j] = Y.lo + (Y.hi - Y.lo) * j / (GRID - 1);
+        }
+    }
+    map<string, Span<const double>> columns;
+    columns["x"] = Span<const double>{ xs.data(), xs.size() };
+    columns["y"] = Span<const double>{ ys.data(), ys.size() };
+    map<string, Interval> ranges;
+    ranges["x"] = X;
+    ranges["y"] = Y;
+
+    cout << "\n--- Range over x in [1, 90], y in [0.5, 40] ---" << endl;
+    for (const char* expression : expressions) {
+        auto start = chrono::steady_clock::now();
+        calc.evaluateBatch(expression, columns, Span<double>{ results.data(), results.size() });
+        double low = *min_element(results.begin(), results.end());
+        double high = *max_element(results.begin(), results.end());
+        double sampling = secondsSince(start);
+
+        start = chrono::steady_clock::now();
+        Interval once = calc.bound(expression, ranges);
+        double single = secondsSince(start);
+
+        start = chrono::steady_clock::now();
+        RangeBounds range = calc.boundRange(expression, ranges);
+        double search = secondsSince(start);
+        bool contained = range.minimum.lo <= low && range.maximum.hi >= high;
+
+        cout << expression << endl << fixed << setprecision(4)
+             << "  1M samples         " << setw(10) << sampling * 1e3 << " ms  [" << low << ", " << high << "]" << endl
+             << "  one interval       " << setw(10) << single * 1e3 << " ms  [" << once.lo << ", " << once.hi << "]" << endl
+             << "  branch and bound   " << setw(10) << search * 1e3 << " ms  [" << range.minimum.lo << ", "
+             << range.maximum.hi << "] in " << range.boxes << " boxes"
+             << (contained ? "" : "  (DOES NOT CONTAIN SAMPLES)") << endl;
+    }
+}
+
+// Error and speed of each accuracy tier. Errors are measured against a
+// long double reference (libm's own error is the "exact" row), one value
+// at a time and in batches, and checked against the tier's bound. Then
+// whole formulas are timed per tier.
+void benchmarkAccuracy() {
+    struct Case {
+        OpCode op;
+        double low, high;
+        bool logarithmic;                       // Sample exponents uniformly
+        long double (*reference)(long double);
+    };
+    // Degrees reduced to [-45, 45] before conversion, so results near zero
+    // keep their relative precision: x = r + 90k
+    static auto quadrant = [](long double x, long double& r) {
+        long double k = nearbyintl(x / 90);
+        r = (x - 90 * k) * (3.141592653589793238462643383279502884L / 180);
+        return static_cast<int>(k - 4 * floorl(k / 4));
+    };
+    const Case cases[] = {
+        { OP_SIN, -720, 720, false, [](long double x) {
+              long double r;
+              int q = quadrant(x, r);
+              long double v = q % 2 ? cosl(r) : sinl(r);
+              return q >= 2 ? -v : v;
+          } },
+        { OP_COS, -720, 720, false, [](long double x) {
+              long double r;
+              int q = quadrant(x, r);
+              long double v = q % 2 ? sinl(r) : cosl(r);
+              return q == 1 || q == 2 ? -v : v;
+          } },
+        { OP_TAN, -720, 720, false, [](long double x) {
+              long double r;
+              int q = quadrant(x, r);
+              return q % 2 ? -1 / tanl(r) : tanl(r);
+          } },
+        { OP_LOG, 1e-6, 1e12, true, [](long double x) { return log10l(x); } },
+        { OP_LN, 1e-6, 1e12, true, [](long double x) { return logl(x); } },
+        { OP_EXP, -300, 300, false, [](long double x) { return expl(x); } }
+    };
+    const size_t SAMPLES = 1 << 20;
+
+    mt19937_64 rng(2025);
+    vector<double> inputs(SAMPLES), outputs(SAMPLES);
+
+    cout << "\n--- Accuracy tiers (" << SAMPLES << " random inputs per function) ---" << endl;
+    cout << "function tier     max ulps  max rel error  ns/call  ns/value (batch)" << endl;
+    for (const Case& c : cases) {
+        for (double& x : inputs) {
+            double u = uniform_real_distribution<double>(0, 1)(rng);
+            x = c.logarithmic ? exp(log(c.low) + u * (log(c.high) - log(c.low))) : c.low + u * (c.high - c.low);
+        }
+
+        for (int tier = 0; tier < ACCURACY_COUNT; tier++) {
+            UnaryFunction function = MATH_KERNELS[tier].unary[c.op];
+
+            volatile double sink = 0;
+            auto start = chrono::steady_clock::now();
+            for (double x : inputs) sink = sink + function(x);
+            double scalar = secondsSince(start);
+
+            start = chrono::steady_clock::now();
+            applyFunctionBatch(inputs.data(), outputs.data(), SAMPLES, c.op, static_cast<MathAccuracy>(tier));
+            double batch = secondsSince(start);
+            sink = sink + outputs[SAMPLES / 2];
+
+            double maxUlps = 0;
+            double maxRelative = 0;
+            for (size_t i = 0; i < SAMPLES; i++) {
+                long double expected = c.reference(inputs[i]);
+                double rounded = static_cast<double>(expected);
+                if (rounded == 0 || !isfinite(rounded)) continue;
+                double error = static_cast<double>(max(fabsl(function(inputs[i]) - expected),
+                                                       fabsl(outputs[i] - expected)));
+                maxUlps = max(maxUlps, error / fabs(nextafter(rounded, INF) - rounded));
+                maxRelative = max(maxRelative, error / fabs(rounded));
+            }
+            string what = string(OP_TABLE[c.op].name) + " " + ACCURACY_NAMES[tier];
+            if (tier == ACCURACY_ULP) {
+                double bound = c.op == OP_TAN ? ULP_TIER_MAX_ULPS_TAN : ULP_TIER_MAX_ULPS;
+                benchmarkCheck(maxUlps <= bound, what + " within " + to_string(bound) + " ulps");
+            } else if (tier == ACCURACY_FAST) {
+                benchmarkCheck(maxRelative < FAST_TIER_MAX_RELATIVE, what + " relative error below 1e-7");
+            }
+
+            cout << left << setw(9) << OP_TABLE[c.op].name << setw(6) << ACCURACY_NAMES[tier] << right
+                 << fixed << setprecision(2) << setw(11) << maxUlps
+                 << scientific << setprecision(1) << setw(15) << maxRelative
+                 << fixed << setprecision(2) << setw(9) << scalar * 1e9 / SAMPLES
+                 << setw(10) << batch * 1e9 / SAMPLES << endl;
+        }
+    }
+
+    const char* expressions[] = {
+        "sin(x) * cos(y) + tan(x / 3)",
+        "ln(x) + log(y) * exp(0 - x / 100)",
+        "sqrt(x^2 + y^2) * sin(x + y)"
+    };
+    const size_t ROWS = 1 << 20;
+    const size_t ITERATIONS = 2000000;
+    vector<double> xs(ROWS), ys(ROWS), results(ROWS);
+    for (size_t i = 0; i < ROWS; i++) {
+        xs[i] = 1 + 89.0 * i / ROWS;
+        ys[i] = 1 + 359.0 * (ROWS - i) / ROWS;
+    }
+    map<string, Span<const double>> columns;
+    columns["x"] = Span<const double>{ xs.data(), xs.size() };
+    columns["y"] = Span<const double>{ ys.data(), ys.size() };
+
+    // Whole formulas gain less than their functions: the interpreter's own
+    // work is the same in every tier, and sqrt, arithmetic and glibc's
+    // ln and exp are already fast. Batches gain about 1.5-2x and single
+    // evaluations less, short of the 3-5x the tiers were meant to reach.
+    cout << "\n--- Formulas by accuracy tier (speedup over exact) ---" << endl;
+    for (const char* expression : expressions) {
+        cout << expression << endl;
+        double exactScalar = 0;
+        double exactBatch = 0;
+        for (int tier = 0; tier < ACCURACY_COUNT; tier++) {
+            ScientificCalculator calc;
+            calc.setAccuracy(static_cast<MathAccuracy>(tier));
+            vector<double> values = benchmarkValues(calc);
+            CompiledExpression program = calc.compile(expression);
+            uint32_t x = calc.variableSlot("x");
+            uint32_t y = calc.variableSlot("y");
+
+            // Single evaluations take the batch's rows in turn, as one
+            // repeated input would favour libm's fast paths
+            volatile double sink = 0;
+            auto start = chrono::steady_clock::now();
+            for (size_t i = 0; i < ITERATIONS; i++) {
+                values[x] = xs[i % ROWS];
+                values[y] = ys[i % ROWS];
+                sink = sink + program.evaluate(values.data(), calc.getAccuracy());
+            }
+            double scalar = secondsSince(start);
+
+            start = chrono::steady_clock::now();
+            calc.evaluateBatch(expression, columns, Span<double>{ results.data(), results.size() });
+            double batch = secondsSince(start);
+
+            if (tier == ACCURACY_EXACT) {
+                exactScalar = scalar;
+                exactBatch = batch;
             }
-            output.push(operators.top());
-            operators.pop();
+            cout << "  " << left << setw(6) << ACCURACY_NAMES[tier] << right << fixed
+                 << setprecision(1) << setw(8) << scalar * 1e9 / ITERATIONS << " ns/eval ("
+                 << setprecision(2) << exactScalar / scalar << "x) "
+                 << setprecision(1) << setw(8) << batch * 1e9 / ROWS << " ns/row batch ("
+                 << setprecision(2) << exactBatch / batch << "x)" << endl;
         }
+    }
+}
+
+// Lookup by name versus slot-indexed reads with many variables defined
+void benchmarkVariableLookup() {
+    ScientificCalculator calc;
+    const size_t VARIABLES = 5000;
+    const size_t ITERATIONS = 1000000;
 
-        return output;
+    map<string, double> bindings;
+    for (size_t i = 0; i < VARIABLES; i++) {
+        bindings[benchmarkVariableName(i)] = static_cast<double>(i);
+    }
+    for (const auto& pair : bindings) {
+        calc.variableSlot(pair.first);
+    }
+    vector<double> values(calc.getVariables().size());
+    for (const auto& pair : bindings) {
+        values[calc.variableSlot(pair.first)] = pair.second;
     }
 
-    // Apply binary operation
-    double applyBinaryOperator(double a, double b, const string& op) {
-        if (op == "+") return a + b;
-        if (op == "-") return a - b;
-        if (op == "*") return a * b;
-        if (op == "/") {
-            if (b == 0) throw runtime_error("Division by zero!");
-            return a / b;
-        }
-        if (op == "%") {
-            if (b == 0) throw runtime_error("Modulo by zero!");
-            return fmod(a, b);
-        }
-        if (op == "^") return pow(a, b);
+    string expression = benchmarkVariableName(17) + " * " + benchmarkVariableName(1234) + " + " +
+                        benchmarkVariableName(2500) + " * " + benchmarkVariableName(3999) + " - " +
+                        benchmarkVariableName(4242) + " / " + benchmarkVariableName(777) + " + " +
+                        benchmarkVariableName(4998) + " * " + benchmarkVariableName(42);
+    CompiledExpression program = calc.compile(expression);
 
-        throw runtime_error("Unknown operator: " + op);
+    volatile double sink = 0;
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < ITERATIONS; i++) {
+        sink = sink + program.evaluate(bindings);
     }
+    double byName = secondsSince(start);
 
-    // Apply function
-    double applyFunction(double value, const string& func) {
-        if (func == "sin") return sin(value * M_PI / 180.0); // Degrees to radians
-        if (func == "cos") return cos(value * M_PI / 180.0);
-        if (func == "tan") return tan(value * M_PI / 180.0);
-        if (func == "log") {
-            if (value <= 0) throw runtime_error("log: value must be positive!");
-            return log10(value);
-        }
-        if (func == "ln") {
-            if (value <= 0) throw runtime_error("ln: value must be positive!");
-            return log(value);
-        }
-        if (func == "sqrt") {
-            if (value < 0) throw runtime_error("sqrt: value must be non-negative!");
-            return sqrt(value);
-        }
-        if (func == "abs") return fabs(value);
-        if (func == "exp") return exp(value);
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < ITERATIONS; i++) {
+        sink = sink + program.evaluate(values.data());
+    }
+    double bySlot = secondsSince(start);
+
+    cout << "\n--- Variable lookup (" << VARIABLES << " variables, "
+         << program.getVariableNames().size() << " read per eval) ---" << endl;
+    cout << fixed << setprecision(1) << "by name " << byName * 1e9 / ITERATIONS
+         << " ns/eval, by slot " << bySlot * 1e9 / ITERATIONS << " ns/eval ("
+         << setprecision(2) << byName / bySlot << "x)" << endl;
+}
+
+// Reassigning the head of a chain of formulas recomputes the chain, while
+// an unrelated assignment costs the same however long the chain is. An
+// assignment that reads its own variable updates it once.
+void benchmarkFormulas() {
+    const size_t CHAIN = 20000;
+    const size_t ASSIGNMENTS = 100000;
+
+    ScientificCalculator calc;
+    calc.setEcho(false);
+    calc.calculate(benchmarkVariableName(0) + " = 1");
+    for (size_t i = 1; i < CHAIN; i++) {
+        calc.calculate(benchmarkVariableName(i) + " = " + benchmarkVariableName(i - 1) + " + 1");
+    }
+    auto start = chrono::steady_clock::now();
+    calc.calculate(benchmarkVariableName(0) + " = 2");
+    double chained = secondsSince(start);
+    benchmarkCheck(calc.evaluate(benchmarkVariableName(CHAIN - 1)) == CHAIN + 1, "chain not recomputed");
 
-        throw runtime_error("Unknown function: " + func);
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < ASSIGNMENTS; i++) {
+        calc.calculate("w = " + to_string(i % 100));
     }
+    double unrelated = secondsSince(start);
 
-    // Evaluate postfix expression
-    double evaluatePostfix(queue<Token> postfix) {
-        stack<double> values;
+    calc.calculate("x = 2");
+    calc.calculate("x = x + 1");
+    calc.calculate("y = x * 2");
+    calc.calculate("x = x + 1");
+    benchmarkCheck(calc.evaluate("x") == 4 && calc.evaluate("y") == 8, "x = x + 1 did not update x once");
 
-        while (!postfix.empty()) {
-            Token token = postfix.front();
-            postfix.pop();
+    cout << "\n--- Formulas (chain of " << CHAIN << ") ---" << endl;
+    cout << fixed << setprecision(1) << "reassign head: " << chained * 1e3 << " ms, unrelated assignment: "
+         << unrelated * 1e9 / ASSIGNMENTS << " ns" << endl;
+}
 
-            switch (token.type) {
-                case NUMBER:
-                    values.push(token.numValue);
-                    break;
+// Closed-loop load on the server: each client sends a request, waits for
+// the reply, then sends the next. One request in 100 is an assignment.
+void benchmarkServer() {
+    const size_t CLIENTS = 16;
+    const size_t REQUESTS_PER_CLIENT = 20000;
+    const size_t EXPRESSION_COUNT = sizeof(BENCHMARK_EXPRESSIONS) / sizeof(BENCHMARK_EXPRESSIONS[0]);
 
-                case OPERATOR: {
-                    if (values.size() < 2) {
-                        throw runtime_error("Invalid expression!");
-                    }
-                    double b = values.top(); values.pop();
-                    double a = values.top(); values.pop();
-                    double result = applyBinaryOperator(a, b, token.value);
-                    values.push(result);
-                    break;
-                }
+    cout << "\n--- Server load (" << CLIENTS << " clients, "
+         << REQUESTS_PER_CLIENT << " requests each) ---" << endl;
+    for (size_t threadCount : { 1, 2, 4, 8 }) {
+        ExpressionServer server(threadCount);
+        server.submit("x = 10").get();
+        server.submit("y = 20").get();
 
-                case FUNCTION: {
-                    if (values.empty()) {
-                        throw runtime_error("Invalid expression!");
-                    }
-                    double value = values.top(); values.pop();
-                    double result = applyFunction(value, token.value);
-                    values.push(result);
-                    break;
+        vector<vector<double>> latencies(CLIENTS);
+        vector<thread> clients;
+        auto start = chrono::steady_clock::now();
+        for (size_t c = 0; c < CLIENTS; c++) {
+            clients.emplace_back([&, c] {
+                latencies[c].reserve(REQUESTS_PER_CLIENT);
+                for (size_t i = 0; i < REQUESTS_PER_CLIENT; i++) {
+                    string request = (i % 100 == 99) ? "x = " + to_string(i % 7 + 1)
+                                                     : BENCHMARK_EXPRESSIONS[(c + i) % EXPRESSION_COUNT];
+                    auto sent = chrono::steady_clock::now();
+                    server.submit(request).get();
+                    latencies[c].push_back(secondsSince(sent));
                 }
-
-                default:
-                    throw runtime_error("Unexpected token in postfix!");
-            }
+            });
         }
+        for (thread& client : clients) {
+            client.join();
+        }
+        double seconds = secondsSince(start);
 
-        if (values.size() != 1) {
-            throw runtime_error("Invalid expression!");
+        vector<double> all;
+        for (const vector<double>& client : latencies) {
+            all.insert(all.end(), client.begin(), client.end());
         }
+        sort(all.begin(), all.end());
 
-        return values.top();
+        cout << setw(2) << threadCount << " threads: " << fixed << setprecision(0)
+             << setw(9) << all.size() / seconds << " evals/s, p50 "
+             << setprecision(1) << setw(6) << all[all.size() / 2] * 1e6 << " us, p99 "
+             << setw(6) << all[all.size() * 99 / 100] * 1e6 << " us" << endl;
     }
 
-public:
-    // Constructor
-    ScientificCalculator() {
-        initializeOperators();
-        // Initialize some common constants
-        variables["pi"] = M_PI;
-        variables["e"] = M_E;
+    // Each assignment publishes the variables; only the blocks it wrote
+    // are copied, so its cost should not grow with the table
+    const size_t ASSIGNMENTS = 2000;
+    for (size_t variables : { 100, 20000 }) {
+        ExpressionServer server(1);
+        for (size_t i = 0; i < variables; i++) {
+            server.submit(benchmarkVariableName(i) + " = 1").get();
+        }
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < ASSIGNMENTS; i++) {
+            server.submit("x = " + to_string(i)).get();
+            server.submit("x + 1").get();
+        }
+        cout << setw(5) << variables << " variables: assignment and read " << fixed << setprecision(1)
+             << setw(6) << secondsSince(start) * 1e6 / ASSIGNMENTS << " us" << endl;
     }
+}
 
-    // Main calculation function
-    double calculate(const string& expression) {
-        try {
-            // Check if it's a variable assignment
-            size_t equalPos = expression.find('=');
-            if (equalPos != string::npos) {
-                string varName = expression.substr(0, equalPos);
-                string varExpr = expression.substr(equalPos + 1);
 
-                // Remove whitespace from variable name
-                varName.erase(remove_if(varName.begin(), varName.end(), ::isspace), varName.end());
+// Random well-formed expressions for the parser benchmarks. The first
+// operand at each level is nested (parentheses or a function call), so
+// depth is exact. Variables are benchmarkVariableName(0..variables-1).
+class ExpressionGenerator {
+private:
+    mt19937 rng;
+    size_t variableCount;
 
-                // Calculate the value
-                double value = calculate(varExpr);
-                variables[varName] = value;
+    size_t pick(size_t count) {
+        return uniform_int_distribution<size_t>(0, count - 1)(rng);
+    }
 
-                cout << varName << " = " << value << endl;
-                return value;
+    void appendLeaf(string& out) {
+        if (variableCount > 0 && pick(2) == 0) {
+            out += benchmarkVariableName(pick(variableCount));
+        } else {
+            out += to_string(pick(999) + 1);
+            if (pick(2) == 0) {
+                out += '.';
+                out += static_cast<char>('0' + pick(10));
             }
+        }
+    }
 
-            // Tokenize
-            vector<Token> tokens = tokenize(expression);
-
-            // Convert to postfix
-            queue<Token> postfix = infixToPostfix(tokens);
+    // Functions that take any argument without throwing
+    void appendNested(string& out, size_t depth) {
+        static const char* OPENERS[] = { "(", "sin(", "cos(", "abs(", "sqrt(abs(", "ln(abs(" };
+        static const char* CLOSERS[] = { ")", ")", ")", ")", "))", ") + 1)" };
+        size_t kind = pick(6);
+        out += OPENERS[kind];
+        appendTerms(out, depth - 1, 2 + pick(2));
+        out += CLOSERS[kind];
+    }
 
-            // Evaluate
-            double result = evaluatePostfix(postfix);
+    void appendTerms(string& out, size_t depth, size_t terms) {
+        static const char* OPERATORS[] = { " + ", " - ", " * ", " / " };
+        for (size_t i = 0; i < terms; i++) {
+            if (i > 0) {
+                out += OPERATORS[pick(4)];
+            }
+            if (depth > 0 && (i == 0 || pick(3) == 0)) {
+                appendNested(out, depth);
+            } else {
+                appendLeaf(out);
+            }
+            if (pick(16) == 0) {
+                out += " ^ 2";
+            }
+        }
+    }
 
-            // Add to history
-            stringstream ss;
-            ss << expression << " = " << fixed << setprecision(6) << result;
-            history.push_back(ss.str());
+public:
+    ExpressionGenerator(uint32_t seed, size_t variables) : rng(seed), variableCount(variables) {}
 
-            return result;
+    string generate(size_t depth, size_t terms) {
+        string out;
+        appendTerms(out, depth, terms);
+        return out;
+    }
+};
 
-        } catch (const exception& e) {
-            throw runtime_error(string("Error: ") + e.what());
+// Generated expressions that compile and evaluate without error
+// (division by an operand that happens to be zero is regenerated)
+vector<string> benchmarkCorpus(ScientificCalculator& calc, const vector<double>& values,
+                               size_t depth, size_t terms, size_t variables, size_t count) {
+    ExpressionGenerator generator(static_cast<uint32_t>(depth * 1000003 + terms * 1009 + variables),
+                                  variables);
+    vector<string> corpus;
+    while (corpus.size() < count) {
+        string expression = generator.generate(depth, terms);
+        try {
+            calc.compile(expression).evaluate(values.data());
+            corpus.push_back(expression);
+        } catch (const exception&) {
         }
     }
+    return corpus;
+}
 
-    // Display all variables
-    void displayVariables() {
-        cout << "\n========================================" << endl;
-        cout << "STORED VARIABLES" << endl;
-        cout << "========================================" << endl;
+// Cost of each compile stage per character, and of evaluation, over
+// generated corpora. Stages are timed cumulatively and differenced.
+void benchmarkParserStages() {
+    struct Corpus { const char* axis; size_t depth, terms, variables; };
+    const Corpus CORPORA[] = {
+        { "depth", 0, 8, 4 }, { "depth", 2, 8, 4 }, { "depth", 4, 8, 4 }, { "depth", 8, 8, 4 },
+        { "length", 1, 4, 4 }, { "length", 1, 32, 4 }, { "length", 1, 256, 4 },
+        { "variables", 1, 32, 0 }, { "variables", 1, 32, 64 }, { "variables", 1, 32, 4096 }
+    };
+    const size_t EXPRESSIONS = 200;
+    const size_t CHARACTERS = 1000000;     // Per stage, summed over repeats
 
-        if (variables.empty()) {
-            cout << "No variables defined." << endl;
-        } else {
-            for (const auto& pair : variables) {
-                cout << left << setw(10) << pair.first << " = "
-                     << fixed << setprecision(6) << pair.second << endl;
-            }
+    cout << "\n--- Parser stages (ns/char; eval in ns/expression) ---" << endl;
+    cout << left << setw(24) << "corpus" << right << setw(7) << "chars" << setw(10) << "tokenize"
+         << setw(8) << "parse" << setw(10) << "optimize" << setw(10) << "eval" << endl;
+    for (const Corpus& c : CORPORA) {
+        ScientificCalculator calc;
+        for (size_t i = 0; i < c.variables; i++) {
+            calc.variableSlot(benchmarkVariableName(i));
         }
-        cout << "========================================\n" << endl;
-    }
+        vector<double> values(calc.getVariables().size(), 1.5);
+        vector<string> corpus = benchmarkCorpus(calc, values, c.depth, c.terms, c.variables, EXPRESSIONS);
 
-    // Display calculation history
-    void displayHistory() {
-        cout << "\n========================================" << endl;
-        cout << "CALCULATION HISTORY" << endl;
-        cout << "========================================" << endl;
+        size_t corpusChars = 0;
+        vector<CompiledExpression> programs;
+        for (const string& expression : corpus) {
+            corpusChars += expression.size();
+            programs.push_back(calc.compile(expression));
+        }
+        size_t repeats = max<size_t>(1, CHARACTERS / corpusChars);
 
-        if (history.empty()) {
-            cout << "No calculations yet." << endl;
-        } else {
-            for (size_t i = 0; i < history.size(); i++) {
-                cout << i + 1 << ". " << history[i] << endl;
+        // Cumulative time through stage 1..3 (tokenize, parse, optimize)
+        double cumulative[3];
+        for (int stage = 0; stage < 3; stage++) {
+            volatile size_t sink = 0;
+            auto start = chrono::steady_clock::now();
+            for (size_t r = 0; r < repeats; r++) {
+                for (const string& expression : corpus) {
+                    const vector<Token>& tokens = calc.tokenize(expression);
+                    if (stage == 0) {
+                        sink = sink + tokens.size();
+                        continue;
+                    }
+                    CompiledExpression program = calc.parseProgram(tokens);
+                    if (stage == 2) {
+                        program = ExpressionOptimizer::optimize(program);
+                    }
+                    sink = sink + program.getCode().size();
+                }
             }
+            cumulative[stage] = secondsSince(start);
         }
-        cout << "========================================\n" << endl;
-    }
 
-    // Clear history
-    void clearHistory() {
-        history.clear();
-        cout << "History cleared!" << endl;
+        size_t passes = 0;
+        volatile double sink = 0;
+        auto start = chrono::steady_clock::now();
+        do {
+            for (const CompiledExpression& program : programs) {
+                sink = sink + program.evaluate(values.data());
+            }
+            passes++;
+        } while (secondsSince(start) < 0.2);
+        double evaluation = secondsSince(start);
+
+        double chars = static_cast<double>(corpusChars) * repeats;
+        ostringstream label;
+        label << c.axis << " (d" << c.depth << " t" << c.terms << " v" << c.variables << ")";
+        cout << left << setw(24) << label.str() << right << fixed << setprecision(0)
+             << setw(7) << static_cast<double>(corpusChars) / corpus.size() << setprecision(2)
+             << setw(10) << cumulative[0] * 1e9 / chars
+             << setw(8) << max(0.0, cumulative[1] - cumulative[0]) * 1e9 / chars
+             << setw(10) << max(0.0, cumulative[2] - cumulative[1]) * 1e9 / chars
+             << setprecision(1) << setw(10) << evaluation * 1e9 / (passes * corpus.size()) << endl;
     }
+}
 
-    // Clear variables (except constants)
-    void clearVariables() {
-        double pi_value = variables["pi"];
-        double e_value = variables["e"];
-        variables.clear();
-        variables["pi"] = pi_value;
-        variables["e"] = e_value;
-        cout << "Variables cleared!" << endl;
+// Seconds per character to compile and evaluate an expression, repeated
+// until the measurement is long enough to trust
+double compileSecondsPerChar(ScientificCalculator& calc, const string& expression,
+                             const vector<double>& values) {
+    size_t runs = 0;
+    volatile double sink = 0;
+    auto start = chrono::steady_clock::now();
+    do {
+        try {
+            sink = sink + calc.compile(expression).evaluate(values.data());
+        } catch (const exception&) {
+        }
+        runs++;
+    } while (secondsSince(start) < 0.02);
+    return secondsSince(start) / (runs * expression.size());
+}
+
+// Compile + evaluate time must grow linearly with input length. Inputs
+// double in size; the cost per character should stay flat.
+void benchmarkScaling() {
+    const size_t STEPS = 8;
+    const double MAX_GROWTH = 3;     // Allowed per-char slowdown, largest vs smallest
+
+    ScientificCalculator calc;
+    for (size_t i = 0; i < 16; i++) {
+        calc.variableSlot(benchmarkVariableName(i));
     }
+    vector<double> values(calc.getVariables().size(), 1.5);
+    ExpressionGenerator generator(14, 16);
 
-    // Unit conversion menu
-    void unitConversion() {
-        cout << "\n========================================" << endl;
-        cout << "UNIT CONVERSION" << endl;
-        cout << "========================================" << endl;
-        cout << "1. Temperature (Celsius <-> Fahrenheit)" << endl;
-        cout << "2. Length (Meters <-> Feet)" << endl;
-        cout << "3. Weight (Kilograms <-> Pounds)" << endl;
-        cout << "4. Back to main menu" << endl;
-        cout << "========================================" << endl;
+    struct Shape { const char* name; function<string(size_t)> make; };
+    const Shape SHAPES[] = {
+        { "long sums", [&](size_t n) { return generator.generate(1, 16 * n); } },
+        { "nested parentheses", [](size_t n) {
+            return string(64 * n, '(') + "1" + string(64 * n, ')'); } },
+        { "nested functions", [](size_t n) {
+            string out;
+            for (size_t i = 0; i < 32 * n; i++) out += "abs(";
+            return out + "2" + string(32 * n, ')'); } },
+        { "right-assoc powers", [](size_t n) {
+            string out = "1";
+            for (size_t i = 0; i < 64 * n; i++) out += " ^ 1";
+            return out; } },
+        { "unbalanced", [](size_t n) { return string(64 * n, '(') + "1 +"; } }
+    };
 
-        int choice;
-        double value, result;
+    cout << "\n--- Scaling (ns/char at 1x .. " << (1 << (STEPS - 1)) << "x length) ---" << endl;
+    for (const Shape& shape : SHAPES) {
+        cout << left << setw(20) << shape.name << right << fixed << setprecision(1);
+        double first = 0, last = 0;
+        for (size_t step = 0; step < STEPS; step++) {
+            last = compileSecondsPerChar(calc, shape.make(size_t(1) << step), values) * 1e9;
+            if (step == 0) first = last;
+            cout << setw(7) << last;
+        }
+        cout << (last > MAX_GROWTH * first ? "  NOT LINEAR" : "  linear") << endl;
+    }
+}
 
-        cout << "Enter choice: ";
-        cin >> choice;
+// Column conversion through the unit matrix versus converting one value
+// per call by symbol, as the menu does
+void benchmarkUnits() {
+    ScientificCalculator calc;
+    const size_t VALUES = 1 << 24;
+    const size_t SINGLE_CALLS = 1 << 20;
+    vector<double> input(VALUES);
+    for (size_t i = 0; i < VALUES; i++) {
+        input[i] = -40.0 + static_cast<double>(i % 10000) * 0.01;
+    }
+    vector<double> output(VALUES);
 
-        switch (choice) {
-            case 1:
-                cout << "1. Celsius to Fahrenheit\n2. Fahrenheit to Celsius" << endl;
-                int tempChoice;
-                cin >> tempChoice;
-                cout << "Enter value: ";
-                cin >> value;
-
-                if (tempChoice == 1) {
-                    result = (value * 9.0 / 5.0) + 32.0;
-                    cout << value << "C = " << result << "F" << endl;
-                } else {
-                    result = (value - 32.0) * 5.0 / 9.0;
-                    cout << value << "F = " << result << "C" << endl;
-                }
-                break;
+    volatile double sink = 0;
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < SINGLE_CALLS; i++) {
+        sink = sink + calc.convertUnits(input[i], "C", "F");
+    }
+    double single = secondsSince(start) / SINGLE_CALLS;
 
-            case 2:
-                cout << "1. Meters to Feet\n2. Feet to Meters" << endl;
-                int lengthChoice;
-                cin >> lengthChoice;
-                cout << "Enter value: ";
-                cin >> value;
-
-                if (lengthChoice == 1) {
-                    result = value * 3.28084;
-                    cout << value << "m = " << result << "ft" << endl;
-                } else {
-                    result = value / 3.28084;
-                    cout << value << "ft = " << result << "m" << endl;
-                }
-                break;
+    start = chrono::steady_clock::now();
+    calc.convertUnits(input, output, "C", "F");
+    double column = secondsSince(start) / VALUES;
 
-            case 3:
-                cout << "1. Kilograms to Pounds\n2. Pounds to Kilograms" << endl;
-                int weightChoice;
-                cin >> weightChoice;
-                cout << "Enter value: ";
-                cin >> value;
-
-                if (weightChoice == 1) {
-                    result = value * 2.20462;
-                    cout << value << "kg = " << result << "lbs" << endl;
-                } else {
-                    result = value / 2.20462;
-                    cout << value << "lbs = " << result << "kg" << endl;
-                }
-                break;
+    double maxError = 0;
+    for (size_t i = 0; i < VALUES; i++) {
+        maxError = max(maxError, fabs(output[i] - (input[i] * 9.0 / 5.0 + 32.0)));
+    }
 
-            case 4:
-                return;
+    cout << "\n--- Unit conversion (C -> F) ---" << endl;
+    cout << fixed << setprecision(1) << "per call " << 1e-6 / single << " M values/s, column "
+         << 1e-6 / column << " M values/s (" << setprecision(0) << single / column << "x), "
+         << "max error " << scientific << setprecision(1) << maxError << defaultfloat << endl;
+}
 
-            default:
-                cout << "Invalid choice!" << endl;
+// Run every benchmark whose name contains filter (all when empty);
+// false if any of their checks failed
+bool runBenchmarks(const string& filter) {
+    const pair<const char*, void (*)()> BENCHMARKS[] = {
+        { "evaluation", benchmarkEvaluation },
+        { "compilation", benchmarkCompilation },
+        { "native", benchmarkNativeBackend },
+        { "optimizer", benchmarkOptimizer },
+        { "lookup", benchmarkVariableLookup },
+        { "formulas", benchmarkFormulas },
+        { "gradient", benchmarkGradient },
+        { "numerical", benchmarkNumerical },
+        { "interval", benchmarkIntervals },
+        { "accuracy", benchmarkAccuracy },
+        { "snapshot", benchmarkSnapshot },
+        { "server", benchmarkServer },
+        { "parser", benchmarkParserStages },
+        { "scaling", benchmarkScaling },
+        { "units", benchmarkUnits }
+    };
+
+    cout << "\n========================================" << endl;
+    cout << "CALCULATOR BENCHMARKS" << endl;
+    cout << "========================================" << endl;
+    for (const auto& benchmark : BENCHMARKS) {
+        if (string(benchmark.first).find(filter) != string::npos) {
+            benchmark.second();
         }
     }
+    cout << "========================================\n" << endl;
+    return !benchmarkFailed;
+}
 
-    // Help display
-    void displayHelp() {
-        cout << "\n========================================" << endl;
-        cout << "CALCULATOR HELP" << endl;
-        cout << "========================================" << endl;
-        cout << "\nOPERATORS:" << endl;
-        cout << "  +    Addition" << endl;
-        cout << "  -    Subtraction" << endl;
-        cout << "  *    Multiplication" << endl;
-        cout << "  /    Division" << endl;
-        cout << "  %    Modulo" << endl;
-        cout << "  ^    Power" << endl;
+// ========================================
+// FUZZ TARGET
+// Build with clang and libFuzzer (which supplies main):
+//   clang++ -std=c++17 -pthread -O1 -g -DCALCULATOR_FUZZER
+//           -fsanitize=fuzzer,address,undefined calculator.cpp -o calculator_fuzz
+// ========================================
+#ifdef CALCULATOR_FUZZER
 
-        cout << "\nFUNCTIONS:" << endl;
-        cout << "  sin(x)   Sine (degrees)" << endl;
-        cout << "  cos(x)   Cosine (degrees)" << endl;
-        cout << "  tan(x)   Tangent (degrees)" << endl;
-        cout << "  log(x)   Base-10 logarithm" << endl;
-        cout << "  ln(x)    Natural logarithm" << endl;
-        cout << "  sqrt(x)  Square root" << endl;
-        cout << "  abs(x)   Absolute value" << endl;
-        cout << "  exp(x)   e^x" << endl;
+const double FUZZ_MIN_TIMED_SECONDS = 1e-3;    // Shorter runs are too noisy to compare
+const double FUZZ_MAX_GROWTH = 8;              // Twice the input: linear ~2x, quadratic ~4x
 
-        cout << "\nCONSTANTS:" << endl;
-        cout << "  pi       3.14159..." << endl;
-        cout << "  e        2.71828..." << endl;
+double fuzzCalculate(ScientificCalculator& calc, const string& input) {
+    auto start = chrono::steady_clock::now();
+    try {
+        calc.calculate(input);
+    } catch (const exception&) {
+        // Errors are expected; crashes and hangs are not
+    }
+    return secondsSince(start);
+}
 
-        cout << "\nVARIABLES:" << endl;
-        cout << "  x = 5        Assign value to variable" << endl;
-        cout << "  y = x * 2    Use variables in expressions" << endl;
+// Any input may be rejected but must not crash. A slow expression is run
+// again doubled, as (input) + (input), which must cost about twice as much.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    string input(reinterpret_cast<const char*>(data), size);
+    ScientificCalculator calc;
+    calc.setEcho(false);
+    double seconds = fuzzCalculate(calc, input);
 
-        cout << "\nEXAMPLES:" << endl;
-        cout << "  2 + 3 * 4" << endl;
-        cout << "  (2 + 3) * 4" << endl;
-        cout << "  sqrt(16) + log(100)" << endl;
-        cout << "  sin(30) + cos(60)" << endl;
-        cout << "  2 ^ 8" << endl;
-        cout << "  x = 10" << endl;
-        cout << "  y = x * pi" << endl;
-        cout << "========================================\n" << endl;
+    // Assignments can't be doubled, and integrate()/root() cost depends
+    // on the integrand rather than the text
+    bool timed = seconds >= FUZZ_MIN_TIMED_SECONDS && input.find('=') == string::npos &&
+                 input.find("integrate") == string::npos && input.find("root") == string::npos;
+    if (timed) {
+        double doubled = fuzzCalculate(calc, "(" + input + ") + (" + input + ")");
+        if (doubled > FUZZ_MAX_GROWTH * seconds) {
+            cerr << "Non-linear evaluation time: " << seconds << " s for " << size
+                 << " bytes, " << doubled << " s doubled" << endl;
+            abort();
+        }
     }
-};
+    return 0;
+}
+
+#endif
 
 // ========================================
 // MAIN FUNCTION
 // Program entry point
 // ========================================
-int main() {
+#ifndef CALCULATOR_FUZZER
+int main(int argc, char* argv[]) {
+    // Options for any mode, ahead of it:
+    //   calculator [--load state.snap] [--accuracy exact|ulp|fast] [--batch ... | --serve ...]
+    string snapshot;
+    MathAccuracy accuracy = ACCURACY_EXACT;
+    while (argc > 2 && (string(argv[1]) == "--load" || string(argv[1]) == "--accuracy")) {
+        if (string(argv[1]) == "--load") {
+            snapshot = argv[2];
+        } else {
+            accuracy = lookupAccuracy(argv[2]);
+            if (accuracy == ACCURACY_COUNT) {
+                cerr << "Unknown accuracy: " << argv[2] << " (exact, ulp or fast)" << endl;
+                return 1;
+            }
+        }
+        argv[2] = argv[0];
+        argc -= 2;
+        argv += 2;
+    }
+
+    // Benchmarks: calculator --bench [name filter, e.g. parser]
+    if (argc > 1 && string(argv[1]) == "--bench") {
+        return runBenchmarks(argc > 2 ? argv[2] : "") ? 0 : 1;
+    }
+
+    // File of expressions: calculator --batch input.txt [output.txt]
+    if (argc > 1 && string(argv[1]) == "--batch") {
+        if (argc < 3) {
+            cerr << "Usage: " << argv[0] << " --batch input.txt [output.txt]" << endl;
+            return 1;
+        }
+        try {
+            MappedFile input(argv[2]);
+            ofstream file;
+            if (argc > 3) {
+                file.open(argv[3], ios::binary);
+                if (!file) throw runtime_error(string("Cannot create ") + argv[3]);
+            }
+            ostream& out = argc > 3 ? file : cout;
+
+            ScientificCalculator calc;
+            calc.setEcho(false);
+            calc.setAccuracy(accuracy);
+            if (!snapshot.empty()) calc.loadSnapshot(snapshot);
+            size_t parsers = max(thread::hardware_concurrency(), 2u) - 1;
+            BatchProcessor batch(parsers);
+            BatchStats stats = batch.run(calc, input.data(), input.size(), out);
+
+            cerr << stats.lines << " lines (" << stats.assignments << " assignments, "
+                 << stats.errors << " errors) in " << fixed << setprecision(3) << stats.seconds
+                 << " s: " << setprecision(0) << stats.lines / stats.seconds << " lines/s, "
+                 << setprecision(1) << input.size() / stats.seconds / 1e6 << " MB/s ("
+                 << parsers << " parser threads)" << endl;
+        } catch (const exception& e) {
+            cerr << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // Headless server: calculator --serve [socket path]
+    if (argc > 1 && string(argv[1]) == "--serve") {
+        ExpressionServer server(max(thread::hardware_concurrency(), 1u));
+        try {
+            server.setAccuracy(accuracy);
+            if (!snapshot.empty()) server.loadSnapshot(snapshot);
+            if (argc > 2) {
+#ifdef __unix__
+                server.serveSocket(argv[2]);
+#else
+                throw runtime_error("Socket mode needs a Unix system");
+#endif
+            } else {
+                server.serve(cin, cout);
+            }
+        } catch (const exception& e) {
+            cerr << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+
     ScientificCalculator calc;
+    calc.setAccuracy(accuracy);
     int choice;
     string expression;
 
@@ -549,6 +6280,15 @@ int main() {
     cout << "  ADVANCED SCIENTIFIC CALCULATOR" << endl;
     cout << "========================================\n" << endl;
 
+    if (!snapshot.empty()) {
+        try {
+            calc.loadSnapshot(snapshot);
+            cout << "Loaded " << snapshot << endl;
+        } catch (const exception& e) {
+            cout << e.what() << endl;
+        }
+    }
+
     do {
         cout << "\n========== MAIN MENU ==========" << endl;
         cout << "1. Calculate Expression" << endl;
@@ -558,6 +6298,11 @@ int main() {
         cout << "5. Clear Variables" << endl;
         cout << "6. Unit Conversion" << endl;
         cout << "7. Help" << endl;
+        cout << "8. Stream History to File" << endl;
+        cout << "9. Solve Equation" << endl;
+        cout << "10. Save Snapshot" << endl;
+        cout << "11. Load Snapshot" << endl;
+        cout << "12. Function Accuracy (" << ACCURACY_NAMES[calc.getAccuracy()] << ")" << endl;
         cout << "0. Exit" << endl;
         cout << "===============================" << endl;
         cout << "Enter choice: ";
@@ -604,6 +6349,82 @@ int main() {
                 calc.displayHelp();
                 break;
 
+            case 8: {
+                cout << "\nEnter file name (empty to stop streaming): ";
+                string path;
+                getline(cin, path);
+
+                try {
+                    calc.streamHistory(path);
+                    if (path.empty()) {
+                        cout << "History streaming stopped." << endl;
+                    } else {
+                        cout << "Streaming history to " << path << endl;
+                    }
+                } catch (const exception& e) {
+                    cout << e.what() << endl;
+                }
+                break;
+            }
+
+            case 9: {
+                string variable;
+                double guess;
+                cout << "\nEnter equation (e.g. x^2 = 2): ";
+                getline(cin, expression);
+                cout << "Solve for variable: ";
+                getline(cin, variable);
+                cout << "Initial guess: ";
+                cin >> guess;
+                cin.ignore();
+
+                try {
+                    double root = calc.solve(expression, variable, guess);
+                    cout << "\n" << variable << " = " << fixed << setprecision(10) << root << endl;
+                } catch (const exception& e) {
+                    cout << e.what() << endl;
+                }
+                break;
+            }
+
+            case 10:
+            case 11: {
+                cout << "\nEnter snapshot file name: ";
+                string path;
+                getline(cin, path);
+
+                try {
+                    if (choice == 10) {
+                        calc.saveSnapshot(path);
+                        cout << "Saved variables and formulas to " << path << endl;
+                    } else {
+                        calc.loadSnapshot(path);
+                        cout << "Loaded " << path << endl;
+                    }
+                } catch (const exception& e) {
+                    cout << e.what() << endl;
+                }
+                break;
+            }
+
+            case 12: {
+                cout << "\nexact  libm (default)" << endl;
+                cout << "ulp    polynomials within about 1 ulp" << endl;
+                cout << "fast   relative error below 1e-7" << endl;
+                cout << "Enter accuracy: ";
+                string name;
+                getline(cin, name);
+
+                MathAccuracy tier = lookupAccuracy(name);
+                if (tier == ACCURACY_COUNT) {
+                    cout << "Unknown accuracy: " << name << endl;
+                } else {
+                    calc.setAccuracy(tier);
+                    cout << "sin, cos, tan, log, ln and exp now use " << name << " accuracy" << endl;
+                }
+                break;
+            }
+
             case 0:
                 cout << "\nThank you for using the calculator!" << endl;
                 cout << "Goodbye!\n" << endl;
@@ -617,6 +6438,7 @@ int main() {
 
     return 0;
 }
+#endif
 
 /*
  * ========================================
@@ -624,10 +6446,26 @@ int main() {
  * ========================================
  *
  * To compile:
- *   g++ -std=c++11 calculator.cpp -o calculator
+ *   g++ -std=c++17 -pthread calculator.cpp -o calculator
+ *
+ * Batch evaluation uses AVX when the compiler targets it, e.g.:
+ *   g++ -std=c++17 -pthread -O2 -mavx2 calculator.cpp -o calculator
+ *   (the ulp and fast accuracy tiers vectorize too)
  *
  * To run:
  *   ./calculator
+ *   ./calculator --bench      (performance benchmarks; exits with 1 if a check fails)
+ *   ./calculator --bench parser   (only benchmarks whose name matches)
+ *   ./calculator --serve     (one expression per line on stdin)
+ *   ./calculator --serve /tmp/calc.sock   (Unix domain socket)
+ *   ./calculator --batch input.txt [output.txt]   (one result per line)
+ *   ./calculator --load state.snap [--serve | --batch ...]   (start from a snapshot)
+ *   ./calculator --accuracy ulp [--serve | --batch ...]   (exact, ulp or fast)
+ *
+ * Fuzz target for calculate() (needs clang with libFuzzer):
+ *   clang++ -std=c++17 -pthread -O1 -g -DCALCULATOR_FUZZER \
+ *           -fsanitize=fuzzer,address,undefined calculator.cpp -o calculator_fuzz
+ *   ./calculator_fuzz
  *
  * ========================================
  * TESTING SUGGESTIONS:
@@ -649,10 +6487,21 @@ int main() {
  *   x = 10
  *   y = x * 2
  *   result = sqrt(x^2 + y^2)
+ *   x = 3                  (y and result are recomputed)
  *
  * Complex:
  *   (sin(45) + cos(45)) * sqrt(2)
  *   log(100) + ln(e^2)
+ *   2 ^ 3 ^ 2              (right-associative: 512)
+ *
+ * Numerical (f is a formula in x):
+ *   integrate(x^2, 0, 3)             (9)
+ *   root(x^2 - 2, 0, 2)              (1.414214)
+ *   integrate(2 * t, t, 0, 1)        (1; variable named)
+ *   d = integrate(x^2, 0, y)         (recomputed when y changes)
+ *
+ * Solver (menu option 9):
+ *   x^2 = 2, solve for x from 1      (1.4142135624)
  *
  * ========================================
  */